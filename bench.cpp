@@ -0,0 +1,422 @@
+/*
+ * Throughput benchmark: generate synthetic corpora of several shapes, then
+ * parse each with every cursor and spanner available on this machine.
+ *
+ *   make bench && ./bench [megabytes per corpus] [repetitions]
+ *
+ * Corpora are produced by a fixed-seed generator, so runs on different builds
+ * parse identical bytes. Each configuration reports its best repetition.
+ * Cycle counts use the TSC; the remaining counters come from perf_event_open()
+ * where the kernel permits it, and are shown as "-" otherwise.
+ */
+
+#include <chrono>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "csvmonkey.hpp"
+
+using namespace csvmonkey;
+
+
+/*
+ * Corpus generation.
+ */
+
+struct Shape
+{
+    const char *name;
+    int columns;
+    int min_cell;
+    int max_cell;
+    // Percentage of cells that are quoted, and of quoted cells containing an
+    // escaped quote, a delimiter or a newline.
+    int quoted;
+    int special;
+    bool crlf;
+};
+
+
+static const Shape kShapes[] = {
+    {"narrow",   8,    1,    12,   0,    0,  false},
+    {"wide",     300,  0,    8,    0,    0,  false},
+    {"quoted",   12,   4,    24,   80,   30, false},
+    {"crlf",     8,    1,    12,   10,   10, true},
+    {"long",     4,    512,  4096, 20,   5,  false},
+};
+
+
+struct Random
+{
+    uint64_t state;
+
+    explicit Random(uint64_t seed)
+        : state(seed)
+    {
+    }
+
+    uint64_t
+    next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+
+    int
+    range(int lo, int hi)
+    {
+        return lo + (int) (next() % (uint64_t) (hi - lo + 1));
+    }
+};
+
+
+static void
+append_cell(std::string &out, const Shape &shape, Random &random)
+{
+    static const char kAlphabet[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-_:/ ";
+
+    int size = random.range(shape.min_cell, shape.max_cell);
+    bool quoted = random.range(1, 100) <= shape.quoted;
+    if(quoted) {
+        out += '"';
+    }
+    for(int i = 0; i < size; i++) {
+        out += kAlphabet[random.next() % (sizeof kAlphabet - 1)];
+    }
+    if(quoted) {
+        if(random.range(1, 100) <= shape.special) {
+            switch(random.range(0, 2)) {
+            case 0: out += "\"\""; break;
+            case 1: out += ','; break;
+            case 2: out += '\n'; break;
+            }
+        }
+        out += '"';
+    }
+}
+
+
+static std::string
+generate(const Shape &shape, size_t size)
+{
+    Random random(0x9e3779b97f4a7c15ULL ^ shape.columns);
+    std::string out;
+    out.reserve(size + 65536);
+    for(int col = 0; col < shape.columns; col++) {
+        out += (col ? ",c" : "c") + std::to_string(col);
+    }
+    out += shape.crlf ? "\r\n" : "\n";
+
+    while(out.size() < size) {
+        for(int col = 0; col < shape.columns; col++) {
+            if(col) {
+                out += ',';
+            }
+            append_cell(out, shape, random);
+        }
+        out += shape.crlf ? "\r\n" : "\n";
+    }
+    return out;
+}
+
+
+static std::string
+write_corpus(const Shape &shape, size_t size)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    std::string path = std::string(tmpdir ? tmpdir : "/tmp")
+        + "/csvmonkey-bench-" + shape.name + ".csv";
+
+    std::string data = generate(shape, size);
+    std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+    if(! file) {
+        throw Error("bench", "could not write " + path);
+    }
+    return path;
+}
+
+
+/*
+ * Counters.
+ */
+
+static uint64_t
+read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+class Counters
+{
+    public:
+    enum { kInstructions, kBranchMisses, kCacheMisses, kCount };
+
+    Counters()
+    {
+        for(int i = 0; i < kCount; i++) {
+            fds_[i] = -1;
+        }
+#ifdef __linux__
+        static const uint64_t kConfigs[kCount] = {
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_CACHE_MISSES,
+        };
+        for(int i = 0; i < kCount; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof attr);
+            attr.size = sizeof attr;
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = kConfigs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds_[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#endif
+    }
+
+    ~Counters()
+    {
+        for(int i = 0; i < kCount; i++) {
+            if(fds_[i] != -1) {
+                close(fds_[i]);
+            }
+        }
+    }
+
+    void
+    start()
+    {
+#ifdef __linux__
+        for(int i = 0; i < kCount; i++) {
+            if(fds_[i] != -1) {
+                ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void
+    stop(uint64_t *values)
+    {
+        for(int i = 0; i < kCount; i++) {
+            values[i] = 0;
+#ifdef __linux__
+            if(fds_[i] != -1) {
+                ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+                if(read(fds_[i], &values[i], sizeof values[i]) != 8) {
+                    values[i] = 0;
+                }
+            }
+#endif
+        }
+    }
+
+    /**
+     * Format a value of counter i per byte of input, or "-" if the counter
+     * is unavailable.
+     */
+    std::string
+    per_byte(int i, uint64_t value, size_t size) const
+    {
+        if(fds_[i] == -1) {
+            return "-";
+        }
+        char buf[32];
+        snprintf(buf, sizeof buf, "%.3f", (double) value / size);
+        return buf;
+    }
+
+    private:
+    int fds_[kCount];
+};
+
+
+/*
+ * Benchmark driver.
+ */
+
+struct Result
+{
+    double seconds;
+    uint64_t tsc;
+    size_t rows;
+    uint64_t checksum;
+    uint64_t counters[Counters::kCount];
+};
+
+
+/**
+ * Parse every row, touching each cell so that none of the work is dead.
+ */
+static void
+consume_rows(CsvReader &reader, Result &result)
+{
+    result.rows = 0;
+    result.checksum = 0;
+    CsvCursor &row = reader.row();
+    while(reader.read_row()) {
+        result.rows++;
+        for(int i = 0; i < row.count; i++) {
+            result.checksum += row.cells[i].size;
+        }
+    }
+}
+
+
+enum Engine {
+    kEngineFallback,
+    kEngineSse42,
+    kEngineAvx2,
+    kEngineAvx512,
+    kEngineIndex,
+    kEngineCount
+};
+
+
+static const char *const kEngineNames[] = {
+    "fallback", "sse42", "avx2", "avx512", "index"
+};
+
+
+/**
+ * Configure reader for engine, returning false if this build or CPU lacks it.
+ */
+static bool
+use_engine(CsvReader &reader, Engine engine)
+{
+    if(engine == kEngineIndex) {
+        return reader.use_structural_index();
+    }
+    return reader.use_spanner((CsmSpannerType) engine);
+}
+
+
+static bool
+run_reader(StreamCursor &cursor, Engine engine, Counters &counters,
+           Result &result)
+{
+    CsvReader reader(cursor);
+    if(! use_engine(reader, engine)) {
+        return false;
+    }
+
+    counters.start();
+    auto start = std::chrono::steady_clock::now();
+    uint64_t tsc = read_tsc();
+    consume_rows(reader, result);
+    result.tsc = read_tsc() - tsc;
+    result.seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    counters.stop(result.counters);
+    return true;
+}
+
+
+static bool
+run_once(const std::string &path, bool mapped, Engine engine,
+         Counters &counters, Result &result)
+{
+    if(mapped) {
+        MappedFileCursor cursor;
+        cursor.open(path.c_str());
+        return run_reader(cursor, engine, counters, result);
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd == -1) {
+        throw Error("bench", "could not open " + path);
+    }
+    FdStreamCursor cursor(fd);
+    bool ok = run_reader(cursor, engine, counters, result);
+    close(fd);
+    return ok;
+}
+
+
+int main(int argc, char **argv)
+{
+    size_t megabytes = (argc > 1) ? strtoul(argv[1], 0, 10) : 64;
+    int repetitions = (argc > 2) ? atoi(argv[2]) : 3;
+
+    printf("%-8s %-6s %-8s %8s %8s %10s %8s %8s %8s %8s\n",
+           "corpus", "cursor", "engine", "MiB", "GB/s", "rows/s",
+           "tsc/B", "ins/B", "brmis/B", "cmis/B");
+
+    for(const Shape &shape : kShapes) {
+        std::string path;
+        try {
+            path = write_corpus(shape, megabytes << 20);
+        } catch(csvmonkey::Error &e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+
+        struct stat st;
+        stat(path.c_str(), &st);
+        size_t size = st.st_size;
+
+        uint64_t expected = 0;
+        for(int mapped = 1; mapped >= 0; mapped--) {
+            for(int engine = 0; engine < kEngineCount; engine++) {
+                Counters counters;
+                Result best = Result();
+                bool ok = true;
+                for(int rep = 0; ok && rep < repetitions; rep++) {
+                    Result result;
+                    ok = run_once(path, mapped, (Engine) engine, counters,
+                                  result);
+                    if(ok && (rep == 0 || result.seconds < best.seconds)) {
+                        best = result;
+                    }
+                }
+                if(! ok) {
+                    continue;
+                }
+
+                if(! expected) {
+                    expected = best.checksum;
+                } else if(best.checksum != expected) {
+                    fprintf(stderr, "%s: checksum mismatch for %s/%s\n",
+                            shape.name, mapped ? "mmap" : "fd",
+                            kEngineNames[engine]);
+                    return 1;
+                }
+
+                printf("%-8s %-6s %-8s %8.1f %8.2f %10.0f %8.3f %8s %8s %8s\n",
+                       shape.name, mapped ? "mmap" : "fd",
+                       kEngineNames[engine], size / 1048576.0,
+                       size / best.seconds / 1e9, best.rows / best.seconds,
+                       (double) best.tsc / size,
+                       counters.per_byte(Counters::kInstructions,
+                           best.counters[Counters::kInstructions], size).c_str(),
+                       counters.per_byte(Counters::kBranchMisses,
+                           best.counters[Counters::kBranchMisses], size).c_str(),
+                       counters.per_byte(Counters::kCacheMisses,
+                           best.counters[Counters::kCacheMisses], size).c_str());
+            }
+        }
+        unlink(path.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,211 @@
+#!/usr/bin/env python
+"""
+Time csvmonkey against the csv module on a billing-report shaped file, for
+each mode of the README benchmark table, plus the bulk interfaces.
+
+    python bench.py [path]
+
+Without a path, a synthetic 22 column file of --rows rows is generated with a
+fixed seed, so runs on different builds parse identical bytes. Each mode
+reports its best of --repeat runs.
+"""
+
+import argparse
+import csv
+import os
+import random
+import tempfile
+import time
+
+import csvmonkey
+
+
+COLUMNS = [
+    "InvoiceID", "PayerAccountId", "LinkedAccountId", "RecordType",
+    "RecordId", "ProductName", "RateId", "SubscriptionId", "PricingPlanId",
+    "UsageType", "Operation", "AvailabilityZone", "ReservedInstance",
+    "ItemDescription", "UsageStartDate", "UsageEndDate", "UsageQuantity",
+    "BlendedRate", "BlendedCost", "UnBlendedRate", "UnBlendedCost",
+    "ResourceId",
+]
+RECORD_TYPES = ["LineItem"] * 8 + ["Rounding", "AccountTotal"]
+COST = COLUMNS.index("UnBlendedCost")
+# Low-cardinality columns, for intern=.
+INTERNED = [
+    "InvoiceID", "PayerAccountId", "LinkedAccountId", "RecordType",
+    "ProductName", "UsageType", "Operation", "AvailabilityZone",
+    "ReservedInstance", "ItemDescription", "UsageStartDate", "UsageEndDate",
+    "BlendedRate", "UnBlendedRate",
+]
+
+
+def generate(path, rows):
+    rand = random.Random(1)
+    with open(path, "wb") as fp:
+        writer = csv.writer(fp)
+        writer.writerow(COLUMNS)
+        for i in xrange(rows):
+            writer.writerow([
+                "Estimated", "123456789012", "210987654321",
+                rand.choice(RECORD_TYPES), "%030d" % i, "Amazon EC2",
+                str(rand.randint(1, 99999)), str(rand.randint(1, 9999)),
+                str(rand.randint(1, 9999)), "BoxUsage:m5.large",
+                "RunInstances", "us-east-1a", "N",
+                "$0.096 per On Demand Linux m5.large Instance Hour, 1 GiB",
+                "2024-01-01 00:00:00", "2024-01-01 01:00:00",
+                "%.8f" % rand.random(), "0.0960000000",
+                "%.8f" % rand.random(), "0.0960000000",
+                "%.8f" % rand.random(), "i-%017x" % rand.getrandbits(64),
+            ])
+
+
+def modes(path):
+    def monkey_sum():
+        return sum(float(row["UnBlendedCost"])
+                   for row in csvmonkey.from_path(path))
+
+    def monkey_noop():
+        return all(csvmonkey.from_path(path))
+
+    def dictreader_sum():
+        return sum(float(row["UnBlendedCost"])
+                   for row in csv.DictReader(open(path)))
+
+    def dictreader_noop():
+        return all(csv.DictReader(open(path)))
+
+    def reader_sum():
+        r = csv.reader(open(path))
+        next(r)
+        return sum(float(row[COST]) for row in r)
+
+    def reader_noop():
+        return all(csv.reader(open(path)))
+
+    def tuple_sum():
+        return sum(float(row[COST])
+                   for row in csvmonkey.from_path(path, yields="tuple"))
+
+    def tuple_noop():
+        return all(csvmonkey.from_path(path, yields="tuple"))
+
+    def namedtuple_sum():
+        return sum(float(row.UnBlendedCost)
+                   for row in csvmonkey.from_path(path, yields="namedtuple"))
+
+    def namedtuple_noop():
+        return all(csvmonkey.from_path(path, yields="namedtuple"))
+
+    def dict_sum():
+        return sum(float(row["UnBlendedCost"])
+                   for row in csvmonkey.from_path(path, yields="dict"))
+
+    def dict_noop():
+        return all(csvmonkey.from_path(path, yields="dict"))
+
+    def interned_sum():
+        reader = csvmonkey.from_path(path, yields="tuple", intern=INTERNED)
+        return sum(float(row[COST]) for row in reader)
+
+    def interned_noop():
+        return all(csvmonkey.from_path(path, yields="tuple",
+                                       intern=INTERNED))
+
+    def typed_sum():
+        return sum(row["UnBlendedCost"]
+                   for row in csvmonkey.from_path(path, infer_types=True))
+
+    def typed_noop():
+        return all(csvmonkey.from_path(path, infer_types=True))
+
+    def validated_sum():
+        return sum(float(row["UnBlendedCost"])
+                   for row in csvmonkey.from_path(path, validate="lenient"))
+
+    def validated_noop():
+        return all(csvmonkey.from_path(path, validate="lenient"))
+
+    def projected_sum():
+        return sum(float(row[0])
+                   for row in csvmonkey.from_path(path, yields="tuple",
+                                                  columns=["UnBlendedCost"]))
+
+    def read_columns_sum():
+        reader = csvmonkey.from_path(path)
+        return sum(reader.read_columns({"UnBlendedCost": "f8"})
+                   ["UnBlendedCost"])
+
+    def write_arrow_sum():
+        fd, out = tempfile.mkstemp(suffix=".arrow")
+        os.close(fd)
+        try:
+            reader = csvmonkey.from_path(path, infer_types=True)
+            return reader.write_arrow(out)
+        finally:
+            os.unlink(out)
+
+    def aggregate_sum():
+        reader = csvmonkey.from_path(path)
+        result = reader.aggregate("RecordType", [("sum", "UnBlendedCost")])
+        return sum(v[0] for v in result.values())
+
+    return [
+        ("csvmonkey Lazy Decode", monkey_sum, monkey_noop),
+        ("csv.DictReader", dictreader_sum, dictreader_noop),
+        ("csv.reader", reader_sum, reader_noop),
+        ('csvmonkey yields="tuple"', tuple_sum, tuple_noop),
+        ('csvmonkey yields="dict"', dict_sum, dict_noop),
+        ('csvmonkey yields="namedtuple"', namedtuple_sum, namedtuple_noop),
+        ("csvmonkey intern=", interned_sum, interned_noop),
+        ("csvmonkey infer_types=", typed_sum, typed_noop),
+        ("csvmonkey validate=", validated_sum, validated_noop),
+        ("csvmonkey columns=", projected_sum, None),
+        ("csvmonkey read_columns()", read_columns_sum, None),
+        ("csvmonkey aggregate()", aggregate_sum, None),
+        ("csvmonkey write_arrow()", write_arrow_sum, None),
+    ]
+
+
+def best_of(func, repeat):
+    best = None
+    for _ in xrange(repeat):
+        t0 = time.time()
+        func()
+        elapsed = time.time() - t0
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("path", nargs="?")
+    parser.add_argument("--rows", type=int, default=200000)
+    parser.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    path = args.path
+    if not path:
+        fd, path = tempfile.mkstemp(suffix=".csv")
+        os.close(fd)
+        generate(path, args.rows)
+
+    try:
+        size = os.path.getsize(path)
+        print("%s: %.1f MiB" % (path, size / 1048576.0))
+        print("| %-29s | %9s | %9s | %9s |" % ("Mode", "Sum", "noop",
+                                               "MB/s"))
+        print("|%s|%s|%s|%s|" % ("-" * 31, "-" * 11, "-" * 11, "-" * 11))
+        for name, sum_func, noop_func in modes(path):
+            sum_time = best_of(sum_func, args.repeat)
+            noop_time = noop_func and best_of(noop_func, args.repeat)
+            print("| %-29s | %8.3fs | %9s | %9.1f |" % (
+                name, sum_time,
+                "%.3fs" % noop_time if noop_func else "-",
+                size / 1e6 / sum_time))
+    finally:
+        if not args.path:
+            os.unlink(path)
+
+
+if __name__ == "__main__":
+    main()
@@ -30,7 +30,7 @@ else:
 ig = operator.itemgetter(*slices)
 
 
-writer = csv.writer(sys.stdout, quoting=csv.QUOTE_ALL)
+writer = csvmonkey.writer(sys.stdout, quoting=csv.QUOTE_ALL)
 
 readers = [
     csvmonkey.from_path(path, header=not args.no_header, yields='tuple')
@@ -1,15 +1,21 @@
 
 #include <Python.h>
+#include <datetime.h>
 
 #include "csvmonkey.hpp"
 #include "iterator_stream_cursor.hpp"
 #include "file_stream_cursor.hpp"
+#include "file_stream_writer.hpp"
 
 using namespace csvmonkey;
 
 extern PyTypeObject CellType;
+extern PyTypeObject ColumnType;
+extern PyTypeObject DatasetType;
 extern PyTypeObject ReaderType;
 extern PyTypeObject RowType;
+extern PyTypeObject SpanType;
+extern PyTypeObject WriterType;
 struct RowObject;
 
 
@@ -17,10 +23,182 @@ enum CursorType
 {
     CURSOR_MAPPED_FILE,
     CURSOR_ITERATOR,
-    CURSOR_PYTHON_FILE
+    CURSOR_PYTHON_FILE,
+    CURSOR_GZIP_FILE,
+    CURSOR_UTF16_FILE
 };
 
 
+/*
+ * Open-addressing table of str objects keyed by their bytes, so equal cells
+ * may share one object. Strings are numbered in order of first appearance.
+ */
+class StringTable
+{
+    struct Slot
+    {
+        uint64_t hash;
+        Py_ssize_t code;
+    };
+
+    std::vector<Slot> slots_;
+    std::vector<PyObject *> strings_;
+    size_t limit_;
+    // Scratch for unescaping escaped cells before lookup.
+    UnescapeArena arena_;
+
+    void
+    grow()
+    {
+        std::vector<Slot> slots(slots_.size() * 2, Slot { 0, -1 });
+        size_t mask = slots.size() - 1;
+        for(const Slot &slot : slots_) {
+            if(slot.code >= 0) {
+                size_t i = slot.hash & mask;
+                while(slots[i].code >= 0) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = slot;
+            }
+        }
+        slots_.swap(slots);
+    }
+
+    public:
+    enum { kFull = -2 };
+
+    explicit StringTable(size_t limit=std::numeric_limits<size_t>::max())
+        : slots_(64, Slot { 0, -1 })
+        , limit_(limit)
+    {
+    }
+
+    ~StringTable()
+    {
+        for(PyObject *s : strings_) {
+            Py_DECREF(s);
+        }
+    }
+
+    Py_ssize_t
+    size()
+    {
+        return strings_.size();
+    }
+
+    // Borrowed reference.
+    PyObject *
+    string(Py_ssize_t code)
+    {
+        return strings_[code];
+    }
+
+    /**
+     * Return the code of the unescaped string of cell, adding it if unseen.
+     * Returns kFull if it is unseen and the table holds limit strings, or -1
+     * with an exception set on failure.
+     */
+    Py_ssize_t
+    code(const CsvCell &raw, char escapechar, char quotechar)
+    {
+        arena_.reset();
+        CsvCell cell = arena_.decode(raw, escapechar, quotechar);
+        uint64_t hash = hash_bytes(cell.ptr, cell.size, 0);
+        size_t mask = slots_.size() - 1;
+        size_t i = hash & mask;
+        for(; slots_[i].code >= 0; i = (i + 1) & mask) {
+            if(slots_[i].hash == hash) {
+                PyObject *s = strings_[slots_[i].code];
+                if((size_t) PyString_GET_SIZE(s) == cell.size
+                        && !memcmp(PyString_AS_STRING(s), cell.ptr,
+                                   cell.size)) {
+                    return slots_[i].code;
+                }
+            }
+        }
+
+        if(strings_.size() >= limit_) {
+            return kFull;
+        }
+        PyObject *s = PyString_FromStringAndSize(cell.ptr, cell.size);
+        if(! s) {
+            return -1;
+        }
+        strings_.push_back(s);
+        slots_[i] = Slot { hash, (Py_ssize_t) strings_.size() - 1 };
+        if((strings_.size() * 2) > slots_.size()) {
+            grow();
+        }
+        return strings_.size() - 1;
+    }
+};
+
+
+/*
+ * Columns whose strings are shared through a StringTable, from intern=.
+ */
+struct Interner
+{
+    // Beyond this many distinct values, new ones are no longer cached.
+    static const size_t kMaxStrings = 1 << 16;
+
+    bool all;
+    std::vector<char> columns;
+    StringTable table;
+
+    Interner()
+        : all(false)
+        , table(kMaxStrings)
+    {
+    }
+
+    bool
+    interned(int col)
+    {
+        return all || ((size_t) col < columns.size() && columns[col]);
+    }
+};
+
+
+/*
+ * The reader's header keys ordered by cell index, to build a dict without
+ * walking header_map, and the namedtuple class for yields="namedtuple".
+ */
+struct RowLayout
+{
+    std::vector<PyObject *> keys;
+    std::vector<int> indices;
+    PyObject *type;
+    // Length of type's instances.
+    Py_ssize_t fields;
+
+    RowLayout()
+        : type(NULL)
+        , fields(0)
+    {
+    }
+
+    ~RowLayout()
+    {
+        for(PyObject *key : keys) {
+            Py_DECREF(key);
+        }
+        Py_XDECREF(type);
+    }
+};
+
+
+struct KeyCacheEntry
+{
+    PyObject *key;
+    int index;
+};
+
+
+// Direct-mapped by key address, so must be a power of two.
+static const int kKeyCacheSize = 8;
+
+
 struct ReaderObject
 {
     PyObject_HEAD
@@ -35,6 +213,35 @@ struct ReaderObject
 
     // Map header string -> index.
     PyObject *header_map;
+
+    // Chunked iteration: rows are parsed chunk_rows at a time into batch,
+    // then copied one by one into batch_row, which row points to.
+    size_t chunk_rows;
+    CsvBatch *batch;
+    size_t batch_pos;
+    CsvCursor *batch_row;
+
+    // Incremented as each row is read, to detect stale spans, and the count
+    // of buffers exported from spans, which pin the current row.
+    unsigned long generation;
+    Py_ssize_t exports;
+
+    // Shares str objects between equal cells of some columns, or NULL.
+    Interner *interner;
+
+    // Header keys in column order, built on first use, or NULL.
+    RowLayout *layout;
+    // The tuple last yielded, refilled in place if only the reader holds it.
+    PyObject *last_row;
+    // Recently looked up header key objects and their cell indices.
+    KeyCacheEntry key_cache[kKeyCacheSize];
+    // Column types inferred by infer_types=, or NULL.
+    std::vector<CsmValueType> *types;
+    // Copy of an infer_types= sample read from several buffers, which batch
+    // points into, or NULL.
+    std::string *sample;
+    // Set while a method parses, which may release the GIL; see ReaderUse.
+    bool busy;
 };
 
 
@@ -65,16 +272,120 @@ cell_as_double(CellObject *self)
 }
 
 
+/**
+ * Return a new string holding cell unescaped using reader's dialect. Escaped
+ * cells are decoded straight into the string object.
+ */
+static PyObject *
+cell_to_str(ReaderObject *reader, const CsvCell &cell)
+{
+    if(! (cell.escaped && cell.size)) {
+        return PyString_FromStringAndSize(cell.ptr, cell.size);
+    }
+
+    PyObject *s = PyString_FromStringAndSize(NULL, cell.size);
+    if(s) {
+        size_t size = unescape(cell.ptr, cell.size, PyString_AS_STRING(s),
+                               reader->reader.escapechar(),
+                               reader->reader.quotechar());
+        _PyString_Resize(&s, size);
+    }
+    return s;
+}
+
+/**
+ * Like cell_to_str(), but return a shared string if column col is interned.
+ */
+static PyObject *
+column_str(ReaderObject *reader, int col, const CsvCell &cell)
+{
+    Interner *interner = reader->interner;
+    if(interner && interner->interned(col)) {
+        Py_ssize_t code = interner->table.code(cell,
+            reader->reader.escapechar(), reader->reader.quotechar());
+        if(code >= 0) {
+            PyObject *s = interner->table.string(code);
+            Py_INCREF(s);
+            return s;
+        } else if(code != StringTable::kFull) {
+            return NULL;
+        }
+    }
+    return cell_to_str(reader, cell);
+}
+
+
+/*
+ * Return cell as a value of type, None if it is empty, or NULL without an
+ * exception set if it does not parse as type.
+ */
+static PyObject *
+typed_value(CsmValueType type, const CsvCell &cell)
+{
+    int64_t i;
+    double d;
+    bool b;
+    int year, month, day;
+    if(! cell.size) {
+        Py_RETURN_NONE;
+    }
+
+    switch(type) {
+    case kCsmValueInt:
+        if(parse_exact_int64(cell.ptr, cell.size, i)) {
+            return (i >= LONG_MIN && i <= LONG_MAX)
+                ? PyInt_FromLong((long) i)
+                : PyLong_FromLongLong(i);
+        }
+        // Integers seen in the sample may be followed by fractions.
+        if(parse_exact_double(cell.ptr, cell.size, d)) {
+            return PyFloat_FromDouble(d);
+        }
+        break;
+    case kCsmValueFloat:
+        if(parse_exact_double(cell.ptr, cell.size, d)) {
+            return PyFloat_FromDouble(d);
+        }
+        break;
+    case kCsmValueBool:
+        if(parse_bool(cell.ptr, cell.size, b)) {
+            return PyBool_FromLong(b);
+        }
+        break;
+    case kCsmValueDate:
+        if(parse_date(cell.ptr, cell.size, year, month, day)) {
+            return PyDate_FromDate(year, month, day);
+        }
+        break;
+    default:
+        break;
+    }
+    return NULL;
+}
+
+
+/**
+ * Like column_str(), but convert the cell to column col's inferred type, if
+ * any. Cells that do not parse as their column's type are returned as str.
+ */
 static PyObject *
-cell_to_str(CsvCell *cell)
+column_value(ReaderObject *reader, int col, const CsvCell &cell)
 {
-    return PyString_FromStringAndSize(cell->ptr, cell->size);
+    std::vector<CsmValueType> *types = reader->types;
+    if(types && (size_t) col < types->size()
+            && (*types)[col] != kCsmValueString) {
+        PyObject *value = typed_value((*types)[col], cell);
+        if(value || PyErr_Occurred()) {
+            return value;
+        }
+    }
+    return column_str(reader, col, cell);
 }
 
 static PyObject *
 cell_as_str(CellObject *self)
 {
-    return cell_to_str(self->cell);
+    return cell_to_str(self->reader, *self->cell);
 }
 
 static PyObject *
@@ -154,6 +465,126 @@ cell_dealloc(CellObject *self)
 }
 
 
+/*
+ * Span methods
+ */
+
+/*
+ * Read-only window onto the raw bytes of a row or cell, exported via the
+ * buffer protocol. Mapped files are never recycled, so their spans remain
+ * valid for the life of the reader; others are only valid until the reader
+ * advances.
+ */
+struct SpanObject
+{
+    PyObject_HEAD;
+    ReaderObject *reader; // strong ref, keeps the data alive.
+    const char *ptr;
+    Py_ssize_t size;
+    unsigned long generation;
+};
+
+
+static PyObject *
+span_new(ReaderObject *reader, const char *ptr, size_t size)
+{
+    SpanObject *self = PyObject_New(SpanObject, &SpanType);
+    if(self) {
+        Py_INCREF(reader);
+        self->reader = reader;
+        self->ptr = ptr;
+        self->size = (Py_ssize_t) size;
+        self->generation = reader->generation;
+    }
+    return (PyObject *) self;
+}
+
+
+static bool
+span_check(SpanObject *self)
+{
+    if(self->reader->cursor_type != CURSOR_MAPPED_FILE
+            && self->generation != self->reader->generation) {
+        PyErr_SetString(PyExc_BufferError,
+            "span refers to a row the reader has advanced past");
+        return false;
+    }
+    return true;
+}
+
+
+static void
+span_dealloc(SpanObject *self)
+{
+    Py_CLEAR(self->reader);
+    PyObject_Del(self);
+}
+
+
+static Py_ssize_t
+span_length(SpanObject *self)
+{
+    return span_check(self) ? self->size : -1;
+}
+
+
+static PyObject *
+span_str(SpanObject *self)
+{
+    if(! span_check(self)) {
+        return NULL;
+    }
+    return PyString_FromStringAndSize(self->ptr, self->size);
+}
+
+
+static int
+span_getbuffer(SpanObject *self, Py_buffer *view, int flags)
+{
+    if(! span_check(self)) {
+        return -1;
+    }
+    if(PyBuffer_FillInfo(view, (PyObject *) self, (void *) self->ptr,
+                         self->size, 1, flags)) {
+        return -1;
+    }
+    self->reader->exports++;
+    return 0;
+}
+
+
+static void
+span_releasebuffer(SpanObject *self, Py_buffer *view)
+{
+    self->reader->exports--;
+}
+
+
+static Py_ssize_t
+span_getsegcount(SpanObject *self, Py_ssize_t *lenp)
+{
+    if(lenp) {
+        *lenp = self->size;
+    }
+    return 1;
+}
+
+
+static Py_ssize_t
+span_getreadbuffer(SpanObject *self, Py_ssize_t segment, void **ptrptr)
+{
+    if(! span_check(self)) {
+        return -1;
+    }
+    if(segment) {
+        PyErr_SetString(PyExc_SystemError, "span has only one segment");
+        return -1;
+    }
+    *ptrptr = (void *) self->ptr;
+    return self->size;
+}
+
+
 /*
  * Row methods
  */
@@ -206,7 +637,7 @@ row_astuple(RowObject *self)
         CsvCell *cell = &self->row->cells[0];
 
         for(int i = 0; i < count; i++, cell++) {
-            PyObject *s = PyString_FromStringAndSize(cell->ptr, cell->size);
+            PyObject *s = column_value(self->reader, i, *cell);
             if(! s) {
                 Py_CLEAR(tup);
                 break;
@@ -219,115 +650,294 @@ row_astuple(RowObject *self)
 }
 
 
-static PyObject *
-row_asdict(RowObject *self)
+/*
+ * Return the reader's RowLayout, building it from header_map on first use.
+ */
+static RowLayout *
+reader_layout(ReaderObject *self)
 {
-    PyObject *out = PyDict_New();
-    if(out) {
+    if(self->layout) {
+        return self->layout;
+    }
+
+    std::vector<std::pair<int, PyObject *>> entries;
+    if(self->header_map) {
         Py_ssize_t ppos = 0;
         PyObject *key;
         PyObject *value;
-
-        CsvCell *cells = &self->row->cells[0];
-        while(PyDict_Next(self->reader->header_map, &ppos, &key, &value)) {
-            int i = PyInt_AS_LONG(value);
-            if(i < self->row->count) {
-                PyObject *s = PyString_FromStringAndSize(
-                    cells[i].ptr, cells[i].size);
-                if(! s) {
-                    Py_CLEAR(out);
-                    break;
-                }
-
-                if(PyDict_SetItem(out, key, s)) {
-                    Py_DECREF(s);
-                    Py_CLEAR(out);
-                    break;
-                }
-
-                Py_DECREF(s);
-            }
+        while(PyDict_Next(self->header_map, &ppos, &key, &value)) {
+            entries.push_back(std::make_pair((int) PyInt_AS_LONG(value), key));
         }
+        std::sort(entries.begin(), entries.end());
     }
 
-    return out;
-}
-
-
-static PyObject *
-row_return_self(RowObject *self)
-{
-    Py_INCREF(self);
-    return (PyObject *) self;
+    RowLayout *layout = new RowLayout();
+    for(auto &entry : entries) {
+        Py_INCREF(entry.second);
+        layout->keys.push_back(entry.second);
+        layout->indices.push_back(entry.first);
+    }
+    self->layout = layout;
+    return layout;
 }
 
 
-static PyObject *
-row_repr(RowObject *self)
+/*
+ * Return the namedtuple class for yields="namedtuple", with one field per cell
+ * position named from the header, creating it on first use.
+ */
+static PyTypeObject *
+reader_row_type(ReaderObject *self)
 {
-    PyObject *obj;
-
-    if(self->reader->header) {
-        obj = row_asdict(self);
-    } else {
-        obj = row_astuple(self);
+    RowLayout *layout = reader_layout(self);
+    if(layout->type) {
+        return (PyTypeObject *) layout->type;
     }
-
-    if(! obj) {
+    if(! self->header_map) {
+        PyErr_SetString(PyExc_ValueError,
+                        "yields=\"namedtuple\" requires a header");
         return NULL;
     }
 
-    PyObject *obj_repr = PyObject_Repr(obj);
-    Py_DECREF(obj);
-    if(! obj_repr) {
-        return NULL;
+    Py_ssize_t fields = layout->indices.size()
+        ? layout->indices.back() + 1
+        : 0;
+    layout->fields = fields;
+    PyObject *names = PyList_New(fields);
+    for(Py_ssize_t i = 0; names && i < fields; i++) {
+        // Invalid names, including these placeholders, are renamed by
+        // namedtuple() to _N.
+        PyList_SET_ITEM(names, i, PyString_FromString(""));
+    }
+    for(size_t k = 0; names && k < layout->keys.size(); k++) {
+        Py_INCREF(layout->keys[k]);
+        PyList_SetItem(names, layout->indices[k], layout->keys[k]);
     }
 
-    PyObject *repr = PyString_FromFormat(
-        "<csvmonkey._Row positioned at %s>",
-        PyString_AsString(obj_repr)
-    );
-    Py_DECREF(obj_repr);
-    return repr;
+    PyObject *module = PyImport_ImportModule("collections");
+    PyObject *factory = module
+        ? PyObject_GetAttrString(module, "namedtuple")
+        : NULL;
+    PyObject *args = names ? Py_BuildValue("(sO)", "Row", names) : NULL;
+    PyObject *kw = Py_BuildValue("{s:O}", "rename", Py_True);
+    PyObject *type = (factory && args && kw)
+        ? PyObject_Call(factory, args, kw)
+        : NULL;
+    Py_XDECREF(kw);
+    Py_XDECREF(args);
+    Py_XDECREF(factory);
+    Py_XDECREF(module);
+    Py_XDECREF(names);
+
+    if(type && !(PyType_Check(type)
+            && PyType_IsSubtype((PyTypeObject *) type, &PyTuple_Type))) {
+        PyErr_SetString(PyExc_TypeError, "namedtuple() did not return a type");
+        Py_CLEAR(type);
+    }
+    layout->type = type;
+    return (PyTypeObject *) type;
 }
 
 
-static Py_ssize_t
-row_length(RowObject *self)
+static PyObject *
+row_asdict(RowObject *self)
 {
-    return self->row->count;
+    RowLayout *layout = reader_layout(self->reader);
+    PyObject *out = _PyDict_NewPresized(layout->keys.size());
+    CsvCell *cells = &self->row->cells[0];
+    for(size_t k = 0; out && k < layout->keys.size(); k++) {
+        int i = layout->indices[k];
+        if(i >= self->row->count) {
+            break;
+        }
+
+        PyObject *s = column_value(self->reader, i, cells[i]);
+        if(! (s && !PyDict_SetItem(out, layout->keys[k], s))) {
+            Py_CLEAR(out);
+        }
+        Py_XDECREF(s);
+    }
+
+    return out;
 }
 
 
+/*
+ * Return the current row as a tuple of type and length size, padded as if
+ * with empty cells. The previously yielded tuple is refilled in place when the
+ * reader holds the only reference to it, as the consumer has dropped it.
+ */
 static PyObject *
-row_getitem(RowObject *self, Py_ssize_t index)
+yield_tuple(RowObject *self, PyTypeObject *type, Py_ssize_t size)
 {
-    if(index < 0) {
-        index = self->row->count + index;
+    static const CsvCell empty = { "", 0, false };
+    ReaderObject *reader = self->reader;
+    PyObject *tup = reader->last_row;
+    if(! (tup && Py_REFCNT(tup) == 1 && Py_TYPE(tup) == type
+            && PyTuple_GET_SIZE(tup) == size)) {
+        tup = (type == &PyTuple_Type)
+            ? PyTuple_New(size)
+            : type->tp_alloc(type, size);
+        if(! tup) {
+            return NULL;
+        }
+        Py_XDECREF(reader->last_row);
+        reader->last_row = tup;
     }
 
-    if(index < 0 || index > self->row->count) {
-        PyErr_Format(PyExc_IndexError,
-                     "index %ld greater than parsed col count %lu",
-                     (unsigned long) index,
-                     (unsigned long) self->row->count);
-        return NULL;
+    int count = self->row->count;
+    CsvCell *cell = &self->row->cells[0];
+    for(Py_ssize_t i = 0; i < size; i++, cell++) {
+        PyObject *s = column_value(reader, i, (i < count) ? *cell : empty);
+        if(! s) {
+            return NULL;
+        }
+        PyObject *old = PyTuple_GET_ITEM(tup, i);
+        PyTuple_SET_ITEM(tup, i, s);
+        Py_XDECREF(old);
     }
 
-    CsvCell &cell = self->row->cells[index];
-    return PyString_FromStringAndSize(cell.ptr, cell.size);
+    Py_INCREF(tup);
+    return tup;
 }
 
 
-static Py_ssize_t
-row_getlength(RowObject *self)
+static PyObject *
+row_yield_tuple(RowObject *self)
 {
-    return (Py_ssize_t) self->row->count;
+    return yield_tuple(self, &PyTuple_Type, self->row->count);
 }
 
 
 static PyObject *
-row_subscript(RowObject *self, PyObject *key)
+row_yield_namedtuple(RowObject *self)
+{
+    RowLayout *layout = self->reader->layout;
+    return yield_tuple(self, (PyTypeObject *) layout->type, layout->fields);
+}
+
+
+/*
+ * yields="dict": like row_asdict(), but refill the previously yielded dict in
+ * place when the reader holds the only reference to it and the row is full
+ * length. A dict whose keys the consumer changed is detected by its size and
+ * replaced.
+ */
+static PyObject *
+row_yield_dict(RowObject *self)
+{
+    ReaderObject *reader = self->reader;
+    RowLayout *layout = reader_layout(reader);
+    PyObject *out = reader->last_row;
+    Py_ssize_t size = layout->keys.size();
+    if(! (out && Py_REFCNT(out) == 1 && PyDict_CheckExact(out)
+            && PyDict_Size(out) == size && size
+            && layout->indices.back() < self->row->count)) {
+        Py_CLEAR(reader->last_row);
+        out = row_asdict(self);
+        if(out && PyDict_Size(out) == size) {
+            Py_INCREF(out);
+            reader->last_row = out;
+        }
+        return out;
+    }
+
+    CsvCell *cells = &self->row->cells[0];
+    for(Py_ssize_t k = 0; k < size; k++) {
+        int i = layout->indices[k];
+        PyObject *s = column_value(reader, i, cells[i]);
+        if(! (s && !PyDict_SetItem(out, layout->keys[k], s))) {
+            Py_XDECREF(s);
+            return NULL;
+        }
+        Py_DECREF(s);
+    }
+
+    if(PyDict_Size(out) != size) {
+        Py_CLEAR(reader->last_row);
+        return row_yield_dict(self);
+    }
+    Py_INCREF(out);
+    return out;
+}
+
+
+static PyObject *
+row_return_self(RowObject *self)
+{
+    Py_INCREF(self);
+    return (PyObject *) self;
+}
+
+
+static PyObject *
+row_repr(RowObject *self)
+{
+    PyObject *obj;
+
+    if(self->reader->header) {
+        obj = row_asdict(self);
+    } else {
+        obj = row_astuple(self);
+    }
+
+    if(! obj) {
+        return NULL;
+    }
+
+    PyObject *obj_repr = PyObject_Repr(obj);
+    Py_DECREF(obj);
+    if(! obj_repr) {
+        return NULL;
+    }
+
+    PyObject *repr = PyString_FromFormat(
+        "<csvmonkey._Row positioned at %s>",
+        PyString_AsString(obj_repr)
+    );
+    Py_DECREF(obj_repr);
+    return repr;
+}
+
+
+static Py_ssize_t
+row_length(RowObject *self)
+{
+    return self->row->count;
+}
+
+
+static PyObject *
+row_getitem(RowObject *self, Py_ssize_t index)
+{
+    if(index < 0) {
+        index = self->row->count + index;
+    }
+
+    if(index < 0 || index >= self->row->count) {
+        PyErr_Format(PyExc_IndexError,
+                     "index %ld greater than parsed col count %lu",
+                     (unsigned long) index,
+                     (unsigned long) self->row->count);
+        return NULL;
+    }
+
+    return column_value(self->reader, index, self->row->cells[index]);
+}
+
+
+static Py_ssize_t
+row_getlength(RowObject *self)
+{
+    return (Py_ssize_t) self->row->count;
+}
+
+
+/*
+ * Return the cell named by an index or header key, or set an exception.
+ */
+static CsvCell *
+row_lookup(RowObject *self, PyObject *key)
 {
     int index;
 
@@ -337,15 +947,29 @@ row_subscript(RowObject *self, PyObject *key)
             index = self->row->count + index;
         }
     } else {
-        PyObject *py_index = PyDict_GetItem(self->reader->header_map, key);
-        if(! py_index) {
-            PyErr_Format(PyExc_KeyError, "No such key.");
-            return NULL;
+        // Keys are usually the same few string constants on every row, so
+        // remember the index found for each key object.
+        KeyCacheEntry &entry = self->reader->key_cache[
+            ((uintptr_t) key >> 4) & (kKeyCacheSize - 1)];
+        if(entry.key == key) {
+            index = entry.index;
+        } else {
+            PyObject *py_index = self->reader->header_map
+                ? PyDict_GetItem(self->reader->header_map, key)
+                : NULL;
+            if(! py_index) {
+                PyErr_Format(PyExc_KeyError, "No such key.");
+                return NULL;
+            }
+            index = (int) PyInt_AS_LONG(py_index);
+            Py_INCREF(key);
+            Py_XDECREF(entry.key);
+            entry.key = key;
+            entry.index = index;
         }
-        index = (int) PyInt_AS_LONG(py_index);
     }
 
-    if(index < 0 || index > self->row->count) {
+    if(index < 0 || index >= self->row->count) {
         PyErr_Format(PyExc_IndexError,
                      "index %ld greater than parsed col count %lu",
                      (unsigned long) index,
@@ -353,8 +977,51 @@ row_subscript(RowObject *self, PyObject *key)
         return NULL;
     }
 
-    CsvCell *cell = &self->row->cells[index];
-    return PyString_FromStringAndSize(cell->ptr, cell->size);
+    return &self->row->cells[index];
+}
+
+
+static PyObject *
+row_subscript(RowObject *self, PyObject *key)
+{
+    CsvCell *cell = row_lookup(self, key);
+    if(! cell) {
+        return NULL;
+    }
+    return column_value(self->reader, cell - &self->row->cells[0], *cell);
+}
+
+
+/*
+ * Return a span of a cell's bytes, without unescaping them.
+ */
+static PyObject *
+row_view(RowObject *self, PyObject *key)
+{
+    CsvCell *cell = row_lookup(self, key);
+    if(! cell) {
+        return NULL;
+    }
+    return span_new(self->reader, cell->ptr, cell->size);
+}
+
+
+/*
+ * Return a span of the whole row as it appeared in the input, without its
+ * line terminator.
+ */
+static PyObject *
+row_raw(RowObject *self)
+{
+    ReaderObject *reader = self->reader;
+    size_t size;
+    const char *ptr;
+    if(reader->batch && reader->batch_pos) {
+        ptr = reader->batch->row_data(reader->batch_pos - 1, size);
+    } else {
+        ptr = reader->reader.row_data(size);
+    }
+    return span_new(reader, ptr, size);
 }
 
 
@@ -377,6 +1044,162 @@ row_iter(RowObject *self)
 }
 
 
+/*
+ * Column methods
+ */
+
+enum ColumnKind
+{
+    COLUMN_DOUBLE,
+    COLUMN_INT64,
+    COLUMN_UINT64,
+    COLUMN_STR,
+    COLUMN_CATEGORY
+};
+
+
+/*
+ * Contiguous array of 8-byte items filled by read_columns(), exported via the
+ * buffer protocol so it may be wrapped without copying.
+ */
+struct ColumnObject
+{
+    PyObject_HEAD;
+    ColumnKind kind;
+    char format[2];
+    Py_ssize_t itemsize;
+    Py_ssize_t length;
+    Py_ssize_t capacity;
+    char *data;
+};
+
+
+static PyObject *
+column_new(ColumnKind kind)
+{
+    static const char formats[] = {'d', 'q', 'Q'};
+
+    ColumnObject *self = PyObject_New(ColumnObject, &ColumnType);
+    if(self) {
+        self->kind = kind;
+        self->format[0] = formats[kind];
+        self->format[1] = '\0';
+        self->itemsize = 8;
+        self->length = 0;
+        self->capacity = 0;
+        self->data = NULL;
+    }
+    return (PyObject *) self;
+}
+
+
+/*
+ * Ensure room for n more items. Uses the C allocator so that it may be called
+ * with the GIL released.
+ */
+static bool
+column_reserve(ColumnObject *self, Py_ssize_t n)
+{
+    if((self->length + n) <= self->capacity) {
+        return true;
+    }
+
+    Py_ssize_t capacity = std::max(self->capacity * 2, self->length + n);
+    char *data = (char *) realloc(self->data, capacity * self->itemsize);
+    if(! data) {
+        return false;
+    }
+    self->data = data;
+    self->capacity = capacity;
+    return true;
+}
+
+
+static void
+column_dealloc(ColumnObject *self)
+{
+    free(self->data);
+    self->data = NULL;
+    PyObject_Del(self);
+}
+
+
+static Py_ssize_t
+column_length(ColumnObject *self)
+{
+    return self->length;
+}
+
+
+static PyObject *
+column_getitem(ColumnObject *self, Py_ssize_t index)
+{
+    if(index < 0 || index >= self->length) {
+        PyErr_SetString(PyExc_IndexError, "column index out of range");
+        return NULL;
+    }
+
+    char *p = self->data + (index * self->itemsize);
+    switch(self->kind) {
+    case COLUMN_DOUBLE:
+        return PyFloat_FromDouble(*(double *) p);
+    case COLUMN_INT64:
+        return PyLong_FromLongLong(*(int64_t *) p);
+    default:
+        return PyLong_FromUnsignedLongLong(*(uint64_t *) p);
+    }
+}
+
+
+static PyObject *
+column_repr(ColumnObject *self)
+{
+    return PyString_FromFormat("<csvmonkey._Column format '%s' length %ld>",
+                               self->format, (long) self->length);
+}
+
+
+static int
+column_getbuffer(ColumnObject *self, Py_buffer *view, int flags)
+{
+    view->buf = self->data;
+    view->obj = (PyObject *) self;
+    view->len = self->length * self->itemsize;
+    view->readonly = 0;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? self->format : NULL;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? &self->length : NULL;
+    view->strides = (flags & PyBUF_STRIDES) ? &self->itemsize : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    Py_INCREF(self);
+    return 0;
+}
+
+
+static Py_ssize_t
+column_getsegcount(ColumnObject *self, Py_ssize_t *lenp)
+{
+    if(lenp) {
+        *lenp = self->length * self->itemsize;
+    }
+    return 1;
+}
+
+
+static Py_ssize_t
+column_getreadbuffer(ColumnObject *self, Py_ssize_t segment, void **ptrptr)
+{
+    if(segment) {
+        PyErr_SetString(PyExc_SystemError, "column has only one segment");
+        return -1;
+    }
+    *ptrptr = self->data;
+    return self->length * self->itemsize;
+}
+
+
 /*
  * Reader methods
  */
@@ -386,6 +1209,10 @@ reader_clear(ReaderObject *self)
 {
     Py_CLEAR(self->py_row);
     Py_CLEAR(self->header_map);
+    Py_CLEAR(self->last_row);
+    for(int i = 0; i < kKeyCacheSize; i++) {
+        Py_CLEAR(self->key_cache[i].key);
+    }
     return 0;
 }
 
@@ -394,6 +1221,12 @@ static void
 reader_dealloc(ReaderObject *self)
 {
     reader_clear(self);
+    delete self->layout;
+    delete self->interner;
+    delete self->types;
+    delete self->batch;
+    delete self->sample;
+    delete self->batch_row;
     self->reader.~CsvReader();
     switch(self->cursor_type) {
     case CURSOR_MAPPED_FILE:
@@ -405,6 +1238,21 @@ reader_dealloc(ReaderObject *self)
     case CURSOR_PYTHON_FILE:
         delete (FileStreamCursor *)self->cursor;
         break;
+    case CURSOR_UTF16_FILE: {
+        Utf16StreamCursor *cursor = (Utf16StreamCursor *)self->cursor;
+        delete (MappedFileCursor *)&cursor->source();
+        delete cursor;
+        break;
+    }
+#ifdef CSM_USE_ZLIB
+    case CURSOR_GZIP_FILE: {
+        GzipFdStreamCursor *cursor = (GzipFdStreamCursor *)self->cursor;
+        int fd = cursor->fd();
+        delete cursor;
+        close(fd);
+        break;
+    }
+#endif
     default:
         assert(0);
     }
@@ -416,15 +1264,31 @@ static int
 reader_traverse(ReaderObject *self, visitproc visit, void *arg)
 {
     Py_VISIT(self->py_row);
+    Py_VISIT(self->last_row);
     return 0;
 }
 
 
+/*
+ * Set ValueError if strict validation stopped at a malformed row.
+ */
+static bool
+check_valid(ReaderObject *self)
+{
+    const std::vector<CsvRowError> &errors = self->reader.errors();
+    if(self->reader.failed() && !errors.empty()) {
+        PyErr_SetString(PyExc_ValueError, errors.front().message().c_str());
+        return false;
+    }
+    return true;
+}
+
+
 static int
 header_from_first_row(ReaderObject *self)
 {
     if(! self->reader.read_row()) {
-        if(! PyErr_Occurred()) {
+        if(! PyErr_Occurred() && check_valid(self)) {
             PyErr_Format(PyExc_IOError, "Could not read header row");
         }
         return -1;
@@ -437,7 +1301,7 @@ header_from_first_row(ReaderObject *self)
 
     CsvCell *cell = &self->row->cells[0];
     for(int i = 0; i < self->row->count; i++) {
-        PyObject *key = PyString_FromStringAndSize(cell->ptr, cell->size);
+        PyObject *key = cell_to_str(self, *cell);
         PyObject *value = PyInt_FromLong(i);
         assert(key && value);
         PyDict_SetItem(self->header_map, key, value);
@@ -479,85 +1343,630 @@ header_from_sequence(ReaderObject *self, PyObject *header)
 }
 
 
-static PyObject *
-finish_init(ReaderObject *self, const char *yields, PyObject *header,
-            char delimiter, char quotechar, char escapechar,
-            bool yield_incomplete_row)
+/*
+ * Resolve a column name or number to its index in the file.
+ */
+static int
+column_index(ReaderObject *self, PyObject *key)
 {
-    if(! strcmp(yields, "dict")) {
-        self->yields = row_asdict;
-    } else if(! strcmp(yields, "tuple")) {
-        self->yields = row_astuple;
-    } else {
-        self->yields = row_return_self;
+    PyObject *py_index = key;
+    if(! PyInt_Check(key)) {
+        py_index = self->header_map
+            ? PyDict_GetItem(self->header_map, key)
+            : NULL;
+        if(! py_index) {
+            PyErr_SetObject(PyExc_KeyError, key);
+            return -1;
+        }
     }
 
-    self->header = PyObject_IsTrue(header);
-    new (&(self->reader)) CsvReader(*self->cursor, delimiter, quotechar, escapechar,
-                                    yield_incomplete_row);
-    self->row = &self->reader.row();
-    self->py_row = row_new(self);
+    long index = PyInt_AS_LONG(py_index);
+    if(index < 0) {
+        PyErr_Format(PyExc_IndexError, "negative column index %ld", index);
+        return -1;
+    }
+    return (int) index;
+}
 
-    if(self->header) {
-        int rc;
-        if(PySequence_Check(header)) {
-            rc = header_from_sequence(self, header);
-        } else {
-            rc = header_from_first_row(self);
-        }
 
-        if(rc) {
-            Py_DECREF((PyObject *) self);
-            return NULL;
+/*
+ * Parse an optional numeric range bound, leaving bound unchanged for None.
+ */
+static int
+range_bound(PyObject *obj, double &bound)
+{
+    if(obj && obj != Py_None) {
+        bound = PyFloat_AsDouble(obj);
+        if(bound == -1.0 && PyErr_Occurred()) {
+            return -1;
         }
     }
-
-    PyObject_GC_Track((PyObject *) self);
-    return (PyObject *) self;
+    return 0;
 }
 
 
-static PyObject *
-reader_from_path(PyObject *_self, PyObject *args, PyObject *kw)
-{
+/*
+ * Add one filter for column index from a condition of `where`: a string to
+ * match exactly, a (min, max) tuple for an inclusive numeric range where
+ * either bound may be None, or a dict with any of the keys "equals",
+ * "prefix", "min" and "max".
+ */
+static int
+add_filter(ReaderObject *self, int index, PyObject *cond)
+{
+    if(PyString_Check(cond)) {
+        self->reader.add_filter_equals(index,
+            std::string(PyString_AS_STRING(cond), PyString_GET_SIZE(cond)));
+        return 0;
+    }
+
+    PyObject *equals = NULL;
+    PyObject *prefix = NULL;
+    PyObject *min = NULL;
+    PyObject *max = NULL;
+    if(PyTuple_Check(cond) && PyTuple_GET_SIZE(cond) == 2) {
+        min = PyTuple_GET_ITEM(cond, 0);
+        max = PyTuple_GET_ITEM(cond, 1);
+    } else if(PyDict_Check(cond)) {
+        equals = PyDict_GetItemString(cond, "equals");
+        prefix = PyDict_GetItemString(cond, "prefix");
+        min = PyDict_GetItemString(cond, "min");
+        max = PyDict_GetItemString(cond, "max");
+        Py_ssize_t known = !!equals + !!prefix + !!min + !!max;
+        if(known != PyDict_Size(cond)) {
+            PyErr_SetString(PyExc_ValueError, "unknown where condition key");
+            return -1;
+        }
+    } else {
+        PyErr_SetString(PyExc_TypeError,
+            "where condition must be a string, (min, max) tuple or dict");
+        return -1;
+    }
+
+    if((equals && !PyString_Check(equals))
+            || (prefix && !PyString_Check(prefix))) {
+        PyErr_SetString(PyExc_TypeError, "where values must be strings");
+        return -1;
+    }
+    if(equals) {
+        self->reader.add_filter_equals(index, std::string(
+            PyString_AS_STRING(equals), PyString_GET_SIZE(equals)));
+    }
+    if(prefix) {
+        self->reader.add_filter_prefix(index, std::string(
+            PyString_AS_STRING(prefix), PyString_GET_SIZE(prefix)));
+    }
+    if((min && min != Py_None) || (max && max != Py_None)) {
+        double lo = -HUGE_VAL;
+        double hi = HUGE_VAL;
+        if(range_bound(min, lo) || range_bound(max, hi)) {
+            return -1;
+        }
+        self->reader.add_filter_range(index, lo, hi);
+    }
+    return 0;
+}
+
+
+/*
+ * Only yield rows satisfying every condition of the dict `where`, which maps
+ * column names or numbers to conditions. Rejected rows are skipped during
+ * parsing and never reach Python.
+ */
+static int
+apply_filters(ReaderObject *self, PyObject *where)
+{
+    if(! PyDict_Check(where)) {
+        PyErr_SetString(PyExc_TypeError, "where must be a dict");
+        return -1;
+    }
+
+    Py_ssize_t ppos = 0;
+    PyObject *key;
+    PyObject *cond;
+    while(PyDict_Next(where, &ppos, &key, &cond)) {
+        int index = column_index(self, key);
+        if(index < 0 || add_filter(self, index, cond)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Restrict parsing to the columns named or numbered by the sequence
+ * `columns`, and rewrite header_map to index the projected cells.
+ */
+static int
+apply_projection(ReaderObject *self, PyObject *columns)
+{
+    PyObject *seq = PySequence_Fast(columns, "columns must be a sequence");
+    if(! seq) {
+        return -1;
+    }
+
+    std::vector<int> indices;
+    Py_ssize_t length = PySequence_Fast_GET_SIZE(seq);
+    for(Py_ssize_t i = 0; i < length; i++) {
+        int index = column_index(self, PySequence_Fast_GET_ITEM(seq, i));
+        if(index < 0) {
+            Py_DECREF(seq);
+            return -1;
+        }
+        indices.push_back(index);
+    }
+    Py_DECREF(seq);
+
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    self->reader.set_projection(indices);
+
+    if(self->header_map) {
+        PyObject *header_map = PyDict_New();
+        if(! header_map) {
+            return -1;
+        }
+
+        Py_ssize_t ppos = 0;
+        PyObject *key;
+        PyObject *value;
+        while(PyDict_Next(self->header_map, &ppos, &key, &value)) {
+            auto it = std::lower_bound(indices.begin(), indices.end(),
+                                       (int) PyInt_AS_LONG(value));
+            if(it == indices.end() || *it != PyInt_AS_LONG(value)) {
+                continue;
+            }
+
+            PyObject *py_pos = PyInt_FromLong(it - indices.begin());
+            if(! (py_pos && !PyDict_SetItem(header_map, key, py_pos))) {
+                Py_XDECREF(py_pos);
+                Py_DECREF(header_map);
+                return -1;
+            }
+            Py_DECREF(py_pos);
+        }
+
+        Py_DECREF(self->header_map);
+        self->header_map = header_map;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Share str objects between equal cells of the columns of intern=: True for
+ * every column, or a sequence of names or numbers, resolved after projection.
+ */
+static int
+apply_intern(ReaderObject *self, PyObject *intern)
+{
+    Interner *interner = new Interner();
+    if(PyBool_Check(intern)) {
+        interner->all = (intern == Py_True);
+    } else {
+        PyObject *seq = PySequence_Fast(intern,
+            "intern must be True or a sequence");
+        if(! seq) {
+            delete interner;
+            return -1;
+        }
+
+        Py_ssize_t length = PySequence_Fast_GET_SIZE(seq);
+        for(Py_ssize_t i = 0; i < length; i++) {
+            int index = column_index(self, PySequence_Fast_GET_ITEM(seq, i));
+            if(index < 0) {
+                Py_DECREF(seq);
+                delete interner;
+                return -1;
+            }
+            if((size_t) index >= interner->columns.size()) {
+                interner->columns.resize(index + 1);
+            }
+            interner->columns[index] = 1;
+        }
+        Py_DECREF(seq);
+    }
+
+    self->interner = interner;
+    return 0;
+}
+
+
+/*
+ * Release the GIL for parsing, unless the cursor calls back into Python from
+ * fill(). Returns the state to pass to PyEval_RestoreThread(), or NULL.
+ */
+static PyThreadState *
+release_gil(ReaderObject *self)
+{
+    return (self->cursor_type == CURSOR_MAPPED_FILE
+            || self->cursor_type == CURSOR_GZIP_FILE
+            || self->cursor_type == CURSOR_UTF16_FILE)
+        ? PyEval_SaveThread()
+        : NULL;
+}
+
+
+static void
+acquire_gil(PyThreadState *state)
+{
+    if(state) {
+        PyEval_RestoreThread(state);
+    }
+}
+
+
+/*
+ * Claim a reader for the duration of a method that parses, which may release
+ * the GIL or call back into Python from fill(). As with file objects, a
+ * second thread, or a callback, using the reader meanwhile gets RuntimeError
+ * rather than racing on the cursor and batch.
+ */
+class ReaderUse
+{
+    ReaderObject *self_;
+    bool ok_;
+
+    public:
+    ReaderUse(ReaderObject *self)
+        : self_(self)
+        , ok_(!self->busy)
+    {
+        if(ok_) {
+            self->busy = true;
+        } else {
+            PyErr_SetString(PyExc_RuntimeError,
+                            "concurrent or reentrant use of reader");
+        }
+    }
+
+    ~ReaderUse()
+    {
+        if(ok_) {
+            self_->busy = false;
+        }
+    }
+
+    bool
+    ok()
+    {
+        return ok_;
+    }
+};
+
+
+// Rows sampled by infer_types=True.
+static const Py_ssize_t kInferSampleRows = 1000;
+
+
+/*
+ * Parse up to rows rows into the reader's batch, which must be empty, and
+ * infer column types from them. A batch ends where the stream's buffer does,
+ * so when it falls short each one is copied into self->sample and the next
+ * is read, until enough rows are sampled or input ends.
+ */
+static int
+infer_sample(ReaderObject *self, Py_ssize_t rows)
+{
+    CsvBatch &batch = *self->batch;
+    PyThreadState *state = release_gil(self);
+    size_t n = self->reader.read_batch(batch, rows);
+    if(n && n < (size_t) rows) {
+        std::string *sample = new std::string;
+        CsvBatch combined;
+        combined.clear(rows);
+        while(n) {
+            size_t size;
+            const char *data = batch.row_data(batch.rows - 1, size);
+            size_t shift = sample->size();
+            sample->append(batch.base, (data + size) - batch.base);
+            combined.append_batch(batch, shift);
+            if(combined.rows == (size_t) rows) {
+                break;
+            }
+            n = self->reader.read_batch(batch, rows - combined.rows);
+        }
+        combined.base = sample->data();
+        std::swap(batch, combined);
+        self->sample = sample;
+    }
+    acquire_gil(state);
+    if(PyErr_Occurred()) {
+        return -1;
+    }
+
+    TypeInference inference;
+    inference.add_batch(batch);
+    self->types = new std::vector<CsmValueType>(inference.size());
+    for(size_t col = 0; col < inference.size(); col++) {
+        (*self->types)[col] = inference.type(col);
+    }
+    return 0;
+}
+
+
+static PyObject *
+finish_init(ReaderObject *self, const char *yields, PyObject *header,
+            PyObject *columns, const std::string &delimiter, char quotechar,
+            char escapechar, bool yield_incomplete_row,
+            Py_ssize_t chunk_rows, PyObject *where, PyObject *intern,
+            PyObject *infer_types, const char *validate)
+{
+    if(! strcmp(yields, "dict")) {
+        self->yields = row_yield_dict;
+    } else if(! strcmp(yields, "tuple")) {
+        self->yields = row_yield_tuple;
+    } else if(! strcmp(yields, "namedtuple")) {
+        self->yields = row_yield_namedtuple;
+    } else {
+        self->yields = row_return_self;
+    }
+
+    // The README promises a header is expected by default.
+    self->header = header ? PyObject_IsTrue(header) : 1;
+    self->generation = 0;
+    self->exports = 0;
+    new (&(self->reader)) CsvReader(*self->cursor, delimiter[0], quotechar,
+                                    escapechar, yield_incomplete_row);
+    self->row = &self->reader.row();
+    self->py_row = row_new(self);
+
+    if(delimiter.size() != 1) {
+        try {
+            self->reader.set_delimiter(delimiter);
+        } catch(csvmonkey::Error &e) {
+            PyErr_SetString(PyExc_ValueError, e.what());
+            Py_DECREF((PyObject *) self);
+            return NULL;
+        }
+    }
+
+    CsmValidateType validate_type = kCsmValidateNone;
+    if(validate && !strcmp(validate, "strict")) {
+        validate_type = kCsmValidateStrict;
+    } else if(validate && !strcmp(validate, "lenient")) {
+        validate_type = kCsmValidateLenient;
+    } else if(validate) {
+        PyErr_SetString(PyExc_ValueError,
+                        "validate must be None, \"strict\" or \"lenient\"");
+        Py_DECREF((PyObject *) self);
+        return NULL;
+    }
+    self->reader.set_validation(validate_type);
+
+    if(self->header) {
+        int rc;
+        int width;
+        if(header && PySequence_Check(header)) {
+            rc = header_from_sequence(self, header);
+            width = (int) PySequence_Length(header);
+        } else {
+            rc = header_from_first_row(self);
+            width = self->row->count;
+        }
+
+        if(rc) {
+            Py_DECREF((PyObject *) self);
+            return NULL;
+        }
+        // Every following row must be as wide as the header.
+        self->reader.set_validation(validate_type, width);
+    }
+
+    // Filters name columns of the file, so apply them before projection.
+    if(where && where != Py_None && apply_filters(self, where)) {
+        Py_DECREF((PyObject *) self);
+        return NULL;
+    }
+
+    if(columns && columns != Py_None && apply_projection(self, columns)) {
+        Py_DECREF((PyObject *) self);
+        return NULL;
+    }
+
+    if(intern && intern != Py_None && apply_intern(self, intern)) {
+        Py_DECREF((PyObject *) self);
+        return NULL;
+    }
+
+    // Names are final once projected, so the namedtuple class can be made.
+    if(self->yields == row_yield_namedtuple && !reader_row_type(self)) {
+        Py_DECREF((PyObject *) self);
+        return NULL;
+    }
+
+    Py_ssize_t sample_rows = 0;
+    if(infer_types && infer_types != Py_None) {
+        if(PyBool_Check(infer_types)) {
+            sample_rows = (infer_types == Py_True) ? kInferSampleRows : 0;
+        } else {
+            sample_rows = PyNumber_AsSsize_t(infer_types, PyExc_OverflowError);
+            if(sample_rows == -1 && PyErr_Occurred()) {
+                Py_DECREF((PyObject *) self);
+                return NULL;
+            }
+        }
+    }
+
+    // The infer_types= sample is replayed through the same batch as chunked
+    // iteration, which continues row by row afterwards if chunk_rows is 0.
+    self->chunk_rows = std::max<Py_ssize_t>(chunk_rows, 0);
+    if(chunk_rows > 0 || sample_rows > 0) {
+        self->batch = new CsvBatch();
+        self->batch_pos = 0;
+        self->batch_row = new CsvCursor();
+        self->row = self->batch_row;
+        ((RowObject *) self->py_row)->row = self->row;
+    }
+
+    if(sample_rows > 0 && infer_sample(self, sample_rows)) {
+        Py_DECREF((PyObject *) self);
+        return NULL;
+    }
+
+    PyObject_GC_Track((PyObject *) self);
+    return (PyObject *) self;
+}
+
+
+#ifdef CSM_USE_ZLIB
+/*
+ * Return true if path begins with the gzip magic number.
+ */
+static bool
+is_gzip_path(const char *path)
+{
+    unsigned char magic[2];
+    bool gzip = false;
+    int fd = open(path, O_RDONLY);
+    if(fd != -1) {
+        gzip = (pread(fd, magic, sizeof magic, 0) == sizeof magic)
+            && magic[0] == 0x1f
+            && magic[1] == 0x8b;
+        close(fd);
+    }
+    return gzip;
+}
+#endif
+
+
+/*
+ * Clear the pointer fields released by reader_dealloc(), before anything can
+ * fail.
+ */
+static void
+reader_init_fields(ReaderObject *self)
+{
+    self->py_row = NULL;
+    self->header_map = NULL;
+    self->batch = NULL;
+    self->batch_row = NULL;
+    self->interner = NULL;
+    self->layout = NULL;
+    self->last_row = NULL;
+    self->types = NULL;
+    self->sample = NULL;
+    self->busy = false;
+    for(int i = 0; i < kKeyCacheSize; i++) {
+        self->key_cache[i].key = NULL;
+    }
+}
+
+
+static PyObject *
+reader_from_path(PyObject *_self, PyObject *args, PyObject *kw)
+{
     static char *keywords[] = {"path", "yields", "header", "delimiter",
-        "quotechar", "escapechar", "yield_incomplete_row"};
+        "quotechar", "escapechar", "yield_incomplete_row", "columns",
+        "chunk_rows", "where", "intern", "infer_types", "validate",
+        "encoding", NULL};
     const char *path;
     const char *yields = "row";
     PyObject *header = NULL;
-    char delimiter = ',';
+    const char *delimiter = ",";
+    int delimiter_len = 1;
     char quotechar = '"';
     char escapechar = 0;
     int yield_incomplete_row = 0;
-
-    if(! PyArg_ParseTupleAndKeywords(args, kw, "s|sOccci:from_path", keywords,
-            &path, &yields, &header, &delimiter, &quotechar, &escapechar,
-            &yield_incomplete_row)) {
+    PyObject *columns = NULL;
+    Py_ssize_t chunk_rows = 0;
+    PyObject *where = NULL;
+    PyObject *intern = NULL;
+    PyObject *infer_types = NULL;
+    const char *validate = NULL;
+    const char *encoding = NULL;
+
+    if(! PyArg_ParseTupleAndKeywords(args, kw, "s|sOs#cciOnOOOzz:from_path",
+            keywords,
+            &path, &yields, &header, &delimiter, &delimiter_len,
+            &quotechar, &escapechar,
+            &yield_incomplete_row, &columns, &chunk_rows, &where,
+            &intern, &infer_types, &validate, &encoding)) {
         return NULL;
     }
 
-    ReaderObject *self = PyObject_GC_New(ReaderObject, &ReaderType);
-    if(! self) {
+    CsmUtf16Type utf16 = kCsmUtf16Detect;
+    if(encoding && (!strcmp(encoding, "utf-8") || !strcmp(encoding, "utf8"))) {
+        encoding = NULL;
+    } else if(encoding && !strcmp(encoding, "utf-16-le")) {
+        utf16 = kCsmUtf16Le;
+    } else if(encoding && !strcmp(encoding, "utf-16-be")) {
+        utf16 = kCsmUtf16Be;
+    } else if(encoding && strcmp(encoding, "utf-16")) {
+        PyErr_SetString(PyExc_ValueError, "encoding must be None, \"utf-8\", "
+                        "\"utf-16\", \"utf-16-le\" or \"utf-16-be\"");
         return NULL;
     }
 
-    self->py_row = NULL;
-    self->header_map = NULL;
+#ifdef CSM_USE_ZLIB
+    // Compressed input is inflated by a background thread instead.
+    if(is_gzip_path(path)) {
+        if(encoding) {
+            PyErr_SetString(PyExc_ValueError,
+                            "encoding= is not supported for compressed input");
+            return NULL;
+        }
+        int fd = open(path, O_RDONLY);
+        if(fd == -1) {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+            return NULL;
+        }
+        ReaderObject *self = PyObject_GC_New(ReaderObject, &ReaderType);
+        if(! self) {
+            close(fd);
+            return NULL;
+        }
+        reader_init_fields(self);
+        self->cursor = new GzipFdStreamCursor(fd);
+        self->cursor_type = CURSOR_GZIP_FILE;
+        return finish_init(self, yields, header, columns,
+                           std::string(delimiter, delimiter_len), quotechar,
+                           escapechar, yield_incomplete_row, chunk_rows,
+                           where, intern, infer_types, validate);
+    }
+#endif
 
+    // Mapping may fault in a large file, so let other threads run.
     MappedFileCursor *cursor = new MappedFileCursor();
+    std::string error;
+    Py_BEGIN_ALLOW_THREADS
     try {
         cursor->open(path);
     } catch(csvmonkey::Error &e) {
+        error = e.what();
+    }
+    Py_END_ALLOW_THREADS
+
+    if(! error.empty()) {
+        delete cursor;
+        PyErr_Format(PyExc_IOError, "%s: %s", path, error.c_str());
+        return NULL;
+    }
+
+    // Allocated only once the cursor exists, as reader_dealloc() assumes
+    // the cursor and CsvReader were constructed.
+    ReaderObject *self = PyObject_GC_New(ReaderObject, &ReaderType);
+    if(! self) {
         delete cursor;
-        PyErr_Format(PyExc_IOError, "%s: %s", path, e.what());
-        Py_DECREF(self);
         return NULL;
     }
 
-    self->cursor = cursor;
-    self->cursor_type = CURSOR_MAPPED_FILE;
-    return finish_init(self, yields, header, delimiter, quotechar, escapechar,
-                       yield_incomplete_row);
+    reader_init_fields(self);
+
+    // UTF-16 is transcoded to UTF-8 as the mapped file is parsed.
+    if(encoding) {
+        self->cursor = new Utf16StreamCursor(*cursor, utf16);
+        self->cursor_type = CURSOR_UTF16_FILE;
+    } else {
+        self->cursor = cursor;
+        self->cursor_type = CURSOR_MAPPED_FILE;
+    }
+    return finish_init(self, yields, header, columns,
+                       std::string(delimiter, delimiter_len), quotechar,
+                       escapechar, yield_incomplete_row, chunk_rows, where,
+                       intern, infer_types, validate);
 }
 
 
@@ -565,18 +1974,30 @@ static PyObject *
 reader_from_iter(PyObject *_self, PyObject *args, PyObject *kw)
 {
     static char *keywords[] = {"iter", "yields", "header",
-        "delimiter", "quotechar", "escapechar", "yield_incomplete_row"};
+        "delimiter", "quotechar", "escapechar", "yield_incomplete_row",
+        "columns", "chunk_rows", "where", "intern", "infer_types", "validate",
+        NULL};
     PyObject *iterable;
     const char *yields = "row";
     PyObject *header = NULL;
-    char delimiter = ',';
+    const char *delimiter = ",";
+    int delimiter_len = 1;
     char quotechar = '"';
     char escapechar = 0;
     int yield_incomplete_row = 0;
-
-    if(! PyArg_ParseTupleAndKeywords(args, kw, "O|sOccci:from_iter", keywords,
-            &iterable, &yields, &header, &delimiter, &quotechar, &escapechar,
-            &yield_incomplete_row)) {
+    PyObject *columns = NULL;
+    Py_ssize_t chunk_rows = 0;
+    PyObject *where = NULL;
+    PyObject *intern = NULL;
+    PyObject *infer_types = NULL;
+    const char *validate = NULL;
+
+    if(! PyArg_ParseTupleAndKeywords(args, kw, "O|sOs#cciOnOOOz:from_iter",
+            keywords,
+            &iterable, &yields, &header, &delimiter, &delimiter_len,
+            &quotechar, &escapechar,
+            &yield_incomplete_row, &columns, &chunk_rows, &where,
+            &intern, &infer_types, &validate)) {
         return NULL;
     }
 
@@ -591,12 +2012,13 @@ reader_from_iter(PyObject *_self, PyObject *args, PyObject *kw)
         return NULL;
     }
 
-    self->py_row = NULL;
-    self->header_map = NULL;
+    reader_init_fields(self);
     self->cursor = new IteratorStreamCursor(iter);
     self->cursor_type = CURSOR_ITERATOR;
-    return finish_init(self, yields, header, delimiter, quotechar, escapechar,
-                       yield_incomplete_row);
+    return finish_init(self, yields, header, columns,
+                       std::string(delimiter, delimiter_len), quotechar,
+                       escapechar, yield_incomplete_row, chunk_rows, where,
+                       intern, infer_types, validate);
 }
 
 
@@ -604,18 +2026,30 @@ static PyObject *
 reader_from_file(PyObject *_self, PyObject *args, PyObject *kw)
 {
     static char *keywords[] = {"fp", "yields", "header",
-        "delimiter", "quotechar", "escapechar", "yield_incomplete_row"};
+        "delimiter", "quotechar", "escapechar", "yield_incomplete_row",
+        "columns", "chunk_rows", "where", "intern", "infer_types", "validate",
+        NULL};
     PyObject *fp;
     const char *yields = "row";
     PyObject *header = NULL;
-    char delimiter = ',';
+    const char *delimiter = ",";
+    int delimiter_len = 1;
     char quotechar = '"';
     char escapechar = 0;
     int yield_incomplete_row = 0;
-
-    if(! PyArg_ParseTupleAndKeywords(args, kw, "O|sOccci:from_file", keywords,
-            &fp, &yields, &header, &delimiter, &quotechar, &escapechar,
-            &yield_incomplete_row)) {
+    PyObject *columns = NULL;
+    Py_ssize_t chunk_rows = 0;
+    PyObject *where = NULL;
+    PyObject *intern = NULL;
+    PyObject *infer_types = NULL;
+    const char *validate = NULL;
+
+    if(! PyArg_ParseTupleAndKeywords(args, kw, "O|sOs#cciOnOOOz:from_file",
+            keywords,
+            &fp, &yields, &header, &delimiter, &delimiter_len,
+            &quotechar, &escapechar,
+            &yield_incomplete_row, &columns, &chunk_rows, &where,
+            &intern, &infer_types, &validate)) {
         return NULL;
     }
 
@@ -631,85 +2065,1322 @@ reader_from_file(PyObject *_self, PyObject *args, PyObject *kw)
         return NULL;
     }
 
-    self->cursor = new FileStreamCursor(py_read);
-    self->cursor_type = CURSOR_PYTHON_FILE;
-    return finish_init(self, yields, header, delimiter, quotechar, escapechar,
-                       yield_incomplete_row);
+    reader_init_fields(self);
+    self->cursor = new FileStreamCursor(py_read);
+    self->cursor_type = CURSOR_PYTHON_FILE;
+    return finish_init(self, yields, header, columns,
+                       std::string(delimiter, delimiter_len), quotechar,
+                       escapechar, yield_incomplete_row, chunk_rows, where,
+                       intern, infer_types, validate);
+}
+
+
+/*
+ * Set name to the integer value in dict, returning false on failure.
+ */
+static bool
+set_stat(PyObject *dict, const char *name, uint64_t value)
+{
+    PyObject *py_value = PyLong_FromUnsignedLongLong(value);
+    bool ok = py_value && !PyDict_SetItemString(dict, name, py_value);
+    Py_XDECREF(py_value);
+    return ok;
+}
+
+
+/*
+ * Return a dict of the reader's counters. "bytes" and "rows" are always
+ * present; the rest only when compiled with CSM_STATS.
+ */
+static PyObject *
+reader_stats(ReaderObject *self, PyObject *args)
+{
+    CsvStats stats = self->reader.stats();
+    PyObject *dict = PyDict_New();
+    if(! (dict
+            && set_stat(dict, "bytes", stats.bytes)
+            && set_stat(dict, "rows", stats.rows)
+            && set_stat(dict, "invalid_rows", stats.invalid_rows)
+#ifdef CSM_STATS
+            && set_stat(dict, "rejected_rows", stats.rejected_rows)
+            && set_stat(dict, "cells", stats.cells)
+            && set_stat(dict, "quoted_cells", stats.quoted_cells)
+            && set_stat(dict, "escaped_cells", stats.escaped_cells)
+            && set_stat(dict, "cell_grows", stats.cell_grows)
+            && set_stat(dict, "underruns", stats.underruns)
+            && set_stat(dict, "fills", stats.cursor.fills)
+            && set_stat(dict, "bytes_read", stats.cursor.bytes_read)
+            && set_stat(dict, "bytes_moved", stats.cursor.bytes_moved)
+            && set_stat(dict, "read_ns", stats.cursor.read_ns)
+#endif
+            )) {
+        Py_XDECREF(dict);
+        return NULL;
+    }
+    return dict;
+}
+
+/*
+ * Return a list of (row, offset, message) for the malformed rows found by
+ * validate=, up to the first 1000.
+ */
+static PyObject *
+reader_errors(ReaderObject *self, PyObject *args)
+{
+    ReaderUse use(self);
+    if(! use.ok()) {
+        return NULL;
+    }
+
+    const std::vector<CsvRowError> &errors = self->reader.errors();
+    PyObject *out = PyList_New(errors.size());
+    for(size_t i = 0; out && i < errors.size(); i++) {
+        const CsvRowError &error = errors[i];
+        PyObject *item = Py_BuildValue("(nKs)", (Py_ssize_t) error.row,
+                                       (unsigned long long) error.offset,
+                                       error.message().c_str());
+        if(! item) {
+            Py_CLEAR(out);
+            break;
+        }
+        PyList_SET_ITEM(out, i, item);
+    }
+    return out;
+}
+
+
+/*
+ * Return a list of the type each column was inferred as by infer_types=: int,
+ * float, bool, datetime.date or str.
+ */
+static PyObject *
+reader_types(ReaderObject *self, PyObject *args)
+{
+    if(! self->types) {
+        PyErr_SetString(PyExc_ValueError,
+                        "types() requires infer_types=");
+        return NULL;
+    }
+
+    PyObject *out = PyList_New(self->types->size());
+    for(size_t col = 0; out && col < self->types->size(); col++) {
+        PyTypeObject *type;
+        switch((*self->types)[col]) {
+        case kCsmValueInt: type = &PyInt_Type; break;
+        case kCsmValueFloat: type = &PyFloat_Type; break;
+        case kCsmValueBool: type = &PyBool_Type; break;
+        case kCsmValueDate: type = PyDateTimeAPI->DateType; break;
+        default: type = &PyString_Type; break;
+        }
+        Py_INCREF(type);
+        PyList_SET_ITEM(out, col, (PyObject *) type);
+    }
+    return out;
+}
+
+
+static PyObject *
+reader_get_header(ReaderObject *self, PyObject *args)
+{
+    PyObject *lst = PyList_New(PyDict_Size(self->header_map));
+    Py_ssize_t ppos = 0;
+    PyObject *key;
+    PyObject *value;
+
+    while(PyDict_Next(self->header_map, &ppos, &key, &value)) {
+        int i = PyInt_AS_LONG(value);
+        PyList_SET_ITEM(lst, i, key);
+        Py_INCREF(key);
+    }
+
+    return lst;
+}
+
+
+static PyObject *
+reader_find_cell(ReaderObject *self, PyObject *args)
+{
+    const char *s;
+    if(! PyArg_ParseTuple(args, "s:find_cell", &s)) {
+        return NULL;
+    }
+
+    CsvCell *cell;
+    if(! self->row->by_value(s, cell)) {
+        PyErr_Format(PyExc_KeyError, "%s", s);
+        return NULL;
+    }
+
+    return cell_new(self, cell);
+}
+
+
+/*
+ * Refuse to advance while buffers exported from spans may still point at a
+ * row that would be recycled.
+ */
+static bool
+check_exports(ReaderObject *self)
+{
+    if(self->exports && self->cursor_type != CURSOR_MAPPED_FILE) {
+        PyErr_SetString(PyExc_BufferError,
+            "cannot advance while views of the current row exist");
+        return false;
+    }
+    return true;
+}
+
+
+/*
+ * Set IOError if the cursor failed, or if input remains that could not be
+ * parsed as a row, or ValueError if strict validation stopped parsing.
+ */
+static bool
+check_unparsed(ReaderObject *self)
+{
+#ifdef CSM_USE_ZLIB
+    if(self->cursor_type == CURSOR_GZIP_FILE) {
+        const std::string &error = ((GzipFdStreamCursor *)self->cursor)->error();
+        if(! error.empty()) {
+            PyErr_Format(PyExc_IOError, "%s", error.c_str());
+            return false;
+        }
+    }
+#endif
+    if(! check_valid(self)) {
+        return false;
+    }
+    if(self->cursor->size() && !self->reader.in_newline_skip) {
+        PyErr_Format(PyExc_IOError,
+            "%lu unparsed bytes at end of input. The input may be missing a "
+            "final newline, or unbalanced quotes are present.",
+            (unsigned long) self->cursor->size()
+        );
+        return false;
+    }
+    return true;
+}
+
+
+struct ColumnSpec
+{
+    PyObject *key;
+    int index;
+    ColumnKind kind;
+    PyObject *out;
+    // Distinct values of a COLUMN_CATEGORY column, numbered by out.
+    std::shared_ptr<StringTable> table;
+};
+
+
+static bool
+parse_column_kind(PyObject *dtype, ColumnKind &kind)
+{
+    static const struct {
+        const char *name;
+        ColumnKind kind;
+    } kinds[] = {
+        {"f8", COLUMN_DOUBLE}, {"d", COLUMN_DOUBLE},
+        {"i8", COLUMN_INT64}, {"q", COLUMN_INT64},
+        {"u8", COLUMN_UINT64}, {"Q", COLUMN_UINT64},
+        {"S", COLUMN_STR}, {"C", COLUMN_CATEGORY}
+    };
+
+    const char *s = PyString_Check(dtype) ? PyString_AS_STRING(dtype) : "";
+    for(size_t i = 0; i < (sizeof kinds / sizeof kinds[0]); i++) {
+        if(! strcmp(s, kinds[i].name)) {
+            kind = kinds[i].kind;
+            return true;
+        }
+    }
+    PyErr_Format(PyExc_ValueError,
+                 "unsupported column type; expected f8, i8, u8, S or C");
+    return false;
+}
+
+
+/*
+ * Choose the column type for dtype None from column index's inferred type:
+ * "i8" for int, "f8" for float, and otherwise "S".
+ */
+static bool
+inferred_column_kind(ReaderObject *self, int index, ColumnKind &kind)
+{
+    if(! self->types) {
+        PyErr_SetString(PyExc_ValueError,
+                        "column type None requires infer_types=");
+        return false;
+    }
+
+    CsmValueType type = ((size_t) index < self->types->size())
+        ? (*self->types)[index]
+        : kCsmValueString;
+    if(type == kCsmValueInt) {
+        kind = COLUMN_INT64;
+    } else if(type == kCsmValueFloat) {
+        kind = COLUMN_DOUBLE;
+    } else {
+        kind = COLUMN_STR;
+    }
+    return true;
+}
+
+
+/*
+ * Copy up to max_rows of the infer_types= sample rows not yet iterated into
+ * batch, returning the number copied.
+ */
+static size_t
+take_sample_rows(ReaderObject *self, CsvBatch &batch, size_t max_rows)
+{
+    CsvBatch &sample = *self->batch;
+    batch.clear(std::max(batch.capacity(), max_rows));
+    batch.base = sample.base;
+    while(batch.rows < max_rows && self->batch_pos < sample.rows) {
+        size_t size;
+        const char *data = sample.row_data(self->batch_pos, size);
+        sample.row(self->batch_pos++, *self->batch_row);
+        batch.append(*self->batch_row, data, size);
+    }
+    return batch.rows;
+}
+
+
+/*
+ * Convert one batch into the numeric columns. Called without the GIL when the
+ * input is a mapped file.
+ */
+static bool
+convert_batch(std::vector<ColumnSpec> &specs, const CsvBatch &batch,
+              std::string &error)
+{
+    try {
+        for(auto &spec : specs) {
+            if(spec.kind == COLUMN_STR || spec.kind == COLUMN_CATEGORY) {
+                continue;
+            }
+            ColumnObject *column = (ColumnObject *) spec.out;
+            char *out = column->data + (column->length * column->itemsize);
+            if((size_t) spec.index >= batch.columns.size()) {
+                memset(out, 0, batch.rows * column->itemsize);
+            } else if(spec.kind == COLUMN_DOUBLE) {
+                batch.as_double(spec.index, (double *) out);
+            } else if(spec.kind == COLUMN_INT64) {
+                batch.as_int64(spec.index, (int64_t *) out);
+            } else {
+                batch.as_uint64(spec.index, (uint64_t *) out);
+            }
+            column->length += batch.rows;
+        }
+    } catch(csvmonkey::Error &e) {
+        error = e.what();
+        return false;
+    }
+    return true;
+}
+
+
+static bool
+append_strings(ReaderObject *reader, ColumnSpec &spec, const CsvBatch &batch)
+{
+    for(size_t i = 0; i < batch.rows; i++) {
+        PyObject *s;
+        if((size_t) spec.index < batch.columns.size()) {
+            s = column_str(reader, spec.index, batch.cell(i, spec.index));
+        } else {
+            s = PyString_FromStringAndSize("", 0);
+        }
+        if(! (s && !PyList_Append(spec.out, s))) {
+            Py_XDECREF(s);
+            return false;
+        }
+        Py_DECREF(s);
+    }
+    return true;
+}
+
+
+static bool
+append_codes(ReaderObject *reader, ColumnSpec &spec, const CsvBatch &batch)
+{
+    static const CsvCell empty = { "", 0, false };
+    ColumnObject *column = (ColumnObject *) spec.out;
+    int64_t *out = (int64_t *) (column->data
+                                + (column->length * column->itemsize));
+    for(size_t i = 0; i < batch.rows; i++) {
+        Py_ssize_t code = spec.table->code(
+            ((size_t) spec.index < batch.columns.size())
+                ? batch.cell(i, spec.index)
+                : empty,
+            reader->reader.escapechar(), reader->reader.quotechar());
+        if(code < 0) {
+            return false;
+        }
+        out[i] = code;
+    }
+    column->length += batch.rows;
+    return true;
+}
+
+
+/*
+ * Parse up to max_rows remaining rows (all when negative) into one typed
+ * column per entry of the dict `columns`, which maps a header name or cell
+ * index to "f8", "i8", "u8", "S" or "C", or to None for the type chosen by
+ * inferred_column_kind(). Numeric columns are returned as
+ * _Column buffers; "S" columns are lists of str. "C" columns are a tuple of a
+ * _Column of i8 codes and the list of distinct str the codes index, in order
+ * of first appearance.
+ */
+static PyObject *
+reader_read_columns(ReaderObject *self, PyObject *args, PyObject *kw)
+{
+    static const size_t kBatchRows = 4096;
+    static char *keywords[] = {"columns", "max_rows", NULL};
+    PyObject *columns;
+    Py_ssize_t max_rows = -1;
+
+    if(! PyArg_ParseTupleAndKeywords(args, kw, "O!|n:read_columns", keywords,
+            &PyDict_Type, &columns, &max_rows)) {
+        return NULL;
+    }
+
+    ReaderUse use(self);
+    if(! use.ok()) {
+        return NULL;
+    }
+
+    if(self->batch && self->batch_pos < self->batch->rows
+            && self->chunk_rows) {
+        PyErr_SetString(PyExc_ValueError,
+            "read_columns() called with chunked rows still pending");
+        return NULL;
+    }
+    if(! check_exports(self)) {
+        return NULL;
+    }
+    self->generation++;
+
+    PyObject *result = PyDict_New();
+    if(! result) {
+        return NULL;
+    }
+
+    std::vector<ColumnSpec> specs;
+    Py_ssize_t ppos = 0;
+    PyObject *key;
+    PyObject *dtype;
+    while(PyDict_Next(columns, &ppos, &key, &dtype)) {
+        ColumnSpec spec;
+        spec.key = key;
+        if(PyInt_Check(key)) {
+            spec.index = (int) PyInt_AS_LONG(key);
+        } else {
+            PyObject *py_index = self->header_map
+                ? PyDict_GetItem(self->header_map, key)
+                : NULL;
+            if(! py_index) {
+                PyErr_SetObject(PyExc_KeyError, key);
+                Py_DECREF(result);
+                return NULL;
+            }
+            spec.index = (int) PyInt_AS_LONG(py_index);
+        }
+
+        if(spec.index < 0) {
+            PyErr_Format(PyExc_IndexError, "negative column index %d",
+                         spec.index);
+            Py_DECREF(result);
+            return NULL;
+        }
+        if(dtype == Py_None
+                ? !inferred_column_kind(self, spec.index, spec.kind)
+                : !parse_column_kind(dtype, spec.kind)) {
+            Py_DECREF(result);
+            return NULL;
+        }
+
+        if(spec.kind == COLUMN_STR) {
+            spec.out = PyList_New(0);
+        } else if(spec.kind == COLUMN_CATEGORY) {
+            spec.out = column_new(COLUMN_INT64);
+            spec.table = std::make_shared<StringTable>();
+        } else {
+            spec.out = column_new(spec.kind);
+        }
+        if(! (spec.out && !PyDict_SetItem(result, key, spec.out))) {
+            Py_XDECREF(spec.out);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(spec.out);
+        specs.push_back(spec);
+    }
+
+    CsvBatch batch;
+    std::string error;
+    size_t total = 0;
+    for(;;) {
+        size_t want = kBatchRows;
+        if(max_rows >= 0) {
+            want = std::min(want, (size_t) max_rows - total);
+            if(! want) {
+                break;
+            }
+        }
+
+        for(auto &spec : specs) {
+            if(spec.kind != COLUMN_STR
+                    && !column_reserve((ColumnObject *) spec.out, want)) {
+                Py_DECREF(result);
+                return PyErr_NoMemory();
+            }
+        }
+
+        PyThreadState *state = release_gil(self);
+        size_t rows = (self->batch && self->batch_pos < self->batch->rows)
+            ? take_sample_rows(self, batch, want)
+            : self->reader.read_batch(batch, want);
+        bool ok = convert_batch(specs, batch, error);
+        acquire_gil(state);
+
+        if(! ok) {
+            PyErr_SetString(PyExc_ValueError, error.c_str());
+            Py_DECREF(result);
+            return NULL;
+        }
+        for(auto &spec : specs) {
+            if(spec.kind == COLUMN_STR && !append_strings(self, spec, batch)) {
+                Py_DECREF(result);
+                return NULL;
+            } else if(spec.kind == COLUMN_CATEGORY
+                    && !append_codes(self, spec, batch)) {
+                Py_DECREF(result);
+                return NULL;
+            }
+        }
+
+        if(PyErr_Occurred()) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        if(! rows) {
+            if(! check_unparsed(self)) {
+                Py_DECREF(result);
+                return NULL;
+            }
+            break;
+        }
+        total += rows;
+    }
+
+    for(auto &spec : specs) {
+        if(spec.kind != COLUMN_CATEGORY) {
+            continue;
+        }
+        PyObject *values = PyList_New(spec.table->size());
+        for(Py_ssize_t i = 0; values && i < spec.table->size(); i++) {
+            PyObject *s = spec.table->string(i);
+            Py_INCREF(s);
+            PyList_SET_ITEM(values, i, s);
+        }
+        PyObject *pair = values
+            ? PyTuple_Pack(2, spec.out, values)
+            : NULL;
+        Py_XDECREF(values);
+        if(! (pair && !PyDict_SetItem(result, spec.key, pair))) {
+            Py_XDECREF(pair);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(pair);
+    }
+    return result;
+}
+
+
+/*
+ * Parse one aggregate spec of reader_aggregate(): a (func, column) tuple,
+ * where func is "count", "sum", "min" or "max", and column may be None for
+ * "count".
+ */
+static bool
+add_aggregate_spec(ReaderObject *self, Aggregator &agg, PyObject *spec)
+{
+    const char *func;
+    PyObject *key;
+    if(! PyArg_ParseTuple(spec, "sO:aggregate", &func, &key)) {
+        return false;
+    }
+
+    CsmAggregateType type;
+    if(! strcmp(func, "count")) {
+        type = kCsmAggregateCount;
+    } else if(! strcmp(func, "sum")) {
+        type = kCsmAggregateSum;
+    } else if(! strcmp(func, "min")) {
+        type = kCsmAggregateMin;
+    } else if(! strcmp(func, "max")) {
+        type = kCsmAggregateMax;
+    } else {
+        PyErr_Format(PyExc_ValueError, "unknown aggregate %s", func);
+        return false;
+    }
+
+    int index = -1;
+    if(key == Py_None && type != kCsmAggregateCount) {
+        PyErr_Format(PyExc_ValueError, "aggregate %s requires a column", func);
+        return false;
+    } else if(key != Py_None) {
+        index = column_index(self, key);
+        if(index < 0) {
+            return false;
+        }
+    }
+    agg.add_aggregate(type, index);
+    return true;
+}
+
+
+/*
+ * Build the result of reader_aggregate() from a finished Aggregator.
+ */
+static PyObject *
+aggregate_result(Aggregator &agg, bool tuple_keys)
+{
+    PyObject *result = PyDict_New();
+    for(size_t group = 0; result && group < agg.size(); group++) {
+        std::vector<std::string> cells = agg.key(group);
+        PyObject *key;
+        if(tuple_keys) {
+            key = PyTuple_New(cells.size());
+            for(size_t i = 0; key && i < cells.size(); i++) {
+                PyObject *s = PyString_FromStringAndSize(cells[i].data(),
+                                                         cells[i].size());
+                if(! s) {
+                    Py_CLEAR(key);
+                    break;
+                }
+                PyTuple_SET_ITEM(key, i, s);
+            }
+        } else {
+            key = PyString_FromStringAndSize(cells[0].data(),
+                                             cells[0].size());
+        }
+
+        const double *values = agg.values(group);
+        PyObject *value = key ? PyTuple_New(agg.aggregates()) : NULL;
+        for(size_t i = 0; value && i < agg.aggregates(); i++) {
+            PyObject *v;
+            if(agg.type(i) == kCsmAggregateCount) {
+                v = PyInt_FromSsize_t((Py_ssize_t) values[i]);
+            } else if(std::isnan(values[i])) {
+                Py_INCREF(Py_None);
+                v = Py_None;
+            } else {
+                v = PyFloat_FromDouble(values[i]);
+            }
+            if(! v) {
+                Py_CLEAR(value);
+                break;
+            }
+            PyTuple_SET_ITEM(value, i, v);
+        }
+
+        if(! (value && !PyDict_SetItem(result, key, value))) {
+            Py_CLEAR(result);
+        }
+        Py_XDECREF(key);
+        Py_XDECREF(value);
+    }
+    return result;
+}
+
+
+/*
+ * Write the remaining rows to the file at path as an Arrow IPC stream of
+ * record batches of up to batch_rows rows, returning the number of rows
+ * written. Columns are named from the header, or numbered without one, and
+ * typed from infer_types=, otherwise all utf8. Conversion runs with the GIL
+ * released for from_path() readers, while a background thread writes.
+ */
+static PyObject *
+reader_write_arrow(ReaderObject *self, PyObject *args, PyObject *kw)
+{
+    static char *keywords[] = {"path", "batch_rows", NULL};
+    const char *path;
+    Py_ssize_t batch_rows = 16384;
+
+    if(! PyArg_ParseTupleAndKeywords(args, kw, "s|n:write_arrow", keywords,
+            &path, &batch_rows)) {
+        return NULL;
+    }
+    if(batch_rows <= 0) {
+        PyErr_SetString(PyExc_ValueError, "batch_rows must be positive");
+        return NULL;
+    }
+
+    ReaderUse use(self);
+    if(! use.ok()) {
+        return NULL;
+    }
+
+    if(self->batch && self->batch_pos < self->batch->rows
+            && self->chunk_rows) {
+        PyErr_SetString(PyExc_ValueError,
+            "write_arrow() called with chunked rows still pending");
+        return NULL;
+    }
+    if(! check_exports(self)) {
+        return NULL;
+    }
+    self->generation++;
+
+    RowLayout *layout = reader_layout(self);
+    size_t count = self->types ? self->types->size() : 0;
+    if(! layout->indices.empty()) {
+        count = std::max(count, (size_t) layout->indices.back() + 1);
+    }
+    if(! count) {
+        PyErr_SetString(PyExc_ValueError,
+                        "write_arrow() requires a header or infer_types=");
+        return NULL;
+    }
+
+    std::vector<std::string> names(count);
+    for(size_t i = 0; i < count; i++) {
+        names[i] = std::to_string(i);
+    }
+    for(size_t k = 0; k < layout->keys.size(); k++) {
+        PyObject *name = PyObject_Str(layout->keys[k]);
+        if(! name) {
+            return NULL;
+        }
+        names[layout->indices[k]] = PyString_AS_STRING(name);
+        Py_DECREF(name);
+    }
+    std::vector<CsmValueType> types(count, kCsmValueString);
+    if(self->types) {
+        std::copy(self->types->begin(), self->types->end(), types.begin());
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd == -1) {
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *) path);
+    }
+
+    std::string error;
+    size_t rows = 0;
+    PyThreadState *state = release_gil(self);
+    try {
+        ArrowStreamWriter writer(fd, names, types);
+        ArrowBatch batch(types, self->reader.escapechar(),
+                         self->reader.quotechar());
+        CsvBatch sample;
+        while(self->batch && self->batch_pos < self->batch->rows) {
+            if(batch.rows() == (size_t) batch_rows) {
+                rows += batch.rows();
+                writer.write(batch);
+            }
+            take_sample_rows(self, sample, batch_rows - batch.rows());
+            batch.append(sample);
+        }
+        rows += export_arrow(self->reader, writer, batch, batch_rows);
+    } catch(csvmonkey::Error &e) {
+        error = e.what();
+    }
+    acquire_gil(state);
+    close(fd);
+
+    if(PyErr_Occurred()) {
+        return NULL;
+    }
+    if(! error.empty()) {
+        PyErr_Format(PyExc_IOError, "%s: %s", path, error.c_str());
+        return NULL;
+    }
+    if(! check_unparsed(self)) {
+        return NULL;
+    }
+    return PyLong_FromSize_t(rows);
+}
+
+
+/*
+ * Group the remaining rows by the column `by`, or by a tuple of columns, and
+ * compute each (func, column) of `aggregates` per group. Returns a dict
+ * mapping each key, a str or a tuple of str, to a tuple of results. Counts
+ * are ints; sum, min and max are floats, or None when min or max saw no
+ * nonempty cell.
+ */
+static PyObject *
+reader_aggregate(ReaderObject *self, PyObject *args, PyObject *kw)
+{
+    static char *keywords[] = {"by", "aggregates", NULL};
+    PyObject *by;
+    PyObject *aggregates;
+
+    if(! PyArg_ParseTupleAndKeywords(args, kw, "OO:aggregate", keywords,
+            &by, &aggregates)) {
+        return NULL;
+    }
+
+    ReaderUse use(self);
+    if(! use.ok()) {
+        return NULL;
+    }
+
+    if(self->batch && self->batch_pos < self->batch->rows
+            && self->chunk_rows) {
+        PyErr_SetString(PyExc_ValueError,
+            "aggregate() called with chunked rows still pending");
+        return NULL;
+    }
+    if(! check_exports(self)) {
+        return NULL;
+    }
+    self->generation++;
+
+    bool tuple_keys = PyTuple_Check(by) || PyList_Check(by);
+    std::vector<int> keys;
+    Py_ssize_t nkeys = tuple_keys ? PySequence_Size(by) : 1;
+    for(Py_ssize_t i = 0; i < nkeys; i++) {
+        int index = column_index(self,
+            tuple_keys ? PySequence_Fast_GET_ITEM(by, i) : by);
+        if(index < 0) {
+            return NULL;
+        }
+        keys.push_back(index);
+    }
+    if(keys.empty()) {
+        PyErr_SetString(PyExc_ValueError, "aggregate() requires a column");
+        return NULL;
+    }
+
+    Aggregator agg(keys, self->reader.escapechar(),
+                   self->reader.quotechar());
+    PyObject *seq = PySequence_Fast(aggregates,
+        "aggregates must be a sequence of (func, column) tuples");
+    if(! seq) {
+        return NULL;
+    }
+    for(Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        if(! add_aggregate_spec(self, agg, PySequence_Fast_GET_ITEM(seq, i))) {
+            Py_DECREF(seq);
+            return NULL;
+        }
+    }
+    Py_DECREF(seq);
+
+    // Rows of the infer_types= sample not yet iterated come first.
+    while(self->batch && self->batch_pos < self->batch->rows) {
+        self->batch->row(self->batch_pos++, *self->batch_row);
+        agg.add_row(*self->batch_row);
+    }
+
+    PyThreadState *state = release_gil(self);
+    while(self->reader.read_row()) {
+        agg.add_row(self->reader.row());
+    }
+    acquire_gil(state);
+
+    if(PyErr_Occurred() || !check_unparsed(self)) {
+        return NULL;
+    }
+    return aggregate_result(agg, tuple_keys);
+}
+
+
+static PyObject *
+reader_repr(ReaderObject *self)
+{
+    return PyString_FromFormat(
+        "<csvmonkey._Reader positioned at %d>",
+        0
+    );
+}
+
+
+static PyObject *
+reader_iter(PyObject *self)
+{
+    Py_INCREF(self);
+    return self;
+}
+
+
+/*
+ * Advance row to the next row, in chunked mode parsing a new chunk without
+ * the GIL once the current one is exhausted. Once the infer_types= sample is
+ * exhausted without chunked mode, rows are read directly again.
+ */
+static bool
+reader_next_row(ReaderObject *self)
+{
+    if(! check_exports(self)) {
+        return false;
+    }
+
+    self->generation++;
+    if(self->batch && self->batch_pos == self->batch->rows
+            && !self->chunk_rows) {
+        // batch_row is kept until dealloc, as cells may still point into it.
+        delete self->batch;
+        self->batch = NULL;
+        self->row = &self->reader.row();
+        ((RowObject *) self->py_row)->row = self->row;
+    }
+    if(! self->batch) {
+        return self->reader.read_row();
+    }
+
+    if(self->batch_pos == self->batch->rows) {
+        PyThreadState *state = release_gil(self);
+        size_t rows = self->reader.read_batch(*self->batch, self->chunk_rows);
+        acquire_gil(state);
+        self->batch_pos = 0;
+        if(! rows) {
+            return false;
+        }
+    }
+
+    self->batch->row(self->batch_pos++, *self->batch_row);
+    return true;
+}
+
+
+static PyObject *
+reader_iternext(ReaderObject *self)
+{
+    ReaderUse use(self);
+    if(! use.ok()) {
+        return NULL;
+    }
+    if(reader_next_row(self)) {
+        return self->yields((RowObject *) self->py_row);
+    }
+
+    // Any exception raised by the cursor or by check_exports() takes priority.
+    if(! PyErr_Occurred() && check_unparsed(self)) {
+        PyErr_SetNone(PyExc_StopIteration);
+    }
+    return NULL;
+}
+
+
+/*
+ * Writer methods
+ */
+
+struct WriterObject
+{
+    PyObject_HEAD
+    FileStreamWriter *writer;
+};
+
+
+static PyObject *
+writer_error(csvmonkey::Error &e)
+{
+    if(! PyErr_Occurred()) {
+        PyErr_SetString(PyExc_IOError, e.what());
+    }
+    return NULL;
+}
+
+
+/*
+ * Write one value: str and buffers such as spans are written as bytes, None
+ * as an empty field, and anything else as its str().
+ */
+static int
+writer_write_value(WriterObject *self, PyObject *value)
+{
+    if(PyString_CheckExact(value)) {
+        self->writer->write_cell(PyString_AS_STRING(value),
+                                 PyString_GET_SIZE(value));
+    } else if(value == Py_None) {
+        self->writer->write_cell("", 0);
+    } else if(PyObject_CheckBuffer(value)) {
+        Py_buffer view;
+        if(PyObject_GetBuffer(value, &view, PyBUF_SIMPLE)) {
+            return -1;
+        }
+        self->writer->write_cell((const char *) view.buf, view.len);
+        PyBuffer_Release(&view);
+    } else {
+        PyObject *s = PyObject_Str(value);
+        if(! s) {
+            return -1;
+        }
+        self->writer->write_cell(PyString_AS_STRING(s), PyString_GET_SIZE(s));
+        Py_DECREF(s);
+    }
+    return 0;
+}
+
+
+static int
+writer_write_row(WriterObject *self, PyObject *row)
+{
+    // Rows from a reader are written straight from the parsed cells.
+    if(PyObject_TypeCheck(row, &RowType)) {
+        CsvReader &reader = ((RowObject *) row)->reader->reader;
+        self->writer->write_row(*((RowObject *) row)->row,
+                                reader.escapechar(), reader.quotechar());
+        return 0;
+    }
+
+    PyObject *seq = PySequence_Fast(row, "row must be a sequence");
+    if(! seq) {
+        return -1;
+    }
+
+    Py_ssize_t length = PySequence_Fast_GET_SIZE(seq);
+    for(Py_ssize_t i = 0; i < length; i++) {
+        if(writer_write_value(self, PySequence_Fast_GET_ITEM(seq, i))) {
+            Py_DECREF(seq);
+            return -1;
+        }
+    }
+    Py_DECREF(seq);
+    self->writer->end_row();
+    return 0;
+}
+
+
+static PyObject *
+writer_writerow(WriterObject *self, PyObject *row)
+{
+    try {
+        if(writer_write_row(self, row)) {
+            return NULL;
+        }
+    } catch(csvmonkey::Error &e) {
+        return writer_error(e);
+    }
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+writer_writerows(WriterObject *self, PyObject *rows)
+{
+    PyObject *iter = PyObject_GetIter(rows);
+    if(! iter) {
+        return NULL;
+    }
+
+    PyObject *row;
+    try {
+        while((row = PyIter_Next(iter))) {
+            int rc = writer_write_row(self, row);
+            Py_DECREF(row);
+            if(rc) {
+                break;
+            }
+        }
+    } catch(csvmonkey::Error &e) {
+        Py_DECREF(iter);
+        return writer_error(e);
+    }
+
+    Py_DECREF(iter);
+    if(PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+
+/*
+ * Write a buffer such as Row.raw() verbatim as a complete row.
+ */
+static PyObject *
+writer_writeraw(WriterObject *self, PyObject *obj)
+{
+    Py_buffer view;
+    if(PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE)) {
+        return NULL;
+    }
+
+    try {
+        self->writer->write_raw((const char *) view.buf, view.len);
+        self->writer->end_row();
+    } catch(csvmonkey::Error &e) {
+        PyBuffer_Release(&view);
+        return writer_error(e);
+    }
+    PyBuffer_Release(&view);
+    Py_RETURN_NONE;
+}
+
+
+static PyObject *
+writer_flush(WriterObject *self)
+{
+    try {
+        self->writer->flush();
+    } catch(csvmonkey::Error &e) {
+        return writer_error(e);
+    }
+    Py_RETURN_NONE;
+}
+
+
+static void
+writer_dealloc(WriterObject *self)
+{
+    try {
+        self->writer->flush();
+    } catch(csvmonkey::Error &e) {
+        PyErr_Clear();
+    }
+    delete self->writer;
+    PyObject_Del(self);
+}
+
+
+static PyObject *
+writer_new(PyObject *_self, PyObject *args, PyObject *kw)
+{
+    static char *keywords[] = {"fp", "delimiter", "quotechar",
+        "lineterminator", "quoting", NULL};
+    PyObject *fp;
+    char delimiter = ',';
+    char quotechar = '"';
+    const char *lineterminator = "\r\n";
+    int quoting = 0;
+
+    if(! PyArg_ParseTupleAndKeywords(args, kw, "O|ccsi:writer", keywords,
+            &fp, &delimiter, &quotechar, &lineterminator, &quoting)) {
+        return NULL;
+    }
+
+    // The csv module's QUOTE_MINIMAL and QUOTE_ALL.
+    if(quoting != 0 && quoting != 1) {
+        PyErr_SetString(PyExc_ValueError,
+            "quoting must be csv.QUOTE_MINIMAL or csv.QUOTE_ALL");
+        return NULL;
+    }
+
+    PyObject *py_write = PyObject_GetAttrString(fp, "write");
+    if(! py_write) {
+        return NULL;
+    }
+
+    WriterObject *self = PyObject_New(WriterObject, &WriterType);
+    if(! self) {
+        Py_DECREF(py_write);
+        return NULL;
+    }
+
+    self->writer = new FileStreamWriter(py_write, delimiter, quotechar,
+                                        lineterminator, quoting == 1);
+    return (PyObject *) self;
+}
+
+
+/*
+ * Dataset methods
+ */
+
+struct DatasetObject
+{
+    PyObject_HEAD
+    DatasetReader *reader;
+    char quotechar;
+    // Set during for_each(), whose callback may call back into the dataset.
+    bool busy;
+};
+
+
+static PyObject *
+dataset_error(csvmonkey::Error &e)
+{
+    if(! PyErr_Occurred()) {
+        PyErr_SetString(PyExc_IOError, e.what());
+    }
+    return NULL;
+}
+
+
+static PyObject *
+string_tuple(const std::vector<std::string> &strings)
+{
+    PyObject *tup = PyTuple_New(strings.size());
+    for(size_t i = 0; tup && i < strings.size(); i++) {
+        PyObject *s = PyString_FromStringAndSize(strings[i].data(),
+                                                 strings[i].size());
+        if(! s) {
+            Py_CLEAR(tup);
+            break;
+        }
+        PyTuple_SET_ITEM(tup, i, s);
+    }
+    return tup;
+}
+
+
+static PyObject *
+dataset_header(DatasetObject *self)
+{
+    try {
+        return string_tuple(self->reader->header());
+    } catch(csvmonkey::Error &e) {
+        return dataset_error(e);
+    }
 }
 
 
 static PyObject *
-reader_get_header(ReaderObject *self, PyObject *args)
+dataset_paths(DatasetObject *self)
 {
-    PyObject *lst = PyList_New(PyDict_Size(self->header_map));
-    Py_ssize_t ppos = 0;
-    PyObject *key;
-    PyObject *value;
+    return string_tuple(self->reader->paths());
+}
 
-    while(PyDict_Next(self->header_map, &ppos, &key, &value)) {
-        int i = PyInt_AS_LONG(value);
-        PyList_SET_ITEM(lst, i, key);
-        Py_INCREF(key);
+
+/*
+ * Call fn(file_index, row) with row as a tuple of unescaped strings.
+ */
+static bool
+dataset_call(DatasetObject *self, PyObject *fn, int index, CsvCursor &row)
+{
+    PyObject *tup = PyTuple_New(row.count);
+    for(int i = 0; tup && i < row.count; i++) {
+        CsvCell &cell = row.cells[i];
+        PyObject *s;
+        if(cell.escaped) {
+            std::string value = cell.as_str(0, self->quotechar);
+            s = PyString_FromStringAndSize(value.data(), value.size());
+        } else {
+            s = PyString_FromStringAndSize(cell.ptr, cell.size);
+        }
+        if(! s) {
+            Py_CLEAR(tup);
+            break;
+        }
+        PyTuple_SET_ITEM(tup, i, s);
+    }
+    if(! tup) {
+        return false;
     }
 
-    return lst;
+    PyObject *result = PyObject_CallFunction(fn, "iN", index, tup);
+    Py_XDECREF(result);
+    return result != NULL;
 }
 
 
+/*
+ * Deliver every row in order on the calling thread, which only holds the GIL
+ * while fn runs, so the pool parses ahead meanwhile.
+ */
 static PyObject *
-reader_find_cell(ReaderObject *self, PyObject *args)
+dataset_for_each(DatasetObject *self, PyObject *fn)
 {
-    const char *s;
-    if(! PyArg_ParseTuple(args, "s:find_cell", &s)) {
+    if(self->busy) {
+        PyErr_SetString(PyExc_RuntimeError,
+            "concurrent or reentrant use of dataset");
         return NULL;
     }
 
-    CsvCell *cell;
-    if(! self->row->by_value(s, cell)) {
-        PyErr_Format(PyExc_KeyError, "%s", s);
-        return NULL;
+    self->busy = true;
+    PyThreadState *state = PyEval_SaveThread();
+    bool failed = false;
+    std::string message;
+    try {
+        self->reader->for_each_ordered([&](int index, CsvCursor &row) {
+            PyEval_RestoreThread(state);
+            bool ok = dataset_call(self, fn, index, row);
+            state = PyEval_SaveThread();
+            if(! ok) {
+                throw csvmonkey::Error("for_each", "callback raised");
+            }
+        });
+    } catch(csvmonkey::Error &e) {
+        failed = true;
+        message = e.what();
+    } catch(std::exception &e) {
+        failed = true;
+        message = e.what();
     }
+    PyEval_RestoreThread(state);
+    self->busy = false;
 
-    return cell_new(self, cell);
+    if(failed) {
+        if(! PyErr_Occurred()) {
+            PyErr_SetString(PyExc_IOError, message.c_str());
+        }
+        return NULL;
+    }
+    Py_RETURN_NONE;
 }
 
 
-static PyObject *
-reader_repr(ReaderObject *self)
+static void
+dataset_dealloc(DatasetObject *self)
 {
-    return PyString_FromFormat(
-        "<csvmonkey._Reader positioned at %d>",
-        0
-    );
+    delete self->reader;
+    PyObject_Del(self);
 }
 
 
+/*
+ * from_paths(paths, ...): paths is a sequence of paths, or a glob pattern.
+ */
 static PyObject *
-reader_iter(PyObject *self)
+dataset_from_paths(PyObject *_self, PyObject *args, PyObject *kw)
 {
-    Py_INCREF(self);
-    return self;
-}
-
+    static char *keywords[] = {"paths", "header", "threads", "delimiter",
+        "quotechar", "yield_incomplete_row", NULL};
+    PyObject *py_paths;
+    int header = 1;
+    int threads = 0;
+    char delimiter = ',';
+    char quotechar = '"';
+    int yield_incomplete_row = 0;
 
-static PyObject *
-reader_iternext(ReaderObject *self)
-{
-    if(self->reader.read_row()) {
-        return self->yields((RowObject *) self->py_row);
+    if(! PyArg_ParseTupleAndKeywords(args, kw, "O|iicci:from_paths",
+            keywords, &py_paths, &header, &threads, &delimiter, &quotechar,
+            &yield_incomplete_row)) {
+        return NULL;
     }
 
-    if(self->cursor->size() && !self->reader.in_newline_skip) {
-        PyErr_Format(PyExc_IOError,
-            "%lu unparsed bytes at end of input. The input may be missing a "
-            "final newline, or unbalanced quotes are present.",
-            (unsigned long) self->cursor->size()
-        );
+    std::vector<std::string> paths;
+    if(PyString_Check(py_paths)) {
+        try {
+            paths = DatasetReader::glob(PyString_AS_STRING(py_paths));
+        } catch(csvmonkey::Error &e) {
+            return dataset_error(e);
+        }
+    } else {
+        PyObject *seq = PySequence_Fast(py_paths,
+            "paths must be a glob pattern or a sequence of paths");
+        if(! seq) {
+            return NULL;
+        }
+        for(Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+            PyObject *path = PySequence_Fast_GET_ITEM(seq, i);
+            if(! PyString_Check(path)) {
+                PyErr_SetString(PyExc_TypeError, "paths must be strings");
+                Py_DECREF(seq);
+                return NULL;
+            }
+            paths.push_back(PyString_AS_STRING(path));
+        }
+        Py_DECREF(seq);
     }
-    if(! PyErr_Occurred()) {
-        PyErr_SetNone(PyExc_StopIteration);
+
+    DatasetObject *self = PyObject_New(DatasetObject, &DatasetType);
+    if(! self) {
+        return NULL;
     }
-    return NULL;
+    self->reader = new DatasetReader(paths, threads, delimiter, quotechar,
+                                     yield_incomplete_row, header);
+    self->quotechar = quotechar;
+    self->busy = false;
+    return (PyObject *) self;
 }
 
 
@@ -788,6 +3459,8 @@ static PyMappingMethods row_mapping_methods = {
 static PyMethodDef row_methods[] = {
     {"astuple",     (PyCFunction)row_astuple, METH_NOARGS, ""},
     {"asdict",     (PyCFunction)row_asdict, METH_NOARGS, ""},
+    {"view",       (PyCFunction)row_view, METH_O, ""},
+    {"raw",        (PyCFunction)row_raw, METH_NOARGS, ""},
     {0, 0, 0, 0}
 };
 
@@ -834,6 +3507,131 @@ PyTypeObject RowType = {
 };
 
 
+/*
+ * Column type.
+ */
+
+static PySequenceMethods column_sequence_methods = {
+    (lenfunc) column_length,        /* sq_length */
+    NULL,                           /* sq_concat */
+    NULL,                           /* sq_repeat */
+    (ssizeargfunc) column_getitem,  /* sq_item */
+};
+
+
+static PyBufferProcs column_buffer_methods = {
+    (readbufferproc) column_getreadbuffer,  /* bf_getreadbuffer */
+    (writebufferproc) column_getreadbuffer, /* bf_getwritebuffer */
+    (segcountproc) column_getsegcount,      /* bf_getsegcount */
+    NULL,                                   /* bf_getcharbuffer */
+    (getbufferproc) column_getbuffer,       /* bf_getbuffer */
+    NULL,                                   /* bf_releasebuffer */
+};
+
+PyTypeObject ColumnType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_Column",                  /*tp_name*/
+    sizeof(ColumnObject),       /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    (destructor) column_dealloc,/*tp_dealloc*/
+    0,                          /*tp_print*/
+    0,                          /*tp_getattr*/
+    0,                          /*tp_setattr*/
+    0,                          /*tp_compare*/
+    (reprfunc)column_repr,      /*tp_repr*/
+    0,                          /*tp_as_number*/
+    &column_sequence_methods,   /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    0,                          /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    &column_buffer_methods,     /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+    "csvmonkey._Column",         /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    0,                          /*tp_iter*/
+    0,                          /*tp_iternext*/
+    0,                          /*tp_methods*/
+    0,                          /*tp_members*/
+    0,                          /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    0,                          /*tp_new*/
+    0,                          /*tp_free*/
+};
+
+
+/*
+ * Span type.
+ */
+
+static PySequenceMethods span_sequence_methods = {
+    (lenfunc) span_length,          /* sq_length */
+};
+
+
+static PyBufferProcs span_buffer_methods = {
+    (readbufferproc) span_getreadbuffer,    /* bf_getreadbuffer */
+    NULL,                                   /* bf_getwritebuffer */
+    (segcountproc) span_getsegcount,        /* bf_getsegcount */
+    (charbufferproc) span_getreadbuffer,    /* bf_getcharbuffer */
+    (getbufferproc) span_getbuffer,         /* bf_getbuffer */
+    (releasebufferproc) span_releasebuffer, /* bf_releasebuffer */
+};
+
+PyTypeObject SpanType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_Span",                    /*tp_name*/
+    sizeof(SpanObject),         /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    (destructor) span_dealloc,  /*tp_dealloc*/
+    0,                          /*tp_print*/
+    0,                          /*tp_getattr*/
+    0,                          /*tp_setattr*/
+    0,                          /*tp_compare*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    &span_sequence_methods,     /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    (reprfunc) span_str,        /*tp_str*/
+    0,                          /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    &span_buffer_methods,       /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+    "csvmonkey._Span",           /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    0,                          /*tp_iter*/
+    0,                          /*tp_iternext*/
+    0,                          /*tp_methods*/
+    0,                          /*tp_members*/
+    0,                          /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    0,                          /*tp_new*/
+    0,                          /*tp_free*/
+};
+
+
 /*
  * Reader type.
  */
@@ -841,6 +3639,15 @@ PyTypeObject RowType = {
 static PyMethodDef reader_methods[] = {
     {"get_header",  (PyCFunction)reader_get_header, METH_NOARGS, ""},
     {"find_cell",   (PyCFunction)reader_find_cell, METH_VARARGS, ""},
+    {"read_columns", (PyCFunction)reader_read_columns,
+        METH_VARARGS|METH_KEYWORDS, ""},
+    {"aggregate", (PyCFunction)reader_aggregate,
+        METH_VARARGS|METH_KEYWORDS, ""},
+    {"write_arrow", (PyCFunction)reader_write_arrow,
+        METH_VARARGS|METH_KEYWORDS, ""},
+    {"stats",       (PyCFunction)reader_stats, METH_NOARGS, ""},
+    {"errors",      (PyCFunction)reader_errors, METH_NOARGS, ""},
+    {"types",       (PyCFunction)reader_types, METH_NOARGS, ""},
     {0, 0, 0, 0}
 };
 
@@ -887,6 +3694,115 @@ PyTypeObject ReaderType = {
 };
 
 
+/*
+ * Writer type.
+ */
+
+static PyMethodDef writer_methods[] = {
+    {"writerow",    (PyCFunction)writer_writerow, METH_O, ""},
+    {"writerows",   (PyCFunction)writer_writerows, METH_O, ""},
+    {"writeraw",    (PyCFunction)writer_writeraw, METH_O, ""},
+    {"flush",       (PyCFunction)writer_flush, METH_NOARGS, ""},
+    {0, 0, 0, 0}
+};
+
+PyTypeObject WriterType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_Writer",                  /*tp_name*/
+    sizeof(WriterObject),       /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    (destructor) writer_dealloc,/*tp_dealloc*/
+    0,                          /*tp_print*/
+    0,                          /*tp_getattr*/
+    0,                          /*tp_setattr*/
+    0,                          /*tp_compare*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    0,                          /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    0,                          /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    "csvmonkey._Writer",         /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    0,                          /*tp_iter*/
+    0,                          /*tp_iternext*/
+    writer_methods,             /*tp_methods*/
+    0,                          /*tp_members*/
+    0,                          /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    0,                          /*tp_new*/
+    0,                          /*tp_free*/
+};
+
+
+/*
+ * Dataset type.
+ */
+
+static PyMethodDef dataset_methods[] = {
+    {"header",      (PyCFunction)dataset_header, METH_NOARGS, ""},
+    {"paths",       (PyCFunction)dataset_paths, METH_NOARGS, ""},
+    {"for_each",    (PyCFunction)dataset_for_each, METH_O, ""},
+    {0, 0, 0, 0}
+};
+
+PyTypeObject DatasetType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "_Dataset",                 /*tp_name*/
+    sizeof(DatasetObject),      /*tp_basicsize*/
+    0,                          /*tp_itemsize*/
+    (destructor) dataset_dealloc,/*tp_dealloc*/
+    0,                          /*tp_print*/
+    0,                          /*tp_getattr*/
+    0,                          /*tp_setattr*/
+    0,                          /*tp_compare*/
+    0,                          /*tp_repr*/
+    0,                          /*tp_as_number*/
+    0,                          /*tp_as_sequence*/
+    0,                          /*tp_as_mapping*/
+    0,                          /*tp_hash*/
+    0,                          /*tp_call*/
+    0,                          /*tp_str*/
+    0,                          /*tp_getattro*/
+    0,                          /*tp_setattro*/
+    0,                          /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,         /*tp_flags*/
+    "csvmonkey._Dataset",       /*tp_doc*/
+    0,                          /*tp_traverse*/
+    0,                          /*tp_clear*/
+    0,                          /*tp_richcompare*/
+    0,                          /*tp_weaklistoffset*/
+    0,                          /*tp_iter*/
+    0,                          /*tp_iternext*/
+    dataset_methods,            /*tp_methods*/
+    0,                          /*tp_members*/
+    0,                          /*tp_getset*/
+    0,                          /*tp_base*/
+    0,                          /*tp_dict*/
+    0,                          /*tp_descr_get*/
+    0,                          /*tp_descr_set*/
+    0,                          /*tp_dictoffset*/
+    0,                          /*tp_init*/
+    0,                          /*tp_alloc*/
+    0,                          /*tp_new*/
+    0,                          /*tp_free*/
+};
+
+
 /*
  * Module constructor.
  */
@@ -895,6 +3811,9 @@ static struct PyMethodDef module_methods[] = {
     {"from_path", (PyCFunction) reader_from_path, METH_VARARGS|METH_KEYWORDS},
     {"from_iter", (PyCFunction) reader_from_iter, METH_VARARGS|METH_KEYWORDS},
     {"from_file", (PyCFunction) reader_from_file, METH_VARARGS|METH_KEYWORDS},
+    {"writer", (PyCFunction) writer_new, METH_VARARGS|METH_KEYWORDS},
+    {"from_paths", (PyCFunction) dataset_from_paths,
+        METH_VARARGS|METH_KEYWORDS},
     {0, 0, 0, 0}
 };
 
@@ -903,7 +3822,8 @@ PyMODINIT_FUNC
 initcsvmonkey(void)
 {
     static PyTypeObject *types[] = {
-        &CellType, &RowType, &ReaderType
+        &CellType, &RowType, &ReaderType, &ColumnType, &SpanType,
+        &WriterType, &DatasetType
     };
 
     PyObject *mod = Py_InitModule3("csvmonkey", module_methods, "");
@@ -911,6 +3831,11 @@ initcsvmonkey(void)
         return;
     }
 
+    PyDateTime_IMPORT;
+    if(! PyDateTimeAPI) {
+        return;
+    }
+
     for(int i = 0; i < (sizeof types / sizeof types[0]); i++) {
         PyTypeObject *type = types[i];
         if(PyType_Ready(type)) {
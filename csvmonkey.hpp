@@ -1,24 +1,57 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
 #include <cstring>
+#include <deque>
+#include <exception>
 #include <fcntl.h>
 #include <fstream>
+#include <glob.h>
 #include <iostream>
+#include <limits.h>
+#include <limits>
+#include <locale.h>
+#include <memory>
+#include <mutex>
+#include <queue>
 #include <stdexcept>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+
 #if defined(__SSE4_2__) && !defined(CSM_IGNORE_SSE42)
 #define CSM_USE_SSE42
 #include <emmintrin.h>
 #include <smmintrin.h>
 #endif // __SSE4_2__
 
+// Wider kernels are selected at runtime, so need only compiler support.
+#if defined(CSM_USE_SSE42) && defined(__GNUC__) && !defined(CSM_IGNORE_AVX2)
+#define CSM_USE_AVX2
+#include <immintrin.h>
+#endif // CSM_USE_AVX2
+
+#if defined(CSM_USE_AVX2) && !defined(CSM_IGNORE_AVX512)
+#define CSM_USE_AVX512
+#endif // CSM_USE_AVX512
+
+#ifdef CSM_USE_ZLIB
+#include <zlib.h>
+#endif
+
 #ifdef USE_SPIRIT
 #include "boost/spirit/include/qi.hpp"
 #endif
@@ -30,6 +63,13 @@
 #   define CSM_DEBUG(x...) {}
 #endif
 
+// Hot-path counters cost a few instructions per row, so are opt-in.
+#ifdef CSM_STATS
+#   define CSM_STAT(x...) x;
+#else
+#   define CSM_STAT(x...)
+#endif
+
 
 namespace csvmonkey {
 
@@ -57,18 +97,92 @@ class Error
 };
 
 
+/**
+ * Counters kept by StreamCursor implementations when CSM_STATS is defined.
+ * bytes_moved counts bytes copied to keep an unconsumed partial row in front
+ * of newly read data, and read_ns the time spent waiting for reads.
+ */
+struct CursorStats
+{
+    uint64_t fills;
+    uint64_t bytes_read;
+    uint64_t bytes_moved;
+    uint64_t read_ns;
+};
+
+
+/**
+ * Return nanoseconds elapsed since start, for CursorStats::read_ns.
+ */
+static inline uint64_t
+elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+
 class StreamCursor
 {
+    protected:
+    CursorStats stats_;
+
     public:
     /**
-     * Current stream position. Must guarantee access to buf()[0..size()+15],
-     * with 15 trailing NULs to allow safely running PCMPSTRI on the final data
-     * byte.
+     * Bytes that must be readable past the end of the data, allowing the
+     * widest spanner to load a full block starting at the final data byte.
+     */
+    static const size_t kPadding = 64;
+
+    StreamCursor()
+        : stats_()
+    {
+    }
+
+    virtual ~StreamCursor()
+    {
+    }
+
+    const CursorStats &
+    stats() const
+    {
+        return stats_;
+    }
+
+    /**
+     * Current stream position. Must guarantee access to
+     * buf()[0..size()+kPadding), to allow safely running the spanners on the
+     * final data byte. The contents of the padding are not significant.
      */
     virtual const char *buf() = 0;
     virtual size_t size() = 0;
     virtual void consume(size_t n) = 0;
     virtual bool fill() = 0;
+
+    /**
+     * Reposition at offset bytes from the start of input, returning false if
+     * the cursor cannot seek or offset is past the end.
+     */
+    virtual bool seek(size_t /* offset */)
+    {
+        return false;
+    }
+};
+
+
+/**
+ * Options for MappedFileCursor::open(). kCsmMapPopulate prefaults the whole
+ * file at open, and kCsmMapHugePages asks for transparent huge pages where
+ * the filesystem supports them. kCsmMapReadahead requests the next window of
+ * the file as parsing approaches it, and kCsmMapDropConsumed unmaps pages a
+ * window behind the parse position, so resident memory stays flat however
+ * large the file is. Pages dropped in error are simply faulted in again.
+ */
+enum CsmMapFlags {
+    kCsmMapPopulate = 1,
+    kCsmMapHugePages = 2,
+    kCsmMapReadahead = 4,
+    kCsmMapDropConsumed = 8
 };
 
 
@@ -80,12 +194,55 @@ class MappedFileCursor
     char *p_;
     char *guardp_;
 
+    // Windowed advice: the position at which to next advise, and the start
+    // of the pages not yet dropped.
+    int flags_;
+    size_t window_;
+    char *next_advice_;
+    char *dropped_;
+
+    char *
+    page_floor(char *p)
+    {
+        unsigned long page_size = sysconf(_SC_PAGESIZE);
+        return startp_ + ((p - startp_) & ~(page_size - 1));
+    }
+
+    /**
+     * Apply the windowed flags around p_, then schedule the next call half
+     * a window on.
+     */
+    void
+    advise()
+    {
+        if(flags_ & kCsmMapReadahead) {
+            char *startp = page_floor(p_);
+            char *endp = std::min(endp_, p_ + window_);
+            if(endp > startp) {
+                ::madvise(startp, endp - startp, MADV_WILLNEED);
+            }
+        }
+        if(flags_ & kCsmMapDropConsumed) {
+            char *endp = page_floor(p_ - std::min((size_t) (p_ - startp_),
+                                                  window_));
+            if(endp > dropped_) {
+                ::madvise(dropped_, endp - dropped_, MADV_DONTNEED);
+                dropped_ = endp;
+            }
+        }
+        next_advice_ = p_ + window_ / 2;
+    }
+
     public:
     MappedFileCursor()
         : startp_(0)
         , endp_(0)
         , p_(0)
         , guardp_(0)
+        , flags_(0)
+        , window_(0)
+        , next_advice_(0)
+        , dropped_(0)
     {
     }
 
@@ -114,6 +271,9 @@ class MappedFileCursor
     {
         p_ += std::min(n, (size_t) (endp_ - p_));
         CSM_DEBUG("consume(%lu); new size: %lu", n, size())
+        if(flags_ && p_ >= next_advice_) {
+            advise();
+        }
     }
 
     virtual bool fill()
@@ -121,7 +281,31 @@ class MappedFileCursor
         return false;
     }
 
-    void open(const char *filename)
+    virtual bool seek(size_t offset)
+    {
+        if(offset > (size_t) (endp_ - startp_)) {
+            return false;
+        }
+        p_ = startp_ + offset;
+        if(flags_) {
+            advise();
+        }
+        return true;
+    }
+
+    /**
+     * Current position as an offset from the start of the file.
+     */
+    size_t offset()
+    {
+        return p_ - startp_;
+    }
+
+    /**
+     * Map filename, with any CsmMapFlags. window is the distance ahead of the
+     * parse position to read, and behind it to drop.
+     */
+    void open(const char *filename, int flags=0, size_t window=16 << 20)
     {
         int fd = ::open(filename, O_RDONLY);
         if(fd == -1) {
@@ -166,9 +350,15 @@ class MappedFileCursor
             throw Error("mmap", "could not allocate guard page");
         }
 
+        int map_flags = MAP_SHARED|MAP_FIXED;
+#ifdef MAP_POPULATE
+        if(flags & kCsmMapPopulate) {
+            map_flags |= MAP_POPULATE;
+        }
+#endif
         guardp_ = startp + rounded;
         startp_ = (char *) mmap(startp, st.st_size, PROT_READ,
-                                MAP_SHARED|MAP_FIXED, fd, 0);
+                                map_flags, fd, 0);
         ::close(fd);
 
         if(startp_ != startp) {
@@ -178,8 +368,61 @@ class MappedFileCursor
         }
 
         ::madvise(startp_, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        if(flags & kCsmMapHugePages) {
+            ::madvise(startp_, st.st_size, MADV_HUGEPAGE);
+        }
+#endif
         endp_ = startp_ + st.st_size;
         p_ = startp_;
+
+        flags_ = flags & (kCsmMapReadahead | kCsmMapDropConsumed);
+        window_ = std::max(window, (size_t) page_size);
+        dropped_ = startp_;
+        if(flags_) {
+            advise();
+        }
+    }
+};
+
+
+/**
+ * Non-owning cursor over a range of memory that is already fully available,
+ * such as a slice of a MappedFileCursor. The caller must guarantee the usual
+ * trailing bytes after endp are readable; any slice of a mapped file does,
+ * since it is followed either by more file data or the guard page.
+ */
+class MemoryCursor
+    : public StreamCursor
+{
+    const char *p_;
+    const char *endp_;
+
+    public:
+    MemoryCursor(const char *p, const char *endp)
+        : p_(p)
+        , endp_(endp)
+    {
+    }
+
+    virtual const char *buf()
+    {
+        return p_;
+    }
+
+    virtual size_t size()
+    {
+        return endp_ - p_;
+    }
+
+    virtual void consume(size_t n)
+    {
+        p_ += std::min(n, (size_t) (endp_ - p_));
+    }
+
+    virtual bool fill()
+    {
+        return false;
     }
 };
 
@@ -195,19 +438,32 @@ class BufferedStreamCursor
     virtual ssize_t readmore() = 0;
 
     BufferedStreamCursor()
-        : vec_(131072)
+        : vec_(131072 + kPadding)
         , read_pos_(0)
         , write_pos_(0)
     {
     }
 
     protected:
+    /**
+     * Bytes that may be written at write_pos_, excluding the padding.
+     */
+    size_t available()
+    {
+        return vec_.size() - kPadding - write_pos_;
+    }
+
+    /**
+     * Ensure capacity bytes may be written at write_pos_, at least doubling
+     * vec_ when it must grow so that appending is amortized linear.
+     */
     void ensure(size_t capacity)
     {
-        size_t available = vec_.size() - write_pos_;
-        if(available < capacity) {
-            CSM_DEBUG("resizing vec_ %lu", (size_t)(vec_.size() + capacity));
-            vec_.resize(16 + (vec_.size() + capacity));
+        if(available() < capacity) {
+            size_t size = std::max(vec_.size() * 2,
+                                   write_pos_ + capacity + kPadding);
+            CSM_DEBUG("resizing vec_ %lu", size);
+            vec_.resize(size);
         }
     }
 
@@ -233,22 +489,26 @@ class BufferedStreamCursor
         if(read_pos_) {
             size_t n = write_pos_ - read_pos_;
             CSM_DEBUG("read_pos_ needs adjust, it is %lu / n = %lu", read_pos_, n);
-            memcpy(&vec_[0], &vec_[read_pos_], n);
+            CSM_STAT(stats_.bytes_moved += n)
+            memmove(&vec_[0], &vec_[read_pos_], n);
             CSM_DEBUG("fill() adjust old write_pos = %lu", write_pos_);
             write_pos_ -= read_pos_;
             read_pos_ = 0;
             CSM_DEBUG("fill() adjust new write_pos = %lu", write_pos_);
         }
 
-        if(write_pos_ == vec_.size()) {
-            ensure(vec_.size() / 2);
+        if(! available()) {
+            ensure(1);
         }
 
+        CSM_STAT(auto start = std::chrono::steady_clock::now())
         ssize_t rc = readmore();
-        if(rc == -1) {
+        CSM_STAT(stats_.read_ns += elapsed_ns(start))
+        if(rc <= 0) {
             CSM_DEBUG("readmore() failed");
             return false;
         }
+        CSM_STAT(stats_.fills++; stats_.bytes_read += rc)
 
         CSM_DEBUG("readmore() succeeded")
         CSM_DEBUG("fill() old write_pos = %lu", write_pos_);
@@ -259,410 +519,6638 @@ class BufferedStreamCursor
 };
 
 
-class FdStreamCursor
-    : public BufferedStreamCursor
+/**
+ * Read a file with O_DIRECT, bypassing the page cache, for cold data that
+ * would otherwise evict more useful pages. Reads are whole aligned blocks
+ * into an aligned buffer: fill() copies the unconsumed tail so that it ends
+ * on a block boundary, and reads the next block after it. Filesystems that
+ * refuse O_DIRECT are read normally, and where it is unavailable F_NOCACHE
+ * is used instead. After fill() returns false, error() describes any read
+ * failure.
+ */
+class DirectFileCursor
+    : public StreamCursor
 {
+    static const size_t kAlign = 4096;
+
     int fd_;
+    size_t block_size_;
+    char *buf_;
+    size_t capacity_;
+    char *p_;
+    char *endp_;
+    bool eof_;
+    std::string error_;
 
-    public:
-    FdStreamCursor(int fd)
-        : BufferedStreamCursor()
-        , fd_(fd)
+    static size_t
+    align_up(size_t n)
     {
+        return (n + kAlign - 1) & ~(kAlign - 1);
     }
 
-    virtual ssize_t readmore()
+    public:
+    DirectFileCursor(size_t block_size=1048576)
+        : fd_(-1)
+        , block_size_(align_up(std::max(block_size, (size_t) kAlign)))
+        , buf_(0)
+        , capacity_(0)
+        , p_(0)
+        , endp_(0)
+        , eof_(false)
     {
-        return ::read(fd_, &vec_[write_pos_], vec_.size() - write_pos_);
     }
-};
-
 
-struct CsvCell
-{
-    const char *ptr;
-    size_t size;
-    bool escaped;
-
-    public:
-    std::string as_str(char escapechar=0, char quotechar=0)
+    ~DirectFileCursor()
     {
-        auto s = std::string(ptr, size);
-        if(escaped) {
-            int o = 0;
-            for(int i = 0; i < s.size();) {
-                char c = s[i];
-                if((escapechar && c == escapechar) || (c == quotechar)) {
-                    i++;
-                }
-                s[o++] = s[i++];
-            }
-            s.resize(o);
+        if(fd_ != -1) {
+            ::close(fd_);
         }
-        return s;
+        free(buf_);
     }
 
-    bool startswith(const char *str)
+    void
+    open(const char *filename)
     {
-        return std::string(ptr, std::min(size, strlen(str))) == str;
+#ifdef O_DIRECT
+        int fd = ::open(filename, O_RDONLY | O_DIRECT);
+        if(fd == -1 && errno == EINVAL) {
+            fd = ::open(filename, O_RDONLY);
+        }
+#else
+        int fd = ::open(filename, O_RDONLY);
+#endif
+        if(fd == -1) {
+            throw Error(filename, strerror(errno));
+        }
+#ifdef F_NOCACHE
+        // macOS lacks O_DIRECT, but can still be asked not to cache.
+        ::fcntl(fd, F_NOCACHE, 1);
+#endif
+        fd_ = fd;
+        capacity_ = block_size_;
+        if(posix_memalign((void **) &buf_, kAlign, capacity_ + kPadding)) {
+            throw Error("DirectFileCursor", "out of memory");
+        }
+        memset(buf_, 0, capacity_ + kPadding);
+        p_ = buf_;
+        endp_ = buf_;
     }
 
-    bool equals(const char *str)
+    const std::string &
+    error() const
     {
-        return strlen(str) == size && startswith(str);
+        return error_;
     }
 
-    double as_double()
+    virtual const char *buf()
     {
-#ifdef USE_SPIRIT
-        namespace qi = boost::spirit::qi;
-        using qi::double_;
-        double n;
-        qi::parse(ptr, ptr+size, double_, n);
-        return n;
-#else
-        return strtod(ptr, NULL);
-#endif
+        return p_;
     }
-};
 
+    virtual size_t size()
+    {
+        return endp_ - p_;
+    }
 
-
-#ifndef CSM_USE_SSE42
-#warning Using non-SSE4.2 fallback implementation.
-struct StringSpannerFallback
-{
-    uint8_t charset_[256];
-
-    StringSpannerFallback(char c1=0, char c2=0, char c3=0, char c4=0)
+    virtual void consume(size_t n)
     {
-        ::memset(charset_, 0, sizeof charset_);
-        charset_[(unsigned) c1] = 1;
-        charset_[(unsigned) c2] = 1;
-        charset_[(unsigned) c3] = 1;
-        charset_[(unsigned) c4] = 1;
-        charset_[0] = 0;
+        p_ += std::min(n, (size_t) (endp_ - p_));
     }
 
-    size_t
-    operator()(const char *s)
-        __attribute__((__always_inline__))
+    virtual bool fill()
     {
-        CSM_DEBUG("bitfield[32] = %d", charset_[32]);
-        CSM_DEBUG("span[0] = {%d,%d,%d,%d,%d,%d,%d,%d}",
-            s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7]);
-        CSM_DEBUG("span[1] = {%d,%d,%d,%d,%d,%d,%d,%d}",
-            s[8], s[9], s[10], s[11], s[12], s[13], s[14], s[15]);
+        if(eof_ || fd_ == -1) {
+            return false;
+        }
 
-        auto p = (const unsigned char *)s;
-        auto e = p + 16;
+        size_t n = size();
+        size_t head = align_up(n);
+        if(head + block_size_ > capacity_) {
+            size_t capacity = std::max(capacity_ * 2, head + block_size_);
+            char *buf;
+            if(posix_memalign((void **) &buf, kAlign, capacity + kPadding)) {
+                throw Error("DirectFileCursor", "out of memory");
+            }
+            memcpy(buf + head - n, p_, n);
+            free(buf_);
+            buf_ = buf;
+            capacity_ = capacity;
+        } else {
+            memmove(buf_ + head - n, p_, n);
+        }
+        CSM_STAT(stats_.bytes_moved += n)
 
+        CSM_STAT(auto start = std::chrono::steady_clock::now())
+        ssize_t rc;
         do {
-            if(charset_[p[0]]) {
-                break;
-            }
-            if(charset_[p[1]]) {
-                p++;
-                break;
-            }
-            if(charset_[p[2]]) {
-                p += 2;
-                break;
-            }
-            if(charset_[p[3]]) {
-                p += 3;
-                break;
-            }
-            p += 4;
-        } while(p < e);
+            rc = ::read(fd_, buf_ + head, block_size_);
+        } while(rc == -1 && errno == EINTR);
+        CSM_STAT(stats_.read_ns += elapsed_ns(start))
+        p_ = buf_ + head - n;
+        endp_ = buf_ + head;
+        if(rc == -1) {
+            error_ = strerror(errno);
+            eof_ = true;
+            return false;
+        }
 
-        return p - (const unsigned char *)s;
+        endp_ += rc;
+        memset(endp_, 0, kPadding);
+        if((size_t) rc < block_size_) {
+            eof_ = true;
+        }
+        CSM_STAT(stats_.fills++; stats_.bytes_read += rc)
+        return rc > 0;
     }
 };
 
-using StringSpanner = StringSpannerFallback;
-#   define CSM_ATTR_SSE42
-#endif // !CSM_USE_SSE42
-
 
-#ifdef CSM_USE_SSE42
-struct StringSpannerSse42
+class FdStreamCursor
+    : public BufferedStreamCursor
 {
-    __m128i v_;
+    int fd_;
 
-    StringSpannerSse42(char c1=0, char c2=0, char c3=0, char c4=0)
+    public:
+    FdStreamCursor(int fd)
+        : BufferedStreamCursor()
+        , fd_(fd)
     {
-        __v16qi vq = {c1, c2, c3, c4};
-        v_ = (__m128i) vq;
     }
 
-    size_t __attribute__((__always_inline__, target("sse4.2")))
-    operator()(const char *buf)
+    virtual ssize_t readmore()
     {
-        return _mm_cmpistri(
-            v_,
-            _mm_loadu_si128((__m128i *) buf),
-            0
-        );
+        return ::read(fd_, &vec_[write_pos_], available());
     }
 };
 
-using StringSpanner = StringSpannerSse42;
-#   define CSM_ATTR_SSE42 __attribute__((target("sse4.2")))
-#endif // CSM_USE_SSE42
-
 
-class CsvCursor
+/**
+ * Read an fd on a background thread into a pool of aligned blocks, so the
+ * next block is read while the current one is parsed. Each block reserves
+ * headroom before its data, into which fill() copies the unconsumed tail of
+ * the previous block, so only a partial row is ever copied; tails exceeding
+ * the headroom are instead joined with the new block in a separate buffer,
+ * which grows geometrically.
+ * Destruction waits for any read in progress to complete.
+ *
+ * Subclasses may override read_block() to produce blocks some other way, for
+ * example by decompressing the fd. The thread starts on the first fill(), and
+ * a subclass destructor must call stop() before tearing down its own state.
+ * After fill() returns false, error() describes any read failure.
+ */
+class AsyncFdStreamCursor
+    : public StreamCursor
 {
-    public:
-    std::vector<CsvCell> cells;
-    int count;
-
-    CsvCursor()
-        : cells(32)
-        , count(0)
+    struct Block
     {
-    }
+        char *data;
+        ssize_t len;
+    };
 
-    bool
-    by_value(const std::string &value, CsvCell *&cell)
+    size_t block_size_;
+    size_t headroom_;
+    std::vector<Block> blocks_;
+    std::deque<int> free_;
+    std::deque<int> ready_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+
+    // Block being parsed, or -1 if stitch_ holds the data.
+    int current_;
+    std::vector<char> stitch_;
+    char empty_[kPadding];
+    const char *p_;
+    const char *endp_;
+
+    void
+    run()
     {
-        for(int i = 0; i < count; i++) {
-            if(value == cells[i].as_str(0, 0)) {
-                cell = &cells[i];
-                return true;
+        for(;;) {
+            int i;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [this] { return stop_ || !free_.empty(); });
+                if(stop_) {
+                    return;
+                }
+                i = free_.front();
+                free_.pop_front();
+            }
+
+            Block &block = blocks_[i];
+            block.len = read_block(block.data + headroom_, block_size_);
+            if(block.len < 0 && error_.empty()) {
+                error_ = strerror(errno);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready_.push_back(i);
+            cond_.notify_all();
+            if(block.len <= 0) {
+                return;
             }
         }
-        return false;
     }
-};
 
+    void
+    release(int i)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(i);
+        cond_.notify_all();
+    }
 
-class CsvReader
-{
-    const char *endp_;
-    const char *p_;
-    char delimiter_;
-    char quotechar_;
-    char escapechar_;
-    bool yield_incomplete_row_;
+    protected:
+    int fd_;
 
-    public:
-    bool in_newline_skip;
+    // Set by read_block() or run() before the end marker is queued.
+    std::string error_;
 
-    private:
-    StreamCursor &stream_;
-    StringSpanner quoted_cell_spanner_;
-    StringSpanner unquoted_cell_spanner_;
-    CsvCursor row_;
+    /**
+     * Produce up to size bytes at buf, returning the count, 0 at the end of
+     * input, or -1 with errno or error_ set. Runs on the background thread.
+     */
+    virtual ssize_t
+    read_block(char *buf, size_t size)
+    {
+        ssize_t rc;
+        do {
+            rc = ::read(fd_, buf, size);
+        } while(rc == -1 && errno == EINTR);
+        return rc;
+    }
 
-    enum CsmTryParseReturnType {
-        kCsmTryParseOkay,
-        kCsmTryParseOverflow,
-        kCsmTryParseUnderrun
-    };
+    /**
+     * Wait for the background thread to exit.
+     */
+    void
+    stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            cond_.notify_all();
+        }
+        if(thread_.joinable()) {
+            thread_.join();
+        }
+    }
 
-    CsmTryParseReturnType
-    try_parse()
-        CSM_ATTR_SSE42
+    public:
+    AsyncFdStreamCursor(int fd, size_t block_size=1048576, int blocks=2)
+        : block_size_(block_size)
+        , headroom_(std::max(block_size / 4, (size_t) 4096))
+        , stop_(false)
+        , current_(-1)
+        , p_(empty_)
+        , endp_(empty_)
+        , fd_(fd)
     {
-        const char *p = p_;
-        const char *cell_start;
-        int rc;
+        memset(empty_, 0, sizeof empty_);
+        blocks_.resize(std::max(blocks, 2));
+        for(size_t i = 0; i < blocks_.size(); i++) {
+            void *p;
+            if(posix_memalign(&p, 4096, headroom_ + block_size_ + kPadding)) {
+                for(size_t j = 0; j < i; j++) {
+                    free(blocks_[j].data);
+                }
+                throw Error("AsyncFdStreamCursor", "out of memory");
+            }
+            blocks_[i].data = (char *) p;
+            blocks_[i].len = 0;
+            free_.push_back((int) i);
+        }
+    }
 
-        CsvCell *cell = &row_.cells[0];
-        row_.count = 0;
+    virtual ~AsyncFdStreamCursor()
+    {
+        stop();
+        for(auto &block : blocks_) {
+            free(block.data);
+        }
+    }
 
-        #define PREAMBLE() \
-            if(p >= endp_) {\
-                CSM_DEBUG("pos exceeds size"); \
-                return kCsmTryParseUnderrun; \
-            } \
-            CSM_DEBUG("p = %#p; remain = %ld; next char is: %d", p, endp_-p, (int)*p) \
-            CSM_DEBUG("%d: distance to next newline: %d", __LINE__, strchr(p, '\n') - p);
+    int
+    fd() const
+    {
+        return fd_;
+    }
 
-        #define NEXT_CELL() \
-            ++cell; \
-            if(row_.count == row_.cells.size()) { \
-                CSM_DEBUG("cell array overflow"); \
-                return kCsmTryParseOverflow; \
-            }
+    const std::string &
+    error() const
+    {
+        return error_;
+    }
 
-        CSM_DEBUG("remain = %lu", endp_ - p);
-        CSM_DEBUG("ch = %d %c", (int) *p, *p);
+    virtual const char *buf()
+    {
+        return p_;
+    }
 
-    newline_skip:
-        /*
-         * Skip newlines appearing at the start of the line, which may be a
-         * result of DOS/MAC-formatted input. Or a double-spaced CSV file.
-         */
-        in_newline_skip = true;
-        PREAMBLE()
-        if(*p == '\r' || *p == '\n') {
-            ++p;
-            goto newline_skip;
+    virtual size_t size()
+    {
+        return endp_ - p_;
+    }
+
+    virtual void consume(size_t n)
+    {
+        p_ += std::min(n, (size_t) (endp_ - p_));
+    }
+
+    virtual bool fill()
+    {
+        int i;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if(! thread_.joinable()) {
+                thread_ = std::thread(&AsyncFdStreamCursor::run, this);
+            }
+            CSM_STAT(auto start = std::chrono::steady_clock::now())
+            cond_.wait(lock, [this] { return !ready_.empty(); });
+            CSM_STAT(stats_.read_ns += elapsed_ns(start))
+            i = ready_.front();
+            if(blocks_[i].len <= 0) {
+                // Leave the end marker queued for later calls.
+                return false;
+            }
+            ready_.pop_front();
         }
 
-    cell_start:
-        in_newline_skip = false;
-        PREAMBLE()
-        cell->escaped = false;
-        if(*p == '\r' || *p == '\n') {
-            /*
-             * A newline appearing after at least one cell has been read
-             * indicates the presence of a single comma demarcating an unquoted
-             * unquoted unquoted unquoted empty final field.
-             */
-            cell->ptr = 0;
-            cell->size = 0;
-            ++row_.count;
-            p_ = p + 1;
-            return kCsmTryParseOkay;
-        } else if(*p == quotechar_) {
-            cell_start = ++p;
-            goto in_quoted_cell;
+        char *datap = blocks_[i].data + headroom_;
+        size_t len = blocks_[i].len;
+        size_t n = size();
+        CSM_STAT(stats_.fills++; stats_.bytes_read += len)
+        if(n <= headroom_) {
+            CSM_STAT(stats_.bytes_moved += n)
+            memcpy(datap - n, p_, n);
+            if(current_ != -1) {
+                release(current_);
+            }
+            current_ = i;
+            p_ = datap - n;
         } else {
-            cell_start = p;
-            goto in_unquoted_cell;
+            // A tail already in stitch_ stays put while the new block fits
+            // after it, and is otherwise moved to a buffer of twice the
+            // needed size, so a row spanning many blocks is copied O(1)
+            // times per byte.
+            size_t need = n + len + kPadding;
+            size_t off = stitch_.size();
+            if(current_ == -1) {
+                off = p_ - &stitch_[0];
+            }
+            if((off + need) > stitch_.size()) {
+                CSM_STAT(stats_.bytes_moved += n)
+                if((2 * need) > stitch_.size()) {
+                    std::vector<char> stitch(2 * need);
+                    memcpy(&stitch[0], p_, n);
+                    stitch_.swap(stitch);
+                } else {
+                    memmove(&stitch_[0], p_, n);
+                }
+                off = 0;
+            }
+            CSM_STAT(stats_.bytes_moved += len)
+            memcpy(&stitch_[off + n], datap, len);
+            memset(&stitch_[off + n + len], 0, kPadding);
+            release(i);
+            if(current_ != -1) {
+                release(current_);
+                current_ = -1;
+            }
+            p_ = &stitch_[off];
         }
+        endp_ = p_ + n + len;
+        return true;
+    }
+};
 
-    in_quoted_cell:
-        PREAMBLE()
-        rc = quoted_cell_spanner_(p);
-        switch(rc) {
-            case 16:
-                p += 16;
-                goto in_quoted_cell;
-            default:
-                p += rc + 1;
-                goto in_escape_or_end_of_quoted_cell;
+
+#ifdef CSM_USE_ZLIB
+/**
+ * Decompress a gzip or zlib fd on the background thread of an
+ * AsyncFdStreamCursor, inflating directly into its padded blocks. Inputs made
+ * of several concatenated gzip members, such as BGZF, are read to the end.
+ * Input that stops within a member is reported through error().
+ */
+class GzipFdStreamCursor
+    : public AsyncFdStreamCursor
+{
+    z_stream zs_;
+    std::vector<char> in_;
+    bool eof_;
+    bool in_member_;
+
+    protected:
+    virtual ssize_t
+    read_block(char *buf, size_t size)
+    {
+        zs_.next_out = (Bytef *) buf;
+        zs_.avail_out = (uInt) size;
+        while(zs_.avail_out) {
+            if(! zs_.avail_in) {
+                if(eof_) {
+                    break;
+                }
+                ssize_t rc = AsyncFdStreamCursor::read_block(&in_[0],
+                                                             in_.size());
+                if(rc < 0) {
+                    return -1;
+                } else if(rc == 0) {
+                    eof_ = true;
+                    if(in_member_) {
+                        error_ = "compressed input is truncated";
+                        return -1;
+                    }
+                    break;
+                }
+                zs_.next_in = (Bytef *) &in_[0];
+                zs_.avail_in = (uInt) rc;
             }
 
-    in_escape_or_end_of_quoted_cell:
-        PREAMBLE()
-        if(*p == delimiter_) {
-            cell->ptr = cell_start;
-            cell->size = p - cell_start - 1;
-            ++row_.count;
-            NEXT_CELL();
-            ++p;
-            goto cell_start;
-        } else if(*p == '\r' || *p == '\n') {
-            cell->ptr = cell_start;
-            cell->size = p - cell_start - 1;
-            ++row_.count;
-            p_ = p + 1;
-            return kCsmTryParseOkay;
-        } else {
-            cell->escaped = true;
-            ++p;
-            goto in_quoted_cell;
+            int rc = inflate(&zs_, Z_NO_FLUSH);
+            if(rc == Z_STREAM_END) {
+                inflateReset(&zs_);
+                in_member_ = false;
+            } else if(rc == Z_OK || rc == Z_BUF_ERROR) {
+                in_member_ = true;
+            } else {
+                error_ = zs_.msg ? zs_.msg : "inflate() failed";
+                return -1;
+            }
         }
+        return size - zs_.avail_out;
+    }
 
-    in_unquoted_cell:
-        CSM_DEBUG("\n\nin_unquoted_cell")
-        PREAMBLE()
-        rc = unquoted_cell_spanner_(p);
-        CSM_DEBUG("unquoted span: %d; p[3]=%d p[..17]='%.17s'", rc, p[3], p);
-        switch(rc) {
-        case 16:
-            p += 16;
-            goto in_unquoted_cell;
-        default:
-            p += rc;
-            goto in_escape_or_end_of_unquoted_cell;
+    public:
+    GzipFdStreamCursor(int fd, size_t block_size=1048576, int blocks=2)
+        : AsyncFdStreamCursor(fd, block_size, blocks)
+        , in_(262144)
+        , eof_(false)
+        , in_member_(false)
+    {
+        memset(&zs_, 0, sizeof zs_);
+        // 15 bit window, plus 32 to detect gzip or zlib headers.
+        if(inflateInit2(&zs_, 15 + 32) != Z_OK) {
+            throw Error("GzipFdStreamCursor", "inflateInit2() failed");
         }
+    }
 
-    in_escape_or_end_of_unquoted_cell:
-        PREAMBLE()
-        if(*p == delimiter_) {
-            cell->ptr = cell_start;
-            cell->size = p - cell_start;
-            ++row_.count;
-            CSM_DEBUG("in_escape_or_end_of_unquoted_cell(DELIMITER)")
-            CSM_DEBUG("p[..17] = '%.17s'", p)
-            CSM_DEBUG("done cell: '%.*s'", (int)cell->size, cell->ptr)
-            NEXT_CELL();
-            ++p;
-            goto cell_start;
-        } else if(*p == '\r' || *p == '\n') {
-            CSM_DEBUG("in_escape_or_end_of_unquoted_cell(NEWLINE)")
-            cell->ptr = cell_start;
-            cell->size = p - cell_start;
-            ++row_.count;
-            p_ = p + 1;
-            return kCsmTryParseOkay;
-        } else {
-            cell->escaped = true;
-            ++p;
-            goto in_unquoted_cell;
-        }
+    virtual ~GzipFdStreamCursor()
+    {
+        stop();
+        inflateEnd(&zs_);
+    }
+};
+#endif // CSM_USE_ZLIB
 
-    end_of_buf:
-        CSM_DEBUG("error out");
-        return kCsmTryParseUnderrun;
+
+/**
+ * Byte orders read by Utf16StreamCursor. kCsmUtf16Detect follows a byte order
+ * mark, and without one assumes little endian, as Windows writes.
+ */
+enum CsmUtf16Type {
+    kCsmUtf16Detect,
+    kCsmUtf16Le,
+    kCsmUtf16Be
+};
+
+
+/**
+ * Transcode up to units UTF-16 code units at in to UTF-8 at out, which must
+ * have room for 3 bytes per unit, returning the bytes written and setting
+ * used to the units consumed. Runs of ASCII are narrowed 8 units at a time.
+ * Unpaired surrogates become U+FFFD, except that a high surrogate ending the
+ * input is left unconsumed unless final is set.
+ */
+static inline size_t
+utf16_to_utf8(const char *in, size_t units, bool big_endian, bool final,
+              char *out, size_t &used)
+{
+    const unsigned char *p = (const unsigned char *) in;
+    char *o = out;
+    size_t i = 0;
+    while(i < units) {
+#ifdef CSM_USE_SSE42
+        if(i + 8 <= units) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (p + 2 * i));
+            if(big_endian) {
+                v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            }
+            if(_mm_testz_si128(v, _mm_set1_epi16((short) 0xff80))) {
+                _mm_storel_epi64((__m128i *) o, _mm_packus_epi16(v, v));
+                o += 8;
+                i += 8;
+                continue;
+            }
+        }
+#endif
+        uint32_t c = big_endian
+            ? (p[2 * i] << 8) | p[2 * i + 1]
+            : p[2 * i] | (p[2 * i + 1] << 8);
+        i++;
+        if(c < 0x80) {
+            *o++ = (char) c;
+            continue;
+        } else if(c < 0x800) {
+            *o++ = (char) (0xc0 | (c >> 6));
+            *o++ = (char) (0x80 | (c & 0x3f));
+            continue;
+        } else if(c >= 0xd800 && c < 0xdc00) {
+            if(i == units && !final) {
+                i--;
+                break;
+            }
+            uint32_t d = (i == units) ? 0 : big_endian
+                ? (p[2 * i] << 8) | p[2 * i + 1]
+                : p[2 * i] | (p[2 * i + 1] << 8);
+            if(d >= 0xdc00 && d < 0xe000) {
+                c = 0x10000 + ((c - 0xd800) << 10) + (d - 0xdc00);
+                i++;
+                *o++ = (char) (0xf0 | (c >> 18));
+                *o++ = (char) (0x80 | ((c >> 12) & 0x3f));
+                *o++ = (char) (0x80 | ((c >> 6) & 0x3f));
+                *o++ = (char) (0x80 | (c & 0x3f));
+                continue;
+            }
+            c = 0xfffd;
+        } else if(c >= 0xdc00 && c < 0xe000) {
+            c = 0xfffd;
+        }
+        *o++ = (char) (0xe0 | (c >> 12));
+        *o++ = (char) (0x80 | ((c >> 6) & 0x3f));
+        *o++ = (char) (0x80 | (c & 0x3f));
     }
+    used = i;
+    return o - out;
+}
 
-    #undef PREAMBLE
-    #undef NEXT_CELL
 
-    public:
-    bool
-    read_row()
+/**
+ * Present UTF-16 input read from another cursor as UTF-8, transcoding as the
+ * reader asks for more, so that UTF-16 files are parsed without converting
+ * them first. A byte order mark at the start is dropped, as is one matching
+ * a fixed byte order, and a final odd byte becomes U+FFFD. Offsets such as
+ * CsvReader::row_offset() count UTF-8 bytes, so seek() is not supported. The
+ * source cursor is not owned.
+ */
+class Utf16StreamCursor
+    : public BufferedStreamCursor
+{
+    StreamCursor &source_;
+    CsmUtf16Type type_;
+    bool started_;
+
+    protected:
+    virtual ssize_t
+    readmore()
     {
-        const char *p;
-        CSM_DEBUG("")
+        bool eof = false;
+        while(source_.size() < 4 && !eof) {
+            eof = !source_.fill();
+        }
 
-        do {
-            p = stream_.buf();
-            p_ = p;
-            endp_ = p + stream_.size();
-            switch(try_parse()) {
-                case kCsmTryParseOkay:
-                    stream_.consume(p_ - p);
-                    return true;
-                case kCsmTryParseOverflow:
-                    row_.cells.resize(2 * row_.cells.size());
-                    return read_row();
-                case kCsmTryParseUnderrun:
-                    ;
+        const char *p = source_.buf();
+        size_t size = source_.size();
+        if(! started_ && size >= 2) {
+            started_ = true;
+            unsigned char b0 = p[0];
+            unsigned char b1 = p[1];
+            if(b0 == 0xff && b1 == 0xfe && type_ != kCsmUtf16Be) {
+                type_ = kCsmUtf16Le;
+                source_.consume(2);
+                return readmore();
+            } else if(b0 == 0xfe && b1 == 0xff && type_ != kCsmUtf16Le) {
+                type_ = kCsmUtf16Be;
+                source_.consume(2);
+                return readmore();
             }
-            CSM_DEBUG("attempting fill!")
-        } while(stream_.fill());
+        }
 
-        if(row_.count && yield_incomplete_row_) {
-            CSM_DEBUG("stream fill failed, but partial row exists")
-            stream_.consume(endp_ - p);
-            return true;
+        ensure(3 * 64);
+        if(size == 1 && eof) {
+            source_.consume(1);
+            memcpy(&vec_[write_pos_], "\xef\xbf\xbd", 3);
+            return 3;
         }
 
-        CSM_DEBUG("stream fill failed")
-        return false;
+        size_t used;
+        size_t n = utf16_to_utf8(p, std::min(size / 2, available() / 3),
+                                 type_ == kCsmUtf16Be, eof,
+                                 &vec_[write_pos_], used);
+        source_.consume(2 * used);
+        return n;
     }
 
-    CsvCursor &
-    row()
+    public:
+    Utf16StreamCursor(StreamCursor &source, CsmUtf16Type type=kCsmUtf16Detect)
+        : BufferedStreamCursor()
+        , source_(source)
+        , type_(type)
+        , started_(false)
     {
-        return row_;
     }
 
-    CsvReader(StreamCursor &stream,
-            char delimiter=',',
-            char quotechar='"',
-            char escapechar=0,
-            bool yield_incomplete_row=false)
-        : endp_(stream.buf() + stream.size())
-        , p_(stream.buf())
-        , delimiter_(delimiter)
-        , quotechar_(quotechar)
-        , escapechar_(escapechar)
-        , stream_(stream)
-        , quoted_cell_spanner_(quotechar, escapechar)
-        , unquoted_cell_spanner_(delimiter, '\r', '\n', escapechar)
-        , yield_incomplete_row_(yield_incomplete_row)
+    StreamCursor &
+    source()
     {
+        return source_;
     }
 };
 
 
+/**
+ * Locale-independent number parsing bounded by an explicit length, for cells
+ * that are not NUL terminated. Like strtod(), leading blanks are skipped,
+ * parsing stops at the first byte that cannot continue the number, and an
+ * empty or non-numeric input yields 0. Integer results that do not fit the
+ * target type throw Error.
+ */
+static inline bool
+is_eight_digits(uint64_t v)
+{
+    return !(((v & 0xf0f0f0f0f0f0f0f0ULL)
+            | (((v + 0x0606060606060606ULL) & 0xf0f0f0f0f0f0f0f0ULL) >> 4))
+           ^ 0x3333333333333333ULL);
+}
+
+
+/**
+ * Convert eight ASCII digits loaded little-endian into their value with three
+ * multiplies rather than eight dependent ones.
+ */
+static inline uint32_t
+parse_eight_digits(uint64_t v)
+{
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32)))
+         + (((v >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32))))
+        >> 32;
+    return (uint32_t) v;
+}
+
+
+/**
+ * Accumulate a run of digits into mantissa while it cannot overflow 10**19,
+ * counting further digits in dropped. Sets truncated if a nonzero digit was
+ * lost.
+ */
+static inline bool
+scan_digits(const char *&p, const char *endp, uint64_t &mantissa,
+            int &dropped, bool &truncated)
+{
+    const char *startp = p;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while((endp - p) >= 8 && mantissa < 100000000000ULL) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        if(! is_eight_digits(v)) {
+            break;
+        }
+        mantissa = (mantissa * 100000000) + parse_eight_digits(v);
+        p += 8;
+    }
+#endif
+    for(; p < endp && (unsigned) (*p - '0') < 10; p++) {
+        if(mantissa < 1000000000000000000ULL) {
+            mantissa = (mantissa * 10) + (*p - '0');
+        } else {
+            dropped++;
+            truncated |= *p != '0';
+        }
+    }
+    return p != startp;
+}
+
+
+static inline const char *
+skip_blanks(const char *p, const char *endp)
+{
+    while(p < endp && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+
+/**
+ * Parse a decimal number into sign, up to 19 significant digits and a
+ * power-of-ten exponent. Returns false if no digits were found.
+ */
+static inline bool
+scan_decimal(const char *&p, const char *endp, bool &negative,
+             uint64_t &mantissa, int &exponent, bool &truncated)
+{
+    p = skip_blanks(p, endp);
+    negative = false;
+    if(p < endp && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+
+    mantissa = 0;
+    truncated = false;
+    int dropped = 0;
+    bool any = scan_digits(p, endp, mantissa, dropped, truncated);
+    exponent = dropped;
+    if(p < endp && *p == '.') {
+        p++;
+        int fraction_dropped = 0;
+        const char *startp = p;
+        any |= scan_digits(p, endp, mantissa, fraction_dropped, truncated);
+        exponent -= (int) (p - startp) - fraction_dropped;
+    }
+    if(! any) {
+        return false;
+    }
+
+    if(p < endp && (*p | 0x20) == 'e') {
+        const char *ep = p + 1;
+        bool exp_negative = false;
+        if(ep < endp && (*ep == '-' || *ep == '+')) {
+            exp_negative = *ep++ == '-';
+        }
+        if(ep < endp && (unsigned) (*ep - '0') < 10) {
+            int e = 0;
+            for(; ep < endp && (unsigned) (*ep - '0') < 10; ep++) {
+                if(e < 100000) {
+                    e = (e * 10) + (*ep - '0');
+                }
+            }
+            exponent += exp_negative ? -e : e;
+            p = ep;
+        }
+    }
+    return true;
+}
+
+
+static inline bool
+match_word(const char *&p, const char *endp, const char *word)
+{
+    size_t len = strlen(word);
+    if((size_t) (endp - p) < len) {
+        return false;
+    }
+    for(size_t i = 0; i < len; i++) {
+        if((p[i] | 0x20) != word[i]) {
+            return false;
+        }
+    }
+    p += len;
+    return true;
+}
+
+
+/**
+ * The "C" locale, created once, so that strtod_l() always takes '.' as the
+ * decimal point.
+ */
+static inline locale_t
+c_locale()
+{
+    static locale_t locale = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+    return locale;
+}
+
+
+/**
+ * Correctly rounded fallback for inputs outside the fast path. [p, endp) is
+ * a number already validated by scan_decimal(), copied to terminate it.
+ */
+static inline double
+parse_double_slow(const char *p, const char *endp)
+{
+    char buf[128];
+    size_t size = endp - p;
+    if(size < sizeof buf) {
+        memcpy(buf, p, size);
+        buf[size] = '\0';
+        return strtod_l(buf, 0, c_locale());
+    }
+    return strtod_l(std::string(p, endp).c_str(), 0, c_locale());
+}
+
+
+static inline double
+parse_double(const char *p, size_t size)
+{
+    static const double kPowersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *endp = p + size;
+    const char *startp = p;
+    bool negative;
+    uint64_t mantissa;
+    int exponent;
+    bool truncated;
+    if(! scan_decimal(p, endp, negative, mantissa, exponent, truncated)) {
+        p = skip_blanks(startp, endp);
+        negative = p < endp && *p == '-';
+        p += p < endp && (*p == '-' || *p == '+');
+        double d = 0;
+        if(match_word(p, endp, "inf")) {
+            d = std::numeric_limits<double>::infinity();
+        } else if(match_word(p, endp, "nan")) {
+            d = std::numeric_limits<double>::quiet_NaN();
+        }
+        return negative ? -d : d;
+    }
+
+    // Both the mantissa and the power of ten are exact doubles, so a single
+    // IEEE multiply or divide yields the correctly rounded result (Clinger).
+    double d;
+    if(mantissa == 0) {
+        d = 0;
+    } else if(!truncated && mantissa <= (1ULL << 53)
+              && exponent >= -22 && exponent <= 22) {
+        d = (double) mantissa;
+        if(exponent < 0) {
+            d /= kPowersOfTen[-exponent];
+        } else {
+            d *= kPowersOfTen[exponent];
+        }
+    } else {
+        return parse_double_slow(skip_blanks(startp, endp), p);
+    }
+    return negative ? -d : d;
+}
+
+
+static inline uint64_t
+parse_digits_u64(const char *&p, const char *endp, const char *what)
+{
+    uint64_t n = 0;
+    for(; p < endp && (unsigned) (*p - '0') < 10; p++) {
+        unsigned digit = *p - '0';
+        if(n > (UINT64_MAX - digit) / 10) {
+            throw Error(what, "integer out of range");
+        }
+        n = (n * 10) + digit;
+    }
+    return n;
+}
+
+
+static inline int64_t
+parse_int64(const char *p, size_t size)
+{
+    const char *endp = p + size;
+    p = skip_blanks(p, endp);
+    bool negative = false;
+    if(p < endp && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+    uint64_t n = parse_digits_u64(p, endp, "as_int64");
+    if(n > (uint64_t) INT64_MAX + negative) {
+        throw Error("as_int64", "integer out of range");
+    }
+    return negative ? (int64_t) (0 - n) : (int64_t) n;
+}
+
+
+static inline uint64_t
+parse_uint64(const char *p, size_t size)
+{
+    const char *endp = p + size;
+    p = skip_blanks(p, endp);
+    bool negative = false;
+    if(p < endp && (*p == '-' || *p == '+')) {
+        negative = *p++ == '-';
+    }
+    uint64_t n = parse_digits_u64(p, endp, "as_uint64");
+    if(negative && n) {
+        throw Error("as_uint64", "integer out of range");
+    }
+    return n;
+}
+
+
+/**
+ * Parse a decimal as a fixed-point integer scaled by 10**scale, rounding half
+ * away from zero, so "12.345" with scale 2 yields 1235.
+ */
+static inline int64_t
+parse_decimal(const char *p, size_t size, int scale)
+{
+    const char *endp = p + size;
+    bool negative;
+    uint64_t mantissa;
+    int exponent;
+    bool truncated;
+    if(! scan_decimal(p, endp, negative, mantissa, exponent, truncated)
+            || mantissa == 0) {
+        return 0;
+    }
+
+    int shift = exponent + scale;
+    uint64_t n = mantissa;
+    if(shift < 0) {
+        if(shift < -19) {
+            return 0;
+        }
+        uint64_t divisor = 1;
+        for(int i = 0; i < -shift; i++) {
+            divisor *= 10;
+        }
+        uint64_t remainder = n % divisor;
+        n /= divisor;
+        if(remainder >= divisor - remainder) {
+            n++;
+        }
+    } else {
+        for(int i = 0; i < shift; i++) {
+            if(n > UINT64_MAX / 10) {
+                throw Error("as_decimal", "value out of range");
+            }
+            n *= 10;
+        }
+    }
+    if(n > (uint64_t) INT64_MAX + negative) {
+        throw Error("as_decimal", "value out of range");
+    }
+    return negative ? (int64_t) (0 - n) : (int64_t) n;
+}
+
+/**
+ * Return true if [p, p+size) is entirely a number, without blanks or
+ * leading zeros, so that zero-padded identifiers are not taken for numbers.
+ */
+static inline bool
+is_plain_number(const char *p, size_t size)
+{
+    const char *endp = p + size;
+    p += p < endp && (*p == '-' || *p == '+');
+    if(p == endp || !((unsigned) (*p - '0') < 10 || *p == '.')) {
+        return false;
+    }
+    return !(*p == '0' && p + 1 < endp && (unsigned) (p[1] - '0') < 10);
+}
+
+
+/**
+ * Parse a cell that is entirely an integer, like is_plain_number(), that fits
+ * an int64_t. Returns false for anything else.
+ */
+static inline bool
+parse_exact_int64(const char *p, size_t size, int64_t &out)
+{
+    if(! is_plain_number(p, size)) {
+        return false;
+    }
+    const char *endp = p + size;
+    bool negative = false;
+    if(*p == '-' || *p == '+') {
+        negative = *p++ == '-';
+    }
+    if(p == endp || (endp - p) > 19) {
+        return false;
+    }
+    uint64_t n = 0;
+    for(; p < endp; p++) {
+        unsigned digit = *p - '0';
+        if(digit >= 10) {
+            return false;
+        }
+        n = (n * 10) + digit;
+    }
+    if(n > (uint64_t) INT64_MAX + negative) {
+        return false;
+    }
+    out = negative ? (int64_t) (0 - n) : (int64_t) n;
+    return true;
+}
+
+
+/**
+ * Parse a cell that is entirely a decimal number, like is_plain_number(),
+ * as parse_double() would. Returns false for anything else, including "inf"
+ * and "nan".
+ */
+static inline bool
+parse_exact_double(const char *p, size_t size, double &out)
+{
+    if(! is_plain_number(p, size)) {
+        return false;
+    }
+    const char *q = p;
+    bool negative;
+    uint64_t mantissa;
+    int exponent;
+    bool truncated;
+    if(! (scan_decimal(q, p + size, negative, mantissa, exponent, truncated)
+            && q == p + size)) {
+        return false;
+    }
+    out = parse_double(p, size);
+    return true;
+}
+
+
+/**
+ * Parse "true" or "false" in any case.
+ */
+static inline bool
+parse_bool(const char *p, size_t size, bool &out)
+{
+    const char *endp = p + size;
+    if(match_word(p, endp, "true") && p == endp) {
+        out = true;
+    } else if(match_word(p, endp, "false") && p == endp) {
+        out = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Parse an ISO 8601 calendar date, "YYYY-MM-DD".
+ */
+static inline bool
+parse_date(const char *p, size_t size, int &year, int &month, int &day)
+{
+    static const int kDaysInMonth[] = {
+        31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+    };
+
+    if(size != 10 || p[4] != '-' || p[7] != '-') {
+        return false;
+    }
+    int fields[3] = { 0, 0, 0 };
+    static const int kStarts[] = { 0, 5, 8 };
+    static const int kLengths[] = { 4, 2, 2 };
+    for(int i = 0; i < 3; i++) {
+        for(int j = 0; j < kLengths[i]; j++) {
+            unsigned digit = p[kStarts[i] + j] - '0';
+            if(digit >= 10) {
+                return false;
+            }
+            fields[i] = (fields[i] * 10) + digit;
+        }
+    }
+
+    year = fields[0];
+    month = fields[1];
+    day = fields[2];
+    if(year < 1 || month < 1 || month > 12 || day < 1) {
+        return false;
+    }
+    bool leap = (year % 4 == 0) && (year % 100 != 0 || year % 400 == 0);
+    return day <= kDaysInMonth[month - 1] + (month == 2 && leap);
+}
+
+
+
+/**
+ * Fast non-cryptographic hash of size bytes at p, chained from h.
+ */
+static inline uint64_t
+hash_bytes(const char *p, size_t size, uint64_t h)
+{
+    h ^= size * 0x9e3779b97f4a7c15ULL;
+    for(; size >= 8; p += 8, size -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        h = (h ^ v) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    if(size) {
+        uint64_t v = 0;
+        memcpy(&v, p, size);
+        h = (h ^ v) * 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+
+/**
+ * Copy size bytes at p to out, dropping each escapechar or quotechar and
+ * copying the byte after it literally. A zero escapechar or quotechar is
+ * disabled. Returns the decoded size, which never exceeds size. Runs without
+ * a special byte are copied 16 bytes at a time, never reading past p + size.
+ */
+static inline size_t
+unescape(const char *p, size_t size, char *out, char escapechar,
+         char quotechar)
+{
+    const char *endp = p + size;
+    char *o = out;
+    if(! escapechar) {
+        escapechar = quotechar;
+    } else if(! quotechar) {
+        quotechar = escapechar;
+    }
+    if(! quotechar) {
+        memcpy(out, p, size);
+        return size;
+    }
+
+#ifdef CSM_USE_SSE42
+    const __m128i quote = _mm_set1_epi8(quotechar);
+    const __m128i escape = _mm_set1_epi8(escapechar);
+    while((endp - p) >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        unsigned mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                         _mm_cmpeq_epi8(v, escape)));
+        // out never runs ahead of p, so a whole vector always fits.
+        _mm_storeu_si128((__m128i *) o, v);
+        if(! mask) {
+            o += 16;
+            p += 16;
+            continue;
+        }
+
+        int n = __builtin_ctz(mask);
+        o += n;
+        p += n + 1;
+        if(p < endp) {
+            *o++ = *p++;
+        }
+    }
+#endif
+
+    while(p < endp) {
+        char c = *p++;
+        if(c == quotechar || c == escapechar) {
+            if(p == endp) {
+                break;
+            }
+            c = *p++;
+        }
+        *o++ = c;
+    }
+    return o - out;
+}
+
+
+struct CsvCell
+{
+    const char *ptr;
+    size_t size;
+    bool escaped;
+
+    public:
+    /**
+     * Return a copy of the cell, unescaped if it is escaped.
+     */
+    std::string as_str(char escapechar=0, char quotechar='"')
+    {
+        if(! escaped) {
+            return std::string(ptr, size);
+        }
+        std::string s(size, '\0');
+        s.resize(unescape(ptr, size, &s[0], escapechar, quotechar));
+        return s;
+    }
+
+    bool startswith(const char *str)
+    {
+        return std::string(ptr, std::min(size, strlen(str))) == str;
+    }
+
+    bool equals(const char *str)
+    {
+        return strlen(str) == size && startswith(str);
+    }
+
+    double as_double()
+    {
+#ifdef USE_SPIRIT
+        namespace qi = boost::spirit::qi;
+        using qi::double_;
+        double n;
+        qi::parse(ptr, ptr+size, double_, n);
+        return n;
+#else
+        return parse_double(ptr, size);
+#endif
+    }
+
+    int64_t as_int64()
+    {
+        return parse_int64(ptr, size);
+    }
+
+    uint64_t as_uint64()
+    {
+        return parse_uint64(ptr, size);
+    }
+
+    /**
+     * Return the cell as a fixed-point integer in units of 10**-scale.
+     */
+    int64_t as_decimal(int scale)
+    {
+        return parse_decimal(ptr, size, scale);
+    }
+};
+
+
+/**
+ * Storage for unescaped copies of escaped cells, reused from one row to the
+ * next. Decoded cells point into the arena until reset(). Once it has grown
+ * to fit the largest row seen, decoding allocates nothing.
+ */
+class UnescapeArena
+{
+    std::vector<char> buf_;
+    size_t used_;
+    // Blocks outgrown since the last reset(), which cells may still use.
+    std::vector<std::vector<char>> retired_;
+
+    public:
+    UnescapeArena()
+        : used_(0)
+    {
+    }
+
+    void
+    reset()
+    {
+        used_ = 0;
+        if(retired_.size()) {
+            retired_.clear();
+        }
+    }
+
+    /**
+     * Return cell if it is not escaped, otherwise a view of its unescaped
+     * bytes in the arena.
+     */
+    CsvCell
+    decode(const CsvCell &cell, char escapechar=0, char quotechar='"')
+    {
+        if(! cell.escaped) {
+            return cell;
+        }
+        if((buf_.size() - used_) < cell.size) {
+            size_t size = std::max(cell.size, std::max((size_t) 4096,
+                                                       2 * buf_.size()));
+            retired_.emplace_back(size);
+            retired_.back().swap(buf_);
+            used_ = 0;
+        }
+
+        char *out = buf_.data() + used_;
+        size_t size = unescape(cell.ptr, cell.size, out, escapechar,
+                               quotechar);
+        used_ += size;
+        return CsvCell { out, size, false };
+    }
+};
+
+
+
+/**
+ * Spanners find the first byte within the next kWidth bytes of a buffer that
+ * matches one of up to four characters, returning its offset, or kWidth if
+ * none match. NUL is never matched.
+ */
+enum CsmSpannerType {
+    kCsmSpannerFallback,
+    kCsmSpannerSse42,
+    kCsmSpannerAvx2,
+    kCsmSpannerAvx512
+};
+
+
+#ifndef CSM_USE_SSE42
+#warning Using non-SSE4.2 fallback implementation.
+#endif // !CSM_USE_SSE42
+
+struct StringSpannerFallback
+{
+    enum { kWidth = 16 };
+    uint8_t charset_[256];
+
+    StringSpannerFallback(char c1=0, char c2=0, char c3=0, char c4=0)
+    {
+        ::memset(charset_, 0, sizeof charset_);
+        charset_[(unsigned char) c1] = 1;
+        charset_[(unsigned char) c2] = 1;
+        charset_[(unsigned char) c3] = 1;
+        charset_[(unsigned char) c4] = 1;
+        charset_[0] = 0;
+    }
+
+    size_t
+    operator()(const char *s)
+        __attribute__((__always_inline__))
+    {
+        CSM_DEBUG("bitfield[32] = %d", charset_[32]);
+        CSM_DEBUG("span[0] = {%d,%d,%d,%d,%d,%d,%d,%d}",
+            s[0], s[1], s[2], s[3], s[4], s[5], s[6], s[7]);
+        CSM_DEBUG("span[1] = {%d,%d,%d,%d,%d,%d,%d,%d}",
+            s[8], s[9], s[10], s[11], s[12], s[13], s[14], s[15]);
+
+        auto p = (const unsigned char *)s;
+        auto e = p + 16;
+
+        do {
+            if(charset_[p[0]]) {
+                break;
+            }
+            if(charset_[p[1]]) {
+                p++;
+                break;
+            }
+            if(charset_[p[2]]) {
+                p += 2;
+                break;
+            }
+            if(charset_[p[3]]) {
+                p += 3;
+                break;
+            }
+            p += 4;
+        } while(p < e);
+
+        return p - (const unsigned char *)s;
+    }
+};
+
+#ifndef CSM_USE_SSE42
+using StringSpanner = StringSpannerFallback;
+#   define CSM_ATTR_SSE42
+#endif // !CSM_USE_SSE42
+
+
+#ifdef CSM_USE_SSE42
+struct StringSpannerSse42
+{
+    enum { kWidth = 16 };
+    __m128i v_;
+
+    StringSpannerSse42(char c1=0, char c2=0, char c3=0, char c4=0)
+    {
+        __v16qi vq = {c1, c2, c3, c4};
+        v_ = (__m128i) vq;
+    }
+
+    size_t __attribute__((__always_inline__, target("sse4.2")))
+    operator()(const char *buf)
+    {
+        return _mm_cmpistri(
+            v_,
+            _mm_loadu_si128((__m128i *) buf),
+            0
+        );
+    }
+};
+
+using StringSpanner = StringSpannerSse42;
+#   define CSM_ATTR_SSE42 __attribute__((target("sse4.2")))
+#endif // CSM_USE_SSE42
+
+
+/*
+ * The wide spanners compare a whole 32 or 64 byte block at once, keeping the
+ * bitmask of every match in the block. Successive calls landing in the same
+ * block, such as for each short cell of a narrow row, are answered from the
+ * mask without reloading. They are compiled for their own target and picked
+ * at runtime, so they must only be used from a CsvReader::try_parse_*()
+ * wrapper of the matching target, which flattens them into the parser.
+ */
+#ifdef CSM_USE_AVX2
+#   define CSM_ATTR_AVX2 __attribute__((target("avx2")))
+
+struct StringSpannerAvx2
+{
+    enum { kWidth = 32 };
+    __m256i v1_;
+    __m256i v2_;
+    __m256i v3_;
+    __m256i v4_;
+    uintptr_t base_;
+    uint32_t mask_;
+
+    StringSpannerAvx2(char c1=0, char c2=0, char c3=0, char c4=0)
+        CSM_ATTR_AVX2
+    {
+        // Unused slots repeat c1, so NUL is never matched.
+        v1_ = _mm256_set1_epi8(c1);
+        v2_ = _mm256_set1_epi8(c2 ? c2 : c1);
+        v3_ = _mm256_set1_epi8(c3 ? c3 : c1);
+        v4_ = _mm256_set1_epi8(c4 ? c4 : c1);
+        base_ = 0;
+        mask_ = 0;
+    }
+
+    uint32_t
+    block(const char *buf)
+        CSM_ATTR_AVX2
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *) buf);
+        return (uint32_t) _mm256_movemask_epi8(
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, v1_),
+                                _mm256_cmpeq_epi8(v, v2_)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, v3_),
+                                _mm256_cmpeq_epi8(v, v4_))
+            )
+        );
+    }
+
+    size_t
+    operator()(const char *buf)
+        CSM_ATTR_AVX2
+    {
+        uintptr_t offset = (uintptr_t) buf - base_;
+        if(offset < kWidth) {
+            uint32_t mask = mask_ >> offset;
+            if(mask) {
+                return __builtin_ctz(mask);
+            }
+        }
+
+        base_ = (uintptr_t) buf;
+        mask_ = block(buf);
+        return mask_ ? __builtin_ctz(mask_) : kWidth;
+    }
+};
+#endif // CSM_USE_AVX2
+
+
+#ifdef CSM_USE_AVX512
+#   define CSM_ATTR_AVX512 __attribute__((target("avx512f,avx512bw")))
+
+struct StringSpannerAvx512
+{
+    enum { kWidth = 64 };
+    __m512i v1_;
+    __m512i v2_;
+    __m512i v3_;
+    __m512i v4_;
+    uintptr_t base_;
+    uint64_t mask_;
+
+    StringSpannerAvx512(char c1=0, char c2=0, char c3=0, char c4=0)
+        CSM_ATTR_AVX512
+    {
+        // Unused slots repeat c1, so NUL is never matched.
+        v1_ = _mm512_set1_epi8(c1);
+        v2_ = _mm512_set1_epi8(c2 ? c2 : c1);
+        v3_ = _mm512_set1_epi8(c3 ? c3 : c1);
+        v4_ = _mm512_set1_epi8(c4 ? c4 : c1);
+        base_ = 0;
+        mask_ = 0;
+    }
+
+    uint64_t
+    block(const char *buf)
+        CSM_ATTR_AVX512
+    {
+        __m512i v = _mm512_loadu_si512((const void *) buf);
+        return _mm512_cmpeq_epi8_mask(v, v1_)
+             | _mm512_cmpeq_epi8_mask(v, v2_)
+             | _mm512_cmpeq_epi8_mask(v, v3_)
+             | _mm512_cmpeq_epi8_mask(v, v4_);
+    }
+
+    size_t
+    operator()(const char *buf)
+        CSM_ATTR_AVX512
+    {
+        uintptr_t offset = (uintptr_t) buf - base_;
+        if(offset < kWidth) {
+            uint64_t mask = mask_ >> offset;
+            if(mask) {
+                return __builtin_ctzll(mask);
+            }
+        }
+
+        base_ = (uintptr_t) buf;
+        mask_ = block(buf);
+        return mask_ ? __builtin_ctzll(mask_) : kWidth;
+    }
+};
+#endif // CSM_USE_AVX512
+
+
+/**
+ * Return the widest spanner supported by the running CPU.
+ */
+inline CsmSpannerType
+best_spanner()
+{
+#ifdef CSM_USE_AVX512
+    if(__builtin_cpu_supports("avx512bw")) {
+        return kCsmSpannerAvx512;
+    }
+#endif
+#ifdef CSM_USE_AVX2
+    if(__builtin_cpu_supports("avx2")) {
+        return kCsmSpannerAvx2;
+    }
+#endif
+#ifdef CSM_USE_SSE42
+    return kCsmSpannerSse42;
+#else
+    return kCsmSpannerFallback;
+#endif
+}
+
+
+/**
+ * Return true if the spanner was compiled in and is supported by the running
+ * CPU.
+ */
+inline bool
+spanner_supported(CsmSpannerType type)
+{
+    switch(type) {
+    case kCsmSpannerFallback:
+        return true;
+#ifdef CSM_USE_SSE42
+    case kCsmSpannerSse42:
+        return true;
+#endif
+#ifdef CSM_USE_AVX2
+    case kCsmSpannerAvx2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef CSM_USE_AVX512
+    case kCsmSpannerAvx512:
+        return __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+        return false;
+    }
+}
+
+
+/*
+ * Classifiers produce bitmasks of the quote, delimiter and newline bytes
+ * among the next 64 bytes of a buffer, for the first pass of StructuralIndex.
+ * Like the wide spanners, the vector variants must only be used from a
+ * flattened wrapper of the matching target.
+ */
+struct ClassifierFallback
+{
+    char delimiter_;
+    char quotechar_;
+
+    ClassifierFallback(char delimiter, char quotechar)
+        : delimiter_(delimiter)
+        , quotechar_(quotechar)
+    {
+    }
+
+    void
+    operator()(const char *p, uint64_t &quote, uint64_t &delimiter,
+               uint64_t &newline)
+    {
+        quote = 0;
+        delimiter = 0;
+        newline = 0;
+        for(int i = 0; i < 64; i++) {
+            char c = p[i];
+            quote |= (uint64_t) (c == quotechar_) << i;
+            delimiter |= (uint64_t) (c == delimiter_) << i;
+            newline |= (uint64_t) (c == '\r' || c == '\n') << i;
+        }
+    }
+};
+
+
+#ifdef CSM_USE_SSE42
+struct ClassifierSse2
+{
+    __m128i quote_;
+    __m128i delimiter_;
+    __m128i cr_;
+    __m128i lf_;
+
+    ClassifierSse2(char delimiter, char quotechar)
+        : quote_(_mm_set1_epi8(quotechar))
+        , delimiter_(_mm_set1_epi8(delimiter))
+        , cr_(_mm_set1_epi8('\r'))
+        , lf_(_mm_set1_epi8('\n'))
+    {
+    }
+
+    void
+    operator()(const char *p, uint64_t &quote, uint64_t &delimiter,
+               uint64_t &newline)
+    {
+        quote = 0;
+        delimiter = 0;
+        newline = 0;
+        for(int i = 0; i < 64; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+            quote |= (uint64_t) (uint16_t)
+                _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote_)) << i;
+            delimiter |= (uint64_t) (uint16_t)
+                _mm_movemask_epi8(_mm_cmpeq_epi8(v, delimiter_)) << i;
+            newline |= (uint64_t) (uint16_t)
+                _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr_),
+                                               _mm_cmpeq_epi8(v, lf_))) << i;
+        }
+    }
+};
+#endif // CSM_USE_SSE42
+
+
+#ifdef CSM_USE_AVX2
+struct ClassifierAvx2
+{
+    __m256i quote_;
+    __m256i delimiter_;
+    __m256i cr_;
+    __m256i lf_;
+
+    ClassifierAvx2(char delimiter, char quotechar)
+        CSM_ATTR_AVX2
+    {
+        quote_ = _mm256_set1_epi8(quotechar);
+        delimiter_ = _mm256_set1_epi8(delimiter);
+        cr_ = _mm256_set1_epi8('\r');
+        lf_ = _mm256_set1_epi8('\n');
+    }
+
+    void
+    operator()(const char *p, uint64_t &quote, uint64_t &delimiter,
+               uint64_t &newline)
+        CSM_ATTR_AVX2
+    {
+        __m256i lo = _mm256_loadu_si256((const __m256i *) p);
+        __m256i hi = _mm256_loadu_si256((const __m256i *) (p + 32));
+
+        #define CSM_MASK64(expr_lo, expr_hi) \
+            ((uint64_t) (uint32_t) _mm256_movemask_epi8(expr_lo) | \
+             ((uint64_t) (uint32_t) _mm256_movemask_epi8(expr_hi) << 32))
+
+        quote = CSM_MASK64(_mm256_cmpeq_epi8(lo, quote_),
+                           _mm256_cmpeq_epi8(hi, quote_));
+        delimiter = CSM_MASK64(_mm256_cmpeq_epi8(lo, delimiter_),
+                               _mm256_cmpeq_epi8(hi, delimiter_));
+        newline = CSM_MASK64(
+            _mm256_or_si256(_mm256_cmpeq_epi8(lo, cr_),
+                            _mm256_cmpeq_epi8(lo, lf_)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(hi, cr_),
+                            _mm256_cmpeq_epi8(hi, lf_)));
+
+        #undef CSM_MASK64
+    }
+};
+#endif // CSM_USE_AVX2
+
+
+#ifdef CSM_USE_AVX512
+struct ClassifierAvx512
+{
+    __m512i quote_;
+    __m512i delimiter_;
+    __m512i cr_;
+    __m512i lf_;
+
+    ClassifierAvx512(char delimiter, char quotechar)
+        CSM_ATTR_AVX512
+    {
+        quote_ = _mm512_set1_epi8(quotechar);
+        delimiter_ = _mm512_set1_epi8(delimiter);
+        cr_ = _mm512_set1_epi8('\r');
+        lf_ = _mm512_set1_epi8('\n');
+    }
+
+    void
+    operator()(const char *p, uint64_t &quote, uint64_t &delimiter,
+               uint64_t &newline)
+        CSM_ATTR_AVX512
+    {
+        __m512i v = _mm512_loadu_si512((const void *) p);
+        quote = _mm512_cmpeq_epi8_mask(v, quote_);
+        delimiter = _mm512_cmpeq_epi8_mask(v, delimiter_);
+        newline = _mm512_cmpeq_epi8_mask(v, cr_)
+                | _mm512_cmpeq_epi8_mask(v, lf_);
+    }
+};
+#endif // CSM_USE_AVX512
+
+
+/**
+ * First pass of the two-stage parser. A block of input starting at a row
+ * boundary is classified 64 bytes at a time; a prefix XOR of the quote mask
+ * gives the bytes lying within quotes, without branching per character, and
+ * the offset of every delimiter and newline outside them is appended to a flat
+ * array. Offsets of newlines are tagged with kNewline. The quote bitmap is kept
+ * so the second pass can tell whether a quoted cell contains escaped quotes.
+ *
+ * Only doubled quotes are understood, and quotes are assumed to appear only in
+ * quoted cells, as in RFC 4180.
+ */
+class StructuralIndex
+{
+    public:
+    static const uint32_t kNewline = 1u << 31;
+
+    std::vector<uint32_t> offsets;
+    std::vector<uint64_t> quotes;
+    size_t count;
+
+    StructuralIndex()
+        : count(0)
+    {
+    }
+
+    /**
+     * Return true if a quote appears in [start, end) of the indexed block.
+     */
+    bool
+    has_quote(size_t start, size_t end)
+    {
+        if(start >= end) {
+            return false;
+        }
+
+        size_t word = start >> 6;
+        size_t last = (end - 1) >> 6;
+        uint64_t mask = quotes[word] & (~0ull << (start & 63));
+        while(word < last) {
+            if(mask) {
+                return true;
+            }
+            mask = quotes[++word];
+        }
+        return mask & (~0ull >> (63 - ((end - 1) & 63)));
+    }
+
+    /**
+     * Index len bytes at p, which must be followed by the usual
+     * StreamCursor::kPadding readable bytes, so that the final block may be
+     * classified in place.
+     */
+    template<typename Classifier>
+    void
+    build_with(const char *p, size_t len, Classifier &classify)
+    {
+        offsets.resize(len + 64);
+        quotes.resize((len + 63) / 64);
+
+        uint32_t *out = &offsets[0];
+        uint64_t carry = 0;
+        for(size_t base = 0; base < len; base += 64) {
+            uint64_t quote, delimiter, newline;
+            classify(p + base, quote, delimiter, newline);
+            if(len - base < 64) {
+                uint64_t valid = ~0ull >> (64 - (len - base));
+                quote &= valid;
+                delimiter &= valid;
+                newline &= valid;
+            }
+
+            uint64_t inside = quote;
+            inside ^= inside << 1;
+            inside ^= inside << 2;
+            inside ^= inside << 4;
+            inside ^= inside << 8;
+            inside ^= inside << 16;
+            inside ^= inside << 32;
+            inside ^= carry;
+            carry = (uint64_t) ((int64_t) inside >> 63);
+
+            quotes[base / 64] = quote;
+            uint64_t structural = (delimiter | newline) & ~inside;
+            newline &= structural;
+            while(structural) {
+                uint32_t bit = __builtin_ctzll(structural);
+                *out++ = (uint32_t) (base + bit)
+                       | ((uint32_t) (newline >> bit) << 31);
+                structural &= structural - 1;
+            }
+        }
+        count = out - &offsets[0];
+    }
+
+#ifdef CSM_USE_SSE42
+    void
+    build_sse2(const char *p, size_t len, char delimiter, char quotechar)
+        __attribute__((flatten))
+    {
+        ClassifierSse2 classify(delimiter, quotechar);
+        build_with(p, len, classify);
+    }
+#endif // CSM_USE_SSE42
+
+#ifdef CSM_USE_AVX2
+    void
+    build_avx2(const char *p, size_t len, char delimiter, char quotechar)
+        __attribute__((flatten)) CSM_ATTR_AVX2
+    {
+        ClassifierAvx2 classify(delimiter, quotechar);
+        build_with(p, len, classify);
+    }
+#endif // CSM_USE_AVX2
+
+#ifdef CSM_USE_AVX512
+    void
+    build_avx512(const char *p, size_t len, char delimiter, char quotechar)
+        __attribute__((flatten)) CSM_ATTR_AVX512
+    {
+        ClassifierAvx512 classify(delimiter, quotechar);
+        build_with(p, len, classify);
+    }
+#endif // CSM_USE_AVX512
+
+    void
+    build(const char *p, size_t len, char delimiter, char quotechar,
+          CsmSpannerType type)
+    {
+        switch(type) {
+#ifdef CSM_USE_SSE42
+        case kCsmSpannerSse42:
+            return build_sse2(p, len, delimiter, quotechar);
+#endif
+#ifdef CSM_USE_AVX2
+        case kCsmSpannerAvx2:
+            return build_avx2(p, len, delimiter, quotechar);
+#endif
+#ifdef CSM_USE_AVX512
+        case kCsmSpannerAvx512:
+            return build_avx512(p, len, delimiter, quotechar);
+#endif
+        default: {
+            ClassifierFallback classify(delimiter, quotechar);
+            return build_with(p, len, classify);
+        }
+        }
+    }
+};
+
+
+class CsvCursor
+{
+    public:
+    std::vector<CsvCell> cells;
+    int count;
+
+    CsvCursor()
+        : cells(32)
+        , count(0)
+    {
+    }
+
+    /**
+     * Double the cell array once count reaches its size, returning the first
+     * free cell. Cells only point into the stream buffer, so a row can keep
+     * filling after growth without being parsed again, and since the array
+     * never shrinks, it soon fits the widest row, usually the header.
+     */
+    __attribute__((noinline))
+    CsvCell *
+    grow()
+    {
+        cells.resize(2 * cells.size());
+        return &cells[count];
+    }
+
+    bool
+    by_value(const std::string &value, CsvCell *&cell)
+    {
+        for(int i = 0; i < count; i++) {
+            if(cells[i].size == value.size()
+                    && !memcmp(cells[i].ptr, value.data(), value.size())) {
+                cell = &cells[i];
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+
+/**
+ * Column name resolver built once from a header row. Names are placed by a
+ * perfect hash: each name's hash picks a bucket, and each bucket stores a
+ * seed found at construction that sends its names to distinct free slots, so
+ * a lookup costs one hash, one table read and one comparison. Duplicate
+ * names resolve to their first column, like CsvCursor::by_value(). Should
+ * distinct names share a hash, or no table be found, lookups instead scan
+ * the names.
+ */
+class HeaderIndex
+{
+    std::vector<std::string> names_;
+    std::vector<uint32_t> seeds_;
+    std::vector<int> slots_;
+    bool linear_;
+
+    size_t
+    slot(uint64_t h) const
+    {
+        uint64_t x = h ^ (seeds_[h & (seeds_.size() - 1)]
+                          * 0x9e3779b97f4a7c15ULL);
+        x = (x ^ (x >> 31)) * 0xbf58476d1ce4e5b9ULL;
+        return (x ^ (x >> 29)) & (slots_.size() - 1);
+    }
+
+    /**
+     * Try to place every distinct name in a table of the current size,
+     * returning false if some bucket found no seed.
+     */
+    bool
+    place(const std::vector<int> &columns, const std::vector<uint64_t> &hashes)
+    {
+        static const uint32_t kMaxSeed = 1 << 16;
+
+        size_t nbuckets = seeds_.size();
+        std::vector<std::vector<int>> buckets(nbuckets);
+        for(int col : columns) {
+            buckets[hashes[col] & (nbuckets - 1)].push_back(col);
+        }
+
+        // Place crowded buckets first, while most slots are free.
+        std::vector<size_t> order(nbuckets);
+        for(size_t b = 0; b < nbuckets; b++) {
+            order[b] = b;
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        std::fill(slots_.begin(), slots_.end(), -1);
+        std::vector<size_t> taken;
+        for(size_t b : order) {
+            uint32_t seed = 0;
+            for(; seed < kMaxSeed; seed++) {
+                seeds_[b] = seed;
+                taken.clear();
+                for(int col : buckets[b]) {
+                    size_t i = slot(hashes[col]);
+                    if(slots_[i] != -1) {
+                        break;
+                    }
+                    slots_[i] = col;
+                    taken.push_back(i);
+                }
+                if(taken.size() == buckets[b].size()) {
+                    break;
+                }
+                for(size_t i : taken) {
+                    slots_[i] = -1;
+                }
+            }
+            if(seed == kMaxSeed) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void
+    build()
+    {
+        std::vector<uint64_t> hashes;
+        std::vector<int> columns;
+        for(size_t col = 0; col < names_.size(); col++) {
+            const std::string &name = names_[col];
+            hashes.push_back(hash_bytes(name.data(), name.size(), 0));
+            columns.push_back((int) col);
+        }
+
+        // Keep only the first column of each distinct name.
+        std::stable_sort(columns.begin(), columns.end(), [&](int a, int b) {
+            return names_[a] < names_[b];
+        });
+        columns.erase(std::unique(columns.begin(), columns.end(),
+            [&](int a, int b) {
+                return names_[a] == names_[b];
+            }), columns.end());
+
+        // Names with equal hashes always share a slot, whatever the seed.
+        std::vector<uint64_t> distinct;
+        for(int col : columns) {
+            distinct.push_back(hashes[col]);
+        }
+        std::sort(distinct.begin(), distinct.end());
+        if(std::adjacent_find(distinct.begin(), distinct.end())
+                != distinct.end()) {
+            linear_ = true;
+            return;
+        }
+
+        size_t nbuckets = 1;
+        while(4 * nbuckets < columns.size()) {
+            nbuckets *= 2;
+        }
+        size_t nslots = 1;
+        while(nslots < 2 * columns.size()) {
+            nslots *= 2;
+        }
+
+        // Each doubling makes placement far likelier, so a few suffice.
+        for(int tries = 0; tries < 8; tries++) {
+            seeds_.assign(nbuckets, 0);
+            slots_.assign(nslots, -1);
+            nslots *= 2;
+            if(place(columns, hashes)) {
+                return;
+            }
+        }
+        linear_ = true;
+    }
+
+    public:
+    HeaderIndex()
+        : seeds_(1)
+        , slots_(1, -1)
+        , linear_(false)
+    {
+    }
+
+    /**
+     * Index the cells of row, eg. the first row of a file, unescaping them
+     * using escapechar and quotechar.
+     */
+    explicit HeaderIndex(CsvCursor &row, char escapechar=0, char quotechar='"')
+        : linear_(false)
+    {
+        for(int i = 0; i < row.count; i++) {
+            names_.push_back(row.cells[i].as_str(escapechar, quotechar));
+        }
+        build();
+    }
+
+    explicit HeaderIndex(const std::vector<std::string> &names)
+        : names_(names)
+        , linear_(false)
+    {
+        build();
+    }
+
+    /**
+     * Return the first column named by size bytes at name, or -1.
+     */
+    int
+    find(const char *name, size_t size) const
+    {
+        if(names_.empty()) {
+            return -1;
+        } else if(linear_) {
+            for(size_t col = 0; col < names_.size(); col++) {
+                if(names_[col].size() == size
+                        && !memcmp(names_[col].data(), name, size)) {
+                    return (int) col;
+                }
+            }
+            return -1;
+        }
+        int col = slots_[slot(hash_bytes(name, size, 0))];
+        if(col != -1 && names_[col].size() == size
+                && !memcmp(names_[col].data(), name, size)) {
+            return col;
+        }
+        return -1;
+    }
+
+    int
+    find(const std::string &name) const
+    {
+        return find(name.data(), name.size());
+    }
+
+    /**
+     * Resolve names once to column indices, eg. for use with
+     * CsvReader::set_projection() or to index row().cells directly. Throws
+     * Error naming the first unknown column.
+     */
+    std::vector<int>
+    resolve(const std::vector<std::string> &names) const
+    {
+        std::vector<int> out;
+        for(const std::string &name : names) {
+            int col = find(name);
+            if(col == -1) {
+                throw Error("HeaderIndex", "no such column: " + name);
+            }
+            out.push_back(col);
+        }
+        return out;
+    }
+
+    size_t
+    size() const
+    {
+        return names_.size();
+    }
+
+    const std::string &
+    name(size_t col) const
+    {
+        return names_[col];
+    }
+};
+
+
+/**
+ * Struct-of-arrays buffer filled by CsvReader::read_batch(). For every row,
+ * each column holds its cell's offset from base and size, with escaped cells
+ * flagged in a bitmap, so a single column can be processed in a tight loop.
+ * Rows shorter than the widest row in the batch have empty trailing cells;
+ * counts records how many cells each row actually had. Cells point into the
+ * stream buffer, and are only valid until the next read from the reader.
+ */
+class CsvBatch
+{
+    public:
+    struct Column
+    {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> sizes;
+        std::vector<uint64_t> escaped;
+    };
+
+    const char *base;
+    size_t rows;
+    std::vector<int> counts;
+    std::vector<Column> columns;
+    // Raw bytes of each row, as returned by CsvReader::row_data().
+    std::vector<uint32_t> row_offsets;
+    std::vector<uint32_t> row_sizes;
+
+    private:
+    size_t capacity_;
+
+    void
+    init_column(Column &column)
+    {
+        column.offsets.assign(capacity_, 0);
+        column.sizes.assign(capacity_, 0);
+        column.escaped.assign((capacity_ + 63) / 64, 0);
+    }
+
+    public:
+    CsvBatch()
+        : base(0)
+        , rows(0)
+        , capacity_(0)
+    {
+    }
+
+    size_t
+    capacity()
+    {
+        return capacity_;
+    }
+
+    /**
+     * Empty the batch, keeping column storage, and ensure room for capacity
+     * rows.
+     */
+    void
+    clear(size_t capacity)
+    {
+        if(capacity != capacity_) {
+            capacity_ = capacity;
+            counts.resize(capacity);
+            row_offsets.resize(capacity);
+            row_sizes.resize(capacity);
+            for(auto &column : columns) {
+                init_column(column);
+            }
+        } else {
+            for(auto &column : columns) {
+                std::fill(column.escaped.begin(), column.escaped.end(), 0);
+            }
+        }
+        base = 0;
+        rows = 0;
+    }
+
+    /**
+     * Append a row spanning [data, data+size), whose cells must not precede
+     * base or lie 4GiB beyond it.
+     */
+    void
+    append(const CsvCursor &row, const char *data, size_t size)
+    {
+        size_t i = rows++;
+        counts[i] = row.count;
+        row_offsets[i] = (uint32_t) (data - base);
+        row_sizes[i] = (uint32_t) size;
+        while(columns.size() < (size_t) row.count) {
+            columns.emplace_back();
+            init_column(columns.back());
+        }
+
+        const CsvCell *cell = row.cells.data();
+        for(int col = 0; col < row.count; col++, cell++) {
+            Column &column = columns[col];
+            column.offsets[i] = cell->ptr ? (uint32_t) (cell->ptr - base) : 0;
+            column.sizes[i] = (uint32_t) cell->size;
+            column.escaped[i / 64] |= (uint64_t) cell->escaped << (i % 64);
+        }
+        for(size_t col = row.count; col < columns.size(); col++) {
+            columns[col].offsets[i] = 0;
+            columns[col].sizes[i] = 0;
+        }
+    }
+
+    /**
+     * Append the rows of other, whose bytes from other.base on have been
+     * copied shift bytes past base.
+     */
+    void
+    append_batch(const CsvBatch &other, size_t shift)
+    {
+        while(columns.size() < other.columns.size()) {
+            columns.emplace_back();
+            init_column(columns.back());
+        }
+        for(size_t r = 0; r < other.rows; r++) {
+            size_t i = rows++;
+            counts[i] = other.counts[r];
+            row_offsets[i] = (uint32_t) (other.row_offsets[r] + shift);
+            row_sizes[i] = other.row_sizes[r];
+            for(size_t col = 0; col < columns.size(); col++) {
+                Column &column = columns[col];
+                if(col >= other.columns.size() || (int) col >= counts[i]) {
+                    column.offsets[i] = 0;
+                    column.sizes[i] = 0;
+                    continue;
+                }
+                const Column &from = other.columns[col];
+                column.offsets[i] = (uint32_t) (from.offsets[r] + shift);
+                column.sizes[i] = from.sizes[r];
+                column.escaped[i / 64] |=
+                    ((from.escaped[r / 64] >> (r % 64)) & 1) << (i % 64);
+            }
+        }
+    }
+
+    CsvCell
+    cell(size_t row, size_t col) const
+    {
+        const Column &column = columns[col];
+        return CsvCell {
+            base + column.offsets[row],
+            column.sizes[row],
+            (bool) ((column.escaped[row / 64] >> (row % 64)) & 1)
+        };
+    }
+
+    const char *
+    row_data(size_t row, size_t &size) const
+    {
+        size = row_sizes[row];
+        return base + row_offsets[row];
+    }
+
+    /**
+     * Copy the cells of one row into out, growing its cells as needed.
+     */
+    void
+    row(size_t row, CsvCursor &out) const
+    {
+        int count = counts[row];
+        if(out.cells.size() < (size_t) count) {
+            out.cells.resize(count);
+        }
+        for(int col = 0; col < count; col++) {
+            out.cells[col] = cell(row, col);
+        }
+        out.count = count;
+    }
+
+    /**
+     * Convert column col of every row to out[0..rows). Rows lacking the
+     * column convert as 0.
+     */
+    void
+    as_double(size_t col, double *out) const
+    {
+        const Column &column = columns[col];
+        for(size_t i = 0; i < rows; i++) {
+            out[i] = parse_double(base + column.offsets[i], column.sizes[i]);
+        }
+    }
+
+    void
+    as_int64(size_t col, int64_t *out) const
+    {
+        const Column &column = columns[col];
+        for(size_t i = 0; i < rows; i++) {
+            out[i] = parse_int64(base + column.offsets[i], column.sizes[i]);
+        }
+    }
+
+    void
+    as_uint64(size_t col, uint64_t *out) const
+    {
+        const Column &column = columns[col];
+        for(size_t i = 0; i < rows; i++) {
+            out[i] = parse_uint64(base + column.offsets[i], column.sizes[i]);
+        }
+    }
+
+    void
+    as_decimal(size_t col, int scale, int64_t *out) const
+    {
+        const Column &column = columns[col];
+        for(size_t i = 0; i < rows; i++) {
+            out[i] = parse_decimal(base + column.offsets[i], column.sizes[i],
+                                   scale);
+        }
+    }
+};
+
+
+/**
+ * Types a column may be inferred as by TypeInference.
+ */
+enum CsmValueType {
+    kCsmValueString,
+    kCsmValueInt,       // parse_exact_int64()
+    kCsmValueFloat,     // parse_exact_double()
+    kCsmValueBool,      // parse_bool()
+    kCsmValueDate       // parse_date()
+};
+
+
+/**
+ * Infer a type for each column from a sample of rows: int if every nonempty
+ * cell of the column is an integer, else float if every one is a number, else
+ * bool or date if every one is that, and otherwise string. Escaped cells are
+ * always strings, and columns with no nonempty cell are strings. Cells are
+ * matched only against the types still possible for their column, so once a
+ * column is known to be a string its cells are no longer examined.
+ */
+class TypeInference
+{
+    enum {
+        kInt = 1 << kCsmValueInt,
+        kFloat = 1 << kCsmValueFloat,
+        kBool = 1 << kCsmValueBool,
+        kDate = 1 << kCsmValueDate,
+        kAll = kInt | kFloat | kBool | kDate
+    };
+
+    // Per column, the types every nonempty cell so far has matched.
+    std::vector<unsigned> masks_;
+    std::vector<bool> seen_;
+
+    static unsigned
+    classify(const CsvCell &cell, unsigned mask)
+    {
+        int64_t i;
+        double d;
+        bool b;
+        int year, month, day;
+        if(cell.escaped) {
+            return 0;
+        } else if((mask & kInt) && parse_exact_int64(cell.ptr, cell.size, i)) {
+            return kInt | kFloat;
+        } else if((mask & kFloat)
+                  && parse_exact_double(cell.ptr, cell.size, d)) {
+            return kFloat;
+        } else if((mask & kBool) && parse_bool(cell.ptr, cell.size, b)) {
+            return kBool;
+        } else if((mask & kDate)
+                  && parse_date(cell.ptr, cell.size, year, month, day)) {
+            return kDate;
+        }
+        return 0;
+    }
+
+    void
+    reserve(size_t columns)
+    {
+        if(masks_.size() < columns) {
+            masks_.resize(columns, kAll);
+            seen_.resize(columns, false);
+        }
+    }
+
+    void
+    add(size_t col, const CsvCell &cell)
+    {
+        if(cell.size && masks_[col]) {
+            masks_[col] &= classify(cell, masks_[col]);
+            seen_[col] = true;
+        }
+    }
+
+    public:
+    void
+    add_row(const CsvCursor &row)
+    {
+        reserve(row.count);
+        for(int col = 0; col < row.count; col++) {
+            add(col, row.cells[col]);
+        }
+    }
+
+    void
+    add_batch(const CsvBatch &batch)
+    {
+        reserve(batch.columns.size());
+        for(size_t col = 0; col < batch.columns.size(); col++) {
+            for(size_t i = 0; i < batch.rows && masks_[col]; i++) {
+                add(col, batch.cell(i, col));
+            }
+        }
+    }
+
+    /**
+     * Return the number of columns seen.
+     */
+    size_t
+    size() const
+    {
+        return masks_.size();
+    }
+
+    CsmValueType
+    type(size_t col) const
+    {
+        if(col >= masks_.size() || !seen_[col]) {
+            return kCsmValueString;
+        }
+        unsigned mask = masks_[col];
+        if(mask & kInt) {
+            return kCsmValueInt;
+        } else if(mask & kFloat) {
+            return kCsmValueFloat;
+        } else if(mask & kBool) {
+            return kCsmValueBool;
+        } else if(mask & kDate) {
+            return kCsmValueDate;
+        }
+        return kCsmValueString;
+    }
+};
+
+
+/**
+ * Sparse index of the byte offset at which every stride'th row begins,
+ * recorded by a CsvReader given set_row_index() while it reads from the start
+ * of input. Indexed offsets are always row starts, where parsing is outside
+ * any quoted cell, so no further parser state need be stored to resume there.
+ * The index may be saved as a sidecar file next to the CSV it describes; the
+ * format is native-endian and records the size of the indexed input, so a
+ * stale index can be detected with covers().
+ */
+class RowIndex
+{
+    static const uint64_t kMagic = 0x31305844494d5343ULL; // "CSMIDX01"
+
+    uint64_t stride_;
+    uint64_t rows_;
+    uint64_t end_;
+    std::vector<uint64_t> offsets_;
+
+    public:
+    RowIndex(size_t stride=65536)
+        : stride_(std::max(stride, (size_t) 1))
+        , rows_(0)
+        , end_(0)
+    {
+    }
+
+    size_t stride() const
+    {
+        return stride_;
+    }
+
+    /**
+     * Number of rows seen while building the index.
+     */
+    size_t rows() const
+    {
+        return rows_;
+    }
+
+    /**
+     * Offset just past the last row seen while building the index.
+     */
+    uint64_t end() const
+    {
+        return end_;
+    }
+
+    const std::vector<uint64_t> &
+    offsets() const
+    {
+        return offsets_;
+    }
+
+    void clear()
+    {
+        rows_ = 0;
+        end_ = 0;
+        offsets_.clear();
+    }
+
+    /**
+     * Record that row starts at offset and ends before end. Rows must be
+     * added in order; rows already covered by the index are ignored.
+     */
+    void add(size_t row, uint64_t offset, uint64_t end)
+    {
+        if(row < rows_) {
+            return;
+        }
+        if(! (row % stride_)) {
+            offsets_.push_back(offset);
+        }
+        rows_ = row + 1;
+        end_ = end;
+    }
+
+    /**
+     * Return true if the index was built over exactly size bytes of input,
+     * allowing for the final row's line terminator.
+     */
+    bool covers(uint64_t size) const
+    {
+        return end_ <= size && (size - end_) <= 2;
+    }
+
+    /**
+     * Find the nearest indexed row at or before row, setting offset to its
+     * start. Returns the indexed row number, or -1 if row is not covered.
+     */
+    ssize_t find_row(size_t row, uint64_t &offset) const
+    {
+        if(row >= rows_ || offsets_.empty()) {
+            return -1;
+        }
+        size_t i = row / stride_;
+        offset = offsets_[i];
+        return i * stride_;
+    }
+
+    /**
+     * Find the first indexed row starting at or after offset, setting
+     * row_offset to its start. Returns its row number, or -1 if none.
+     */
+    ssize_t find_offset(uint64_t offset, uint64_t &row_offset) const
+    {
+        std::vector<uint64_t>::const_iterator it =
+            std::lower_bound(offsets_.begin(), offsets_.end(), offset);
+        if(it == offsets_.end()) {
+            return -1;
+        }
+        row_offset = *it;
+        return (it - offsets_.begin()) * stride_;
+    }
+
+    void save(const char *path) const
+    {
+        std::ofstream fp(path, std::ios::binary | std::ios::trunc);
+        uint64_t header[5] = {
+            kMagic, stride_, rows_, end_, offsets_.size()
+        };
+        fp.write((const char *) header, sizeof header);
+        fp.write((const char *) offsets_.data(),
+                 offsets_.size() * sizeof offsets_[0]);
+        fp.close();
+        if(! fp) {
+            throw Error(path, "could not write row index");
+        }
+    }
+
+    void load(const char *path)
+    {
+        std::ifstream fp(path, std::ios::binary);
+        uint64_t header[5];
+        if(! fp.read((char *) header, sizeof header)) {
+            throw Error(path, "could not read row index");
+        } else if(header[0] != kMagic || !header[1]
+                  || header[4] != (header[2] + header[1] - 1) / header[1]) {
+            throw Error(path, "not a row index");
+        }
+
+        std::vector<uint64_t> offsets(header[4]);
+        if(! fp.read((char *) offsets.data(),
+                     offsets.size() * sizeof offsets[0])) {
+            throw Error(path, "row index is truncated");
+        }
+        stride_ = header[1];
+        rows_ = header[2];
+        end_ = header[3];
+        offsets_.swap(offsets);
+    }
+};
+
+
+/**
+ * Counters returned by CsvReader::stats(). bytes and rows, which include
+ * rows rejected by filters, and invalid_rows are always maintained; the rest
+ * only when CSM_STATS is defined. cells counts cells stored in rows,
+ * underruns the times a row was cut short by the end of the buffer and
+ * parsing had to wait for fill(), and cell_grows the times the cell array
+ * was enlarged mid-row.
+ */
+struct CsvStats
+{
+    uint64_t bytes;
+    uint64_t rows;
+    uint64_t rejected_rows;
+    uint64_t invalid_rows;
+    uint64_t cells;
+    uint64_t quoted_cells;
+    uint64_t escaped_cells;
+    uint64_t cell_grows;
+    uint64_t underruns;
+    CursorStats cursor;
+};
+
+
+/**
+ * Dialects a CsvReader can specialize its parser for at compile time, so that
+ * the delimiter and quote comparisons use constants, spanners are built from
+ * constants, and with quoting disabled the quoted cell states are dropped
+ * entirely. Any other configuration uses the reader's runtime members, and
+ * kCsmDialectMultiByte those of a delimiter longer than one byte.
+ */
+enum CsmDialectType {
+    kCsmDialectRuntime,
+    kCsmDialectCsv,
+    kCsmDialectTsvUnquoted,
+    kCsmDialectMultiByte
+};
+
+
+/**
+ * Compile-time dialect. Quotechar 0 disables quoting, so that every cell is
+ * read as unquoted, and Escapechar 0 disables escapes.
+ */
+template<char Delimiter, char Quotechar='"', char Escapechar=0>
+struct CsvDialect
+{
+    static const bool kRuntime = false;
+    static const bool kMultiByte = false;
+    static const char kDelimiter = Delimiter;
+    static const char kQuotechar = Quotechar;
+    static const char kEscapechar = Escapechar;
+};
+
+
+/**
+ * Stands in for a dialect known only at runtime.
+ */
+struct CsvRuntimeDialect
+{
+    static const bool kRuntime = true;
+    static const bool kMultiByte = false;
+    static const char kDelimiter = 0;
+    static const char kQuotechar = 0;
+    static const char kEscapechar = 0;
+};
+
+
+/**
+ * Stands in for a runtime dialect whose delimiter is several bytes, such as
+ * "||" or a UTF-8 encoded character. Spanners stop at its first byte, and
+ * the rest is compared only there.
+ */
+struct CsvMultiByteDialect
+    : public CsvRuntimeDialect
+{
+    static const bool kMultiByte = true;
+};
+
+
+/**
+ * Row filters evaluated by CsvReader while parsing; see add_filter_equals().
+ */
+enum CsmFilterType {
+    kCsmFilterEquals,
+    kCsmFilterPrefix,
+    kCsmFilterRange
+};
+
+
+/**
+ * How CsvReader treats malformed rows; see set_validation().
+ */
+enum CsmValidateType {
+    kCsmValidateNone,
+    kCsmValidateStrict,
+    kCsmValidateLenient
+};
+
+
+/**
+ * Problems found by validation: a row with the wrong number of columns, or a
+ * quote that is never closed or is closed by something other than a
+ * delimiter, a line break or another quote.
+ */
+enum CsmRowErrorType {
+    kCsmRowErrorNone,
+    kCsmRowErrorColumns,
+    kCsmRowErrorQuote
+};
+
+
+/**
+ * A malformed row found by validation. row is numbered like
+ * CsvReader::row_number() and offset is where it begins in the input.
+ * columns is the number found, or -1 if projection skipped the end of a row
+ * having more than expected.
+ */
+struct CsvRowError
+{
+    CsmRowErrorType type;
+    size_t row;
+    uint64_t offset;
+    int columns;
+    int expected;
+
+    std::string
+    message() const
+    {
+        char buf[128];
+        int n = snprintf(buf, sizeof buf, "row %zu at offset %llu: ", row,
+                         (unsigned long long) offset);
+        if(type == kCsmRowErrorQuote) {
+            snprintf(buf + n, sizeof buf - n, "unbalanced quote");
+        } else if(columns < 0) {
+            snprintf(buf + n, sizeof buf - n, "more than %d columns",
+                     expected);
+        } else {
+            snprintf(buf + n, sizeof buf - n, "%d columns, expected %d",
+                     columns, expected);
+        }
+        return buf;
+    }
+};
+
+
+class CsvReader
+{
+    const char *endp_;
+    const char *p_;
+    char delimiter_;
+    // Bytes of a multi-byte delimiter after its first, delimiter_.
+    std::string delimiter_tail_;
+    char quotechar_;
+    char escapechar_;
+    bool yield_incomplete_row_;
+
+    public:
+    bool in_newline_skip;
+
+    private:
+    StreamCursor &stream_;
+    StringSpanner quoted_cell_spanner_;
+    StringSpanner unquoted_cell_spanner_;
+    StringSpanner skip_spanner_;
+    CsmSpannerType spanner_type_;
+    CsmDialectType dialect_type_;
+    // Set by use_runtime_dialect(), and kept across set_delimiter().
+    bool force_runtime_;
+    CsvCursor row_;
+
+    // Column projection: flag per column up to the last wanted one.
+    std::vector<char> projection_;
+    int projection_last_;
+
+    // Row filters, with a flag per column up to the last filtered one.
+    struct Filter
+    {
+        int column;
+        CsmFilterType type;
+        std::string value;
+        double min;
+        double max;
+    };
+    std::vector<Filter> filters_;
+    std::vector<char> filter_columns_;
+    int filter_last_;
+
+    // Two-stage engine state: the block indexed, and the next offset to use.
+    bool use_index_;
+    StructuralIndex index_;
+    size_t index_block_;
+    const char *index_base_;
+    size_t index_len_;
+    size_t index_pos_;
+
+    // Raw extent of the most recently read row in the stream buffer.
+    const char *row_start_;
+    const char *row_end_;
+
+    // Bytes consumed from the stream, where the last row began, rows read,
+    // and the index to record rows to.
+    uint64_t offset_;
+    uint64_t row_offset_;
+    size_t row_number_;
+    RowIndex *row_index_;
+
+    // Validation mode, the number of columns rows must have or 0, and the
+    // problem found by the last parse returning kCsmTryParseInvalid.
+    CsmValidateType validate_;
+    int columns_;
+    CsmRowErrorType invalid_;
+    int invalid_columns_;
+    bool failed_;
+    size_t max_errors_;
+    std::vector<CsvRowError> errors_;
+
+    CsvStats stats_;
+
+    // Unescaped cells of the row numbered arena_row_, and of filtered cells.
+    UnescapeArena arena_;
+    size_t arena_row_;
+    UnescapeArena filter_arena_;
+
+    enum CsmTryParseReturnType {
+        kCsmTryParseOkay,
+        kCsmTryParseUnderrun,
+        kCsmTryParseRejected,
+        kCsmTryParseInvalid
+    };
+
+    // State machine label to continue from after an underrun.
+    enum CsmResumeState {
+        kCsmResumeNone,
+        kCsmResumeNewlineSkip,
+        kCsmResumeCellStart,
+        kCsmResumeQuotedCell,
+        kCsmResumeQuotedCellEnd,
+        kCsmResumeUnquotedCell,
+        kCsmResumeSkipCellStart,
+        kCsmResumeSkipUnquotedCell,
+        kCsmResumeSkipQuotedCell,
+        kCsmResumeSkipQuotedCellEnd
+    };
+
+    // Parse position saved on underrun, as offsets from the start of the row,
+    // so that after fill() moves the row, parsing continues where it stopped
+    // rather than rescanning the row from its start.
+    struct {
+        CsmResumeState state;
+        const char *base;
+        size_t offset;
+        size_t cell_start;
+        int col;
+        bool rejected;
+    } resume_;
+
+    /**
+     * Record where an underrun occurred. States entered just past a special
+     * character resume at the preceding scan when that character lay in the
+     * padding beyond endp_, and scans resume no later than endp_.
+     */
+    void
+    save_resume(CsmResumeState state, const char *p, const char *cell_start,
+                int col, bool rejected)
+    {
+        if(p > endp_) {
+            if(state == kCsmResumeQuotedCellEnd) {
+                state = kCsmResumeQuotedCell;
+            } else if(state == kCsmResumeSkipQuotedCellEnd) {
+                state = kCsmResumeSkipQuotedCell;
+            }
+            p = endp_;
+        }
+        CSM_STAT(stats_.underruns++)
+        resume_.state = state;
+        resume_.base = p_;
+        resume_.offset = p - p_;
+        resume_.cell_start = cell_start - p_;
+        resume_.col = col;
+        resume_.rejected = rejected;
+    }
+
+    CsmTryParseReturnType
+    invalid(CsmRowErrorType type, int columns)
+    {
+        invalid_ = type;
+        invalid_columns_ = columns;
+        return kCsmTryParseInvalid;
+    }
+
+    /**
+     * Return true if the cell in column col satisfies every filter on it.
+     */
+    bool
+    filter_cell(int col, const char *ptr, size_t size, bool escaped)
+    {
+        if(escaped) {
+            filter_arena_.reset();
+            CsvCell cell = filter_arena_.decode(CsvCell { ptr, size, true },
+                                                escapechar_, quotechar_);
+            ptr = cell.ptr;
+            size = cell.size;
+        }
+
+        for(const Filter &filter : filters_) {
+            if(filter.column != col) {
+                continue;
+            }
+            const std::string &value = filter.value;
+            switch(filter.type) {
+            case kCsmFilterEquals:
+                if(size != value.size() || memcmp(ptr, value.data(), size)) {
+                    return false;
+                }
+                break;
+            case kCsmFilterPrefix:
+                if(size < value.size() || memcmp(ptr, value.data(),
+                                                  value.size())) {
+                    return false;
+                }
+                break;
+            case kCsmFilterRange: {
+                double d = size ? parse_double(ptr, size) : NAN;
+                if(! (d >= filter.min && d <= filter.max)) {
+                    return false;
+                }
+                break;
+            }
+            }
+        }
+        return true;
+    }
+
+    template<typename Dialect>
+    char
+    dialect_delimiter() const
+    {
+        return Dialect::kRuntime ? delimiter_ : (char) Dialect::kDelimiter;
+    }
+
+    template<typename Dialect>
+    char
+    dialect_quotechar() const
+    {
+        return Dialect::kRuntime ? quotechar_ : (char) Dialect::kQuotechar;
+    }
+
+    template<typename Dialect>
+    char
+    dialect_escapechar() const
+    {
+        return Dialect::kRuntime ? escapechar_ : (char) Dialect::kEscapechar;
+    }
+
+    /*
+     * With Project set, only cells whose column is flagged in projection_ are
+     * stored, and once the last such column has been read, the remainder of
+     * the row is skipped without tracking cell boundaries. Dialect supplies
+     * the delimiter and quote character as constants, unless it is
+     * CsvRuntimeDialect or CsvMultiByteDialect.
+     */
+    template<bool Project, typename Dialect, typename Spanner>
+    CsmTryParseReturnType
+    try_parse_with(Spanner &quoted_cell_spanner_,
+                   Spanner &unquoted_cell_spanner_,
+                   Spanner &skip_spanner_)
+    {
+        const char delimiter = dialect_delimiter<Dialect>();
+        const char quotechar = dialect_quotechar<Dialect>();
+        const bool quoting = Dialect::kRuntime || Dialect::kQuotechar;
+        const char *delimiter_tail = delimiter_tail_.data();
+        const size_t delimiter_size = Dialect::kMultiByte
+            ? delimiter_tail_.size() + 1
+            : 1;
+        const char *p = p_;
+        const char *cell_start = p;
+        int rc;
+        int col = 0;
+        const int filter_last = filter_last_;
+        const int skip_after = Project
+            ? std::max(std::max(projection_last_, filter_last), columns_ - 1)
+            : -1;
+        bool rejected = false;
+
+        CsvCell *cell = &row_.cells[0];
+
+        #define PREAMBLE(state) \
+            if(p >= endp_) {\
+                CSM_DEBUG("pos exceeds size"); \
+                save_resume(state, p, cell_start, col, rejected); \
+                return kCsmTryParseUnderrun; \
+            } \
+            CSM_DEBUG("p = %#p; remain = %ld; next char is: %d", p, endp_-p, (int)*p) \
+            CSM_DEBUG("%d: distance to next newline: %d", __LINE__, strchr(p, '\n') - p);
+
+        #define NEXT_CELL() \
+            ++cell; \
+            if(row_.count == (int) row_.cells.size()) { \
+                CSM_DEBUG("cell array overflow"); \
+                CSM_STAT(stats_.cell_grows++) \
+                cell = row_.grow(); \
+            }
+
+        #define WANTED() \
+            (!Project || projection_[col])
+
+        #define NEXT_COLUMN() \
+            if((col++ == skip_after) && Project) { \
+                p += delimiter_size; \
+                goto skip_cell_start; \
+            }
+
+        /*
+         * Having found the first byte of a multi-byte delimiter at p, do
+         * mismatch unless the rest follows, waiting for it to be read.
+         */
+        #define DELIMITER(state, mismatch) \
+            if(Dialect::kMultiByte) { \
+                if(p + delimiter_size > endp_) { \
+                    save_resume(state, p, cell_start, col, rejected); \
+                    return kCsmTryParseUnderrun; \
+                } \
+                if(memcmp(p + 1, delimiter_tail, delimiter_size - 1)) { \
+                    mismatch; \
+                } \
+            }
+
+        #define AFTER_DELIMITER() \
+            (Dialect::kMultiByte \
+                ? (p - delimiter_size >= p_ \
+                   && p[-(int) delimiter_size] == delimiter \
+                   && !memcmp(p - delimiter_size + 1, delimiter_tail, \
+                              delimiter_size - 1)) \
+                : p[-1] == delimiter)
+
+        #define FILTER(size, reject) \
+            if(col <= filter_last && filter_columns_[col] \
+                    && !filter_cell(col, cell_start, size, cell->escaped)) { \
+                rejected = true; \
+                reject; \
+            }
+
+        #define END_ROW(columns) \
+            p_ = p + 1; \
+            if(rejected || col < filter_last) { \
+                return kCsmTryParseRejected; \
+            } \
+            if(columns_ && col + 1 != columns_) { \
+                return invalid(kCsmRowErrorColumns, columns); \
+            } \
+            return kCsmTryParseOkay;
+
+        CSM_DEBUG("remain = %lu", endp_ - p);
+        CSM_DEBUG("ch = %d %c", (int) *p, *p);
+
+        if(resume_.state != kCsmResumeNone) {
+            CsmResumeState state = resume_.state;
+            resume_.state = kCsmResumeNone;
+            for(int i = 0; i < row_.count; i++) {
+                if(row_.cells[i].ptr) {
+                    row_.cells[i].ptr = p_ + (row_.cells[i].ptr - resume_.base);
+                }
+            }
+            cell = &row_.cells[row_.count];
+            p = p_ + resume_.offset;
+            cell_start = p_ + resume_.cell_start;
+            col = resume_.col;
+            rejected = resume_.rejected;
+
+            switch(state) {
+            case kCsmResumeCellStart:
+                goto cell_start;
+            case kCsmResumeQuotedCell:
+                goto in_quoted_cell;
+            case kCsmResumeQuotedCellEnd:
+                goto in_escape_or_end_of_quoted_cell;
+            case kCsmResumeUnquotedCell:
+                goto in_unquoted_cell;
+            case kCsmResumeSkipCellStart:
+                goto skip_cell_start;
+            case kCsmResumeSkipUnquotedCell:
+                goto skip_unquoted_cell;
+            case kCsmResumeSkipQuotedCell:
+                goto skip_quoted_cell;
+            case kCsmResumeSkipQuotedCellEnd:
+                goto skip_quoted_cell_end;
+            default:
+                goto newline_skip;
+            }
+        }
+        row_.count = 0;
+
+    newline_skip:
+        /*
+         * Skip newlines appearing at the start of the line, which may be a
+         * result of DOS/MAC-formatted input. Or a double-spaced CSV file.
+         */
+        in_newline_skip = true;
+        PREAMBLE(kCsmResumeNewlineSkip)
+        if(*p == '\r' || *p == '\n') {
+            ++p;
+            goto newline_skip;
+        }
+
+    cell_start:
+        in_newline_skip = false;
+        PREAMBLE(kCsmResumeCellStart)
+        cell->escaped = false;
+        if(*p == '\r' || *p == '\n') {
+            /*
+             * A newline appearing after at least one cell has been read
+             * indicates the presence of a single comma demarcating an unquoted
+             * unquoted unquoted unquoted empty final field.
+             */
+            cell_start = p;
+            FILTER(0, END_ROW(col + 1))
+            if(WANTED()) {
+                cell->ptr = 0;
+                cell->size = 0;
+                ++row_.count;
+            }
+            END_ROW(col + 1)
+        } else if(quoting && *p == quotechar) {
+            CSM_STAT(stats_.quoted_cells++)
+            cell_start = ++p;
+            goto in_quoted_cell;
+        } else {
+            cell_start = p;
+            goto in_unquoted_cell;
+        }
+
+    in_quoted_cell:
+        PREAMBLE(kCsmResumeQuotedCell)
+        rc = quoted_cell_spanner_(p);
+        switch(rc) {
+            case Spanner::kWidth:
+                p += Spanner::kWidth;
+                goto in_quoted_cell;
+            default:
+                p += rc + 1;
+                goto in_escape_or_end_of_quoted_cell;
+            }
+
+    in_escape_or_end_of_quoted_cell:
+        PREAMBLE(kCsmResumeQuotedCellEnd)
+        if(*p == delimiter) {
+            DELIMITER(kCsmResumeQuotedCellEnd, goto in_quoted_cell_escape)
+            FILTER(p - cell_start - 1, p += delimiter_size;
+                   goto skip_cell_start)
+            if(WANTED()) {
+                cell->ptr = cell_start;
+                cell->size = p - cell_start - 1;
+                ++row_.count;
+                NEXT_CELL();
+            }
+            NEXT_COLUMN();
+            p += delimiter_size;
+            goto cell_start;
+        } else if(*p == '\r' || *p == '\n') {
+            FILTER(p - cell_start - 1, END_ROW(col + 1))
+            if(WANTED()) {
+                cell->ptr = cell_start;
+                cell->size = p - cell_start - 1;
+                ++row_.count;
+            }
+            END_ROW(col + 1)
+        }
+
+    in_quoted_cell_escape:
+        if(validate_ && p[-1] == quotechar && *p != quotechar) {
+            return invalid(kCsmRowErrorQuote, 0);
+        }
+        cell->escaped = true;
+        ++p;
+        goto in_quoted_cell;
+
+    in_unquoted_cell:
+        CSM_DEBUG("\n\nin_unquoted_cell")
+        PREAMBLE(kCsmResumeUnquotedCell)
+        rc = unquoted_cell_spanner_(p);
+        CSM_DEBUG("unquoted span: %d; p[3]=%d p[..17]='%.17s'", rc, p[3], p);
+        switch(rc) {
+        case Spanner::kWidth:
+            p += Spanner::kWidth;
+            goto in_unquoted_cell;
+        default:
+            p += rc;
+            goto in_escape_or_end_of_unquoted_cell;
+        }
+
+    in_escape_or_end_of_unquoted_cell:
+        PREAMBLE(kCsmResumeUnquotedCell)
+        if(*p == delimiter) {
+            DELIMITER(kCsmResumeUnquotedCell, ++p; goto in_unquoted_cell)
+            FILTER(p - cell_start, p += delimiter_size; goto skip_cell_start)
+            if(WANTED()) {
+                cell->ptr = cell_start;
+                cell->size = p - cell_start;
+                ++row_.count;
+                CSM_DEBUG("in_escape_or_end_of_unquoted_cell(DELIMITER)")
+                CSM_DEBUG("p[..17] = '%.17s'", p)
+                CSM_DEBUG("done cell: '%.*s'", (int)cell->size, cell->ptr)
+                NEXT_CELL();
+            }
+            NEXT_COLUMN();
+            p += delimiter_size;
+            goto cell_start;
+        } else if(*p == '\r' || *p == '\n') {
+            CSM_DEBUG("in_escape_or_end_of_unquoted_cell(NEWLINE)")
+            FILTER(p - cell_start, END_ROW(col + 1))
+            if(WANTED()) {
+                cell->ptr = cell_start;
+                cell->size = p - cell_start;
+                ++row_.count;
+            }
+            END_ROW(col + 1)
+        } else {
+            cell->escaped = true;
+            ++p;
+            goto in_unquoted_cell;
+        }
+
+        /*
+         * Skip to the end of the row, after the last column projected or
+         * filtered, or once a filter rejects the row. skip_spanner_ stops
+         * only at quotes, newlines and escapes, so an unquoted run of any
+         * number of cells is crossed in one pass. A quote following a
+         * delimiter opens a quoted cell, as at cell_start.
+         */
+    skip_cell_start:
+        PREAMBLE(kCsmResumeSkipCellStart)
+        if(quoting && *p == quotechar) {
+            ++p;
+            goto skip_quoted_cell;
+        }
+
+    skip_unquoted_cell:
+        PREAMBLE(kCsmResumeSkipUnquotedCell)
+        rc = skip_spanner_(p);
+        switch(rc) {
+        case Spanner::kWidth:
+            p += Spanner::kWidth;
+            goto skip_unquoted_cell;
+        default:
+            p += rc;
+        }
+
+        PREAMBLE(kCsmResumeSkipUnquotedCell)
+        if(*p == '\r' || *p == '\n') {
+            END_ROW(-1)
+        } else if(quoting && *p == quotechar && AFTER_DELIMITER()) {
+            ++p;
+            goto skip_quoted_cell;
+        } else {
+            ++p;
+            goto skip_unquoted_cell;
+        }
+
+    skip_quoted_cell:
+        PREAMBLE(kCsmResumeSkipQuotedCell)
+        rc = quoted_cell_spanner_(p);
+        switch(rc) {
+        case Spanner::kWidth:
+            p += Spanner::kWidth;
+            goto skip_quoted_cell;
+        default:
+            p += rc + 1;
+        }
+
+    skip_quoted_cell_end:
+        PREAMBLE(kCsmResumeSkipQuotedCellEnd)
+        if(*p == delimiter) {
+            DELIMITER(kCsmResumeSkipQuotedCellEnd, ++p; goto skip_quoted_cell)
+            p += delimiter_size;
+            goto skip_cell_start;
+        } else if(*p == '\r' || *p == '\n') {
+            END_ROW(-1)
+        } else if(validate_ && p[-1] == quotechar && *p != quotechar) {
+            return invalid(kCsmRowErrorQuote, 0);
+        } else {
+            ++p;
+            goto skip_quoted_cell;
+        }
+    }
+
+    #undef PREAMBLE
+    #undef NEXT_CELL
+    #undef WANTED
+    #undef NEXT_COLUMN
+    #undef DELIMITER
+    #undef AFTER_DELIMITER
+    #undef FILTER
+    #undef END_ROW
+
+    /*
+     * One wrapper per compiled-in spanner: each is built for its spanner's
+     * target with the whole state machine flattened into it, so the spanner
+     * can be inlined without building everything else for that target.
+     */
+#ifdef CSM_USE_SSE42
+    template<bool Project, typename Dialect>
+    __attribute__((flatten))
+    CsmTryParseReturnType
+    try_parse_fallback()
+    {
+        const char delimiter = dialect_delimiter<Dialect>();
+        const char quotechar = dialect_quotechar<Dialect>();
+        const char escapechar = dialect_escapechar<Dialect>();
+        StringSpannerFallback quoted_cell_spanner(quotechar, escapechar);
+        StringSpannerFallback unquoted_cell_spanner(delimiter, '\r', '\n',
+                                                    escapechar);
+        StringSpannerFallback skip_spanner(quotechar, '\r', '\n', escapechar);
+        return try_parse_with<Project, Dialect>(quoted_cell_spanner,
+                                                unquoted_cell_spanner,
+                                                skip_spanner);
+    }
+#endif // CSM_USE_SSE42
+
+#ifdef CSM_USE_AVX2
+    template<bool Project, typename Dialect>
+    __attribute__((flatten)) CSM_ATTR_AVX2
+    CsmTryParseReturnType
+    try_parse_avx2()
+    {
+        const char delimiter = dialect_delimiter<Dialect>();
+        const char quotechar = dialect_quotechar<Dialect>();
+        const char escapechar = dialect_escapechar<Dialect>();
+        StringSpannerAvx2 quoted_cell_spanner(quotechar, escapechar);
+        StringSpannerAvx2 unquoted_cell_spanner(delimiter, '\r', '\n',
+                                                escapechar);
+        StringSpannerAvx2 skip_spanner(quotechar, '\r', '\n', escapechar);
+        return try_parse_with<Project, Dialect>(quoted_cell_spanner,
+                                                unquoted_cell_spanner,
+                                                skip_spanner);
+    }
+#endif // CSM_USE_AVX2
+
+#ifdef CSM_USE_AVX512
+    template<bool Project, typename Dialect>
+    __attribute__((flatten)) CSM_ATTR_AVX512
+    CsmTryParseReturnType
+    try_parse_avx512()
+    {
+        const char delimiter = dialect_delimiter<Dialect>();
+        const char quotechar = dialect_quotechar<Dialect>();
+        const char escapechar = dialect_escapechar<Dialect>();
+        StringSpannerAvx512 quoted_cell_spanner(quotechar, escapechar);
+        StringSpannerAvx512 unquoted_cell_spanner(delimiter, '\r', '\n',
+                                                  escapechar);
+        StringSpannerAvx512 skip_spanner(quotechar, '\r', '\n', escapechar);
+        return try_parse_with<Project, Dialect>(quoted_cell_spanner,
+                                                unquoted_cell_spanner,
+                                                skip_spanner);
+    }
+#endif // CSM_USE_AVX512
+
+    template<bool Project, typename Dialect>
+    CSM_ATTR_SSE42
+    CsmTryParseReturnType
+    try_parse_spanner()
+    {
+        switch(spanner_type_) {
+#ifdef CSM_USE_SSE42
+        case kCsmSpannerFallback:
+            return try_parse_fallback<Project, Dialect>();
+#endif
+#ifdef CSM_USE_AVX2
+        case kCsmSpannerAvx2:
+            return try_parse_avx2<Project, Dialect>();
+#endif
+#ifdef CSM_USE_AVX512
+        case kCsmSpannerAvx512:
+            return try_parse_avx512<Project, Dialect>();
+#endif
+        default:
+            return try_parse_with<Project, Dialect>(quoted_cell_spanner_,
+                                                    unquoted_cell_spanner_,
+                                                    skip_spanner_);
+        }
+    }
+
+    template<bool Project>
+    CsmTryParseReturnType
+    try_parse_dialect()
+    {
+        switch(dialect_type_) {
+        case kCsmDialectCsv:
+            return try_parse_spanner<Project, CsvDialect<','>>();
+        case kCsmDialectTsvUnquoted:
+            return try_parse_spanner<Project, CsvDialect<'\t', 0>>();
+        case kCsmDialectMultiByte:
+            return try_parse_spanner<Project, CsvMultiByteDialect>();
+        default:
+            return try_parse_spanner<Project, CsvRuntimeDialect>();
+        }
+    }
+
+    CsmTryParseReturnType
+    try_parse()
+    {
+        if(projection_.empty()) {
+            return try_parse_dialect<false>();
+        }
+        return try_parse_dialect<true>();
+    }
+
+    /**
+     * Second pass of the two-stage parser: fill row_ from the structural
+     * index, starting from the row at p. Returns kCsmTryParseUnderrun if the
+     * index ends before the row does.
+     */
+    template<bool Project>
+    CsmTryParseReturnType
+    try_parse_index(const char *p)
+    {
+        const char *base = index_base_;
+        const uint32_t *offsets = &index_.offsets[0];
+        size_t count = index_.count;
+        size_t i = index_pos_;
+        size_t s = p - base;
+        CSM_STAT(uint64_t quoted_cells = stats_.quoted_cells)
+
+        row_.count = 0;
+        in_newline_skip = true;
+        while(i < count && offsets[i] == (s | StructuralIndex::kNewline)) {
+            ++s;
+            ++i;
+        }
+        if(s < index_len_) {
+            in_newline_skip = false;
+        }
+        const size_t first = i;
+
+        const int filter_last = filter_last_;
+        const int skip_after = Project
+            ? std::max(projection_last_, filter_last)
+            : -1;
+        bool rejected = false;
+
+        CsvCell *cell = &row_.cells[0];
+        for(int col = 0; i < count; i++, col++) {
+            uint32_t entry = offsets[i];
+            size_t o = entry & ~StructuralIndex::kNewline;
+            bool filtered = col <= filter_last && filter_columns_[col];
+            bool wanted = !Project
+                || (col <= projection_last_ && projection_[col]);
+
+            if(rejected || !(wanted || filtered)) {
+                s = o + 1;
+                if(rejected || col > skip_after) {
+                    while(!(entry & StructuralIndex::kNewline) && ++i < count) {
+                        entry = offsets[i];
+                    }
+                    if(i == count) {
+                        break;
+                    }
+                    s = (entry & ~StructuralIndex::kNewline) + 1;
+                }
+                if(entry & StructuralIndex::kNewline) {
+                    index_pos_ = i + 1;
+                    p_ = base + s;
+                    return end_index_row(rejected || col < filter_last,
+                                         i - first + 1);
+                }
+                continue;
+            }
+
+            if(row_.count == (int) row_.cells.size()) {
+                CSM_STAT(stats_.cell_grows++)
+                cell = row_.grow();
+            }
+
+            cell->escaped = false;
+            if(o == s && (entry & StructuralIndex::kNewline)) {
+                cell->ptr = 0;
+                cell->size = 0;
+            } else if(base[s] == quotechar_) {
+                CSM_STAT(stats_.quoted_cells++)
+                cell->ptr = base + s + 1;
+                cell->size = (o > s + 1) ? (o - s - 2) : 0;
+                cell->escaped = index_.has_quote(s + 1, s + 1 + cell->size);
+                if(validate_ && (o < s + 2 || base[o - 1] != quotechar_
+                        || (cell->escaped && !paired_quotes(*cell)))) {
+                    return invalid(kCsmRowErrorQuote, 0);
+                }
+            } else {
+                cell->ptr = base + s;
+                cell->size = o - s;
+                if(validate_ && index_.has_quote(s, o)) {
+                    return invalid(kCsmRowErrorQuote, 0);
+                }
+            }
+
+            if(filtered && !filter_cell(col, cell->ptr, cell->size,
+                                        cell->escaped)) {
+                // Revisit this entry to skip the remainder of the row.
+                rejected = true;
+                --i;
+                --col;
+                continue;
+            }
+
+            s = o + 1;
+            if(wanted) {
+                ++row_.count;
+                ++cell;
+            }
+            if(entry & StructuralIndex::kNewline) {
+                index_pos_ = i + 1;
+                p_ = base + s;
+                return end_index_row(col < filter_last, i - first + 1);
+            }
+        }
+
+        // The row is parsed again from its start, so don't count it twice.
+        CSM_STAT(stats_.quoted_cells = quoted_cells)
+        return kCsmTryParseUnderrun;
+    }
+
+    /**
+     * Return true if every quote within a quoted cell is doubled, as the
+     * structural index otherwise mistakes a stray quote for the cell's end.
+     */
+    bool
+    paired_quotes(const CsvCell &cell)
+    {
+        const char *p = cell.ptr;
+        const char *endp = p + cell.size;
+        while((p = (const char *) memchr(p, quotechar_, endp - p))) {
+            if(++p == endp || *p++ != quotechar_) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    CsmTryParseReturnType
+    end_index_row(bool rejected, size_t columns)
+    {
+        if(rejected) {
+            return kCsmTryParseRejected;
+        }
+        if(columns_ && (int) columns != columns_) {
+            return invalid(kCsmRowErrorColumns, (int) columns);
+        }
+        return kCsmTryParseOkay;
+    }
+
+    void
+    build_index()
+    {
+        index_base_ = stream_.buf();
+        index_len_ = std::min(stream_.size(), index_block_);
+        index_pos_ = 0;
+        index_.build(index_base_, index_len_, delimiter_, quotechar_,
+                     spanner_type_);
+    }
+
+    bool
+    read_row_index()
+    {
+        row_.count = 0;
+        in_newline_skip = true;
+        for(;;) {
+            const char *p = stream_.buf();
+            if(index_base_) {
+                CsmTryParseReturnType rc = projection_.empty()
+                    ? try_parse_index<false>(p)
+                    : try_parse_index<true>(p);
+                if(rc == kCsmTryParseOkay) {
+                    mark_row(p, p_ - 1);
+                    consume(p_ - p);
+                    return true;
+                } else if(rc == kCsmTryParseRejected) {
+                    CSM_STAT(stats_.rejected_rows++)
+                    mark_row(p, p_ - 1);
+                    consume(p_ - p);
+                    continue;
+                } else if(rc == kCsmTryParseInvalid) {
+                    if(! recover(p)) {
+                        return false;
+                    }
+                    continue;
+                }
+
+                // Rows remain beyond the block, index again from this row.
+                CSM_STAT(stats_.underruns++)
+                if(index_base_ + index_len_ < p + stream_.size()) {
+                    if(p == index_base_) {
+                        index_block_ *= 2;
+                    }
+                    build_index();
+                    continue;
+                }
+            }
+
+            if(index_base_ || !stream_.size()) {
+                // A row spanning the whole index gathers at least as much
+                // again before reindexing, so small fills don't rescan it.
+                size_t want = (index_base_ == p) ? 2 * index_len_ : 0;
+                index_base_ = 0;
+                if(! stream_.fill()) {
+                    if(validate_ && unterminated_quote()) {
+                        if(recover(stream_.buf())) {
+                            continue;
+                        }
+                        return false;
+                    }
+                    break;
+                }
+                while(stream_.size() < want && stream_.fill()) {
+                }
+            }
+            build_index();
+        }
+
+        if(row_.count && yield_incomplete_row_) {
+            mark_row(stream_.buf(), stream_.buf() + stream_.size());
+            consume(stream_.size());
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * Record the raw extent of a parsed row, less any blank lines before it,
+     * ending before its line terminator.
+     */
+    void
+    mark_row(const char *p, const char *endp)
+    {
+        while(p < endp && (*p == '\r' || *p == '\n')) {
+            p++;
+        }
+        row_start_ = p;
+        row_end_ = endp;
+        row_offset_ = offset_ + (p - stream_.buf());
+        CSM_STAT(
+            stats_.cells += row_.count;
+            for(int i = 0; i < row_.count; i++) {
+                stats_.escaped_cells += row_.cells[i].escaped;
+            }
+        )
+        if(row_index_) {
+            row_index_->add(row_number_, row_offset_,
+                            row_offset_ + (endp - p));
+        }
+        row_number_++;
+    }
+
+    void
+    consume(size_t n)
+    {
+        n = std::min(n, stream_.size());
+        offset_ += n;
+        stream_.consume(n);
+    }
+
+    /**
+     * At the end of input, return true if the unparsed remainder opens a
+     * quote it never closes.
+     */
+    bool
+    unterminated_quote()
+    {
+        bool open;
+        if(use_index_) {
+            const char *p = stream_.buf();
+            open = quotechar_
+                && (std::count(p, p + stream_.size(), quotechar_) & 1);
+        } else {
+            open = resume_.state == kCsmResumeQuotedCell
+                || resume_.state == kCsmResumeSkipQuotedCell;
+        }
+        if(open) {
+            invalid(kCsmRowErrorQuote, 0);
+        }
+        return open;
+    }
+
+    /**
+     * Record the malformed row at p found by the last parse, and unless in
+     * lenient mode, return false. Otherwise skip the row and return true: a
+     * row with the wrong number of columns ends where it was parsed to, while
+     * after a quote error parsing resumes at the first line break after the
+     * start of the row, so an unterminated quote costs only its own line.
+     */
+    bool
+    recover(const char *p)
+    {
+        const char *start = p;
+        const char *endp = p + stream_.size();
+        while(start < endp && (*start == '\r' || *start == '\n')) {
+            start++;
+        }
+
+        resume_.state = kCsmResumeNone;
+        if(! failed_) {
+            stats_.invalid_rows++;
+            if(errors_.size() < max_errors_) {
+                errors_.push_back(CsvRowError {
+                    invalid_, row_number_, offset_ + (start - p),
+                    invalid_columns_, columns_
+                });
+            }
+        }
+        if(validate_ == kCsmValidateStrict) {
+            failed_ = true;
+            return false;
+        }
+
+        row_.count = 0;
+        if(invalid_ == kCsmRowErrorColumns) {
+            mark_row(p, p_ - 1);
+            consume(p_ - p);
+        } else {
+            index_base_ = 0;
+            skip_line(start - p);
+        }
+        return true;
+    }
+
+    /**
+     * Consume input up to and including the first line break at least pos
+     * bytes into the stream buffer, reading more as needed.
+     */
+    void
+    skip_line(size_t pos)
+    {
+        for(;;) {
+            const char *p = stream_.buf();
+            size_t size = stream_.size();
+            while(pos < size && p[pos] != '\r' && p[pos] != '\n') {
+                pos++;
+            }
+            if(pos < size || !stream_.fill()) {
+                mark_row(p, p + pos);
+                consume(pos + 1);
+                return;
+            }
+        }
+    }
+
+    /**
+     * Parse the next row from data already in the stream buffer, without
+     * calling fill().
+     */
+    CsmTryParseReturnType
+    try_parse_buffered(const char *p)
+    {
+        if(use_index_) {
+            if(! index_base_) {
+                return kCsmTryParseUnderrun;
+            }
+            return projection_.empty()
+                ? try_parse_index<false>(p)
+                : try_parse_index<true>(p);
+        }
+
+        p_ = p;
+        endp_ = p + stream_.size();
+        return try_parse();
+    }
+
+    public:
+    bool
+    read_row()
+    {
+        const char *p;
+        CSM_DEBUG("")
+
+        if(use_index_) {
+            return read_row_index();
+        }
+
+        for(;;) {
+            p = stream_.buf();
+            p_ = p;
+            endp_ = p + stream_.size();
+            switch(try_parse()) {
+                case kCsmTryParseOkay:
+                    mark_row(p, p_ - 1);
+                    consume(p_ - p);
+                    return true;
+                case kCsmTryParseRejected:
+                    CSM_STAT(stats_.rejected_rows++)
+                    mark_row(p, p_ - 1);
+                    consume(p_ - p);
+                    continue;
+                case kCsmTryParseInvalid:
+                    if(! recover(p)) {
+                        return false;
+                    }
+                    continue;
+                case kCsmTryParseUnderrun:
+                    ;
+            }
+            CSM_DEBUG("attempting fill!")
+            if(! stream_.fill()) {
+                if(validate_ && unterminated_quote()) {
+                    if(recover(stream_.buf())) {
+                        continue;
+                    }
+                    return false;
+                }
+                break;
+            }
+        }
+
+        resume_.state = kCsmResumeNone;
+        if(row_.count && yield_incomplete_row_) {
+            CSM_DEBUG("stream fill failed, but partial row exists")
+            mark_row(p, endp_);
+            consume(endp_ - p);
+            return true;
+        }
+
+        CSM_DEBUG("stream fill failed")
+        return false;
+    }
+
+    /**
+     * Read up to max_rows rows into batch, returning the number read, or 0 at
+     * the end of input. Rows are parsed back to back from the stream buffer,
+     * so the batch ends early rather than fill() and move rows already in it.
+     */
+    size_t
+    read_batch(CsvBatch &batch, size_t max_rows)
+    {
+        batch.clear(std::max(batch.capacity(), max_rows));
+        if(! max_rows || ! read_row()) {
+            return 0;
+        }
+
+        batch.base = row_start_;
+        batch.append(row_, row_start_, row_end_ - row_start_);
+        while(batch.rows < max_rows) {
+            const char *p = stream_.buf();
+            size_t index_pos = index_pos_;
+            CsmTryParseReturnType rc = try_parse_buffered(p);
+            if(rc == kCsmTryParseRejected) {
+                CSM_STAT(stats_.rejected_rows++)
+                mark_row(p, p_ - 1);
+                consume(p_ - p);
+                continue;
+            } else if(rc != kCsmTryParseOkay
+                      || (size_t) (p_ - batch.base) > UINT32_MAX) {
+                index_pos_ = index_pos;
+                break;
+            }
+
+            mark_row(p, p_ - 1);
+            consume(p_ - p);
+            batch.append(row_, row_start_, row_end_ - row_start_);
+        }
+        return batch.rows;
+    }
+
+    CsvCursor &
+    row()
+    {
+        return row_;
+    }
+
+    /**
+     * Return the raw bytes of the most recently read row, excluding its line
+     * terminator, valid until the next read.
+     */
+    const char *
+    row_data(size_t &size)
+    {
+        size = row_end_ - row_start_;
+        return row_start_;
+    }
+
+    /**
+     * Return counters describing the work done so far, including those of the
+     * stream.
+     */
+    CsvStats
+    stats()
+    {
+        CsvStats stats = stats_;
+        stats.bytes = offset_;
+        stats.rows = row_number_;
+        stats.cursor = stream_.stats();
+        return stats;
+    }
+
+    /**
+     * Number of rows read so far, which is also the number of the next row.
+     */
+    size_t
+    row_number()
+    {
+        return row_number_;
+    }
+
+    /**
+     * Offset from the start of input of the most recently read row.
+     */
+    uint64_t
+    row_offset()
+    {
+        return row_offset_;
+    }
+
+    /**
+     * Record every row read from now on into index, or stop if index is
+     * NULL. For offsets to match the file, the reader must have been created
+     * at the start of input.
+     */
+    void
+    set_row_index(RowIndex *index)
+    {
+        row_index_ = index;
+    }
+
+    /**
+     * Discard any partial row and buffered parse state, after the stream has
+     * been repositioned at the start of row number row, offset bytes from the
+     * start of input.
+     */
+    void
+    reset(uint64_t offset, size_t row)
+    {
+        resume_.state = kCsmResumeNone;
+        index_base_ = 0;
+        row_.count = 0;
+        in_newline_skip = true;
+        offset_ = offset;
+        row_number_ = row;
+        failed_ = false;
+    }
+
+    /**
+     * Seek the stream to the nearest indexed row before row, then read
+     * forward so the next read_row() returns it. Returns false if the index
+     * does not cover row, the stream cannot seek, or input ended early.
+     */
+    bool
+    seek_row(const RowIndex &index, size_t row)
+    {
+        uint64_t offset;
+        ssize_t indexed = index.find_row(row, offset);
+        if(indexed < 0 || !stream_.seek(offset)) {
+            return false;
+        }
+
+        reset(offset, indexed);
+        while(row_number_ < row && read_row()) {
+        }
+        return row_number_ == row;
+    }
+
+    /**
+     * Seek the stream to the first indexed row starting at or after offset,
+     * so parsing a byte range can begin without searching for a boundary.
+     * Returns the row number, or -1 if there is no such row or the stream
+     * cannot seek.
+     */
+    ssize_t
+    seek_offset(const RowIndex &index, uint64_t offset)
+    {
+        uint64_t row_offset;
+        ssize_t row = index.find_offset(offset, row_offset);
+        if(row < 0 || !stream_.seek(row_offset)) {
+            return -1;
+        }
+        reset(row_offset, row);
+        return row;
+    }
+
+    char
+    quotechar()
+    {
+        return quotechar_;
+    }
+
+    char
+    escapechar()
+    {
+        return escapechar_;
+    }
+
+    /**
+     * Return a cell of the current row unescaped using the reader's dialect.
+     * Escaped cells are decoded into an arena reused across rows, so the
+     * result is valid until the next read_row().
+     */
+    CsvCell
+    unescape(const CsvCell &cell)
+    {
+        if(! cell.escaped) {
+            return cell;
+        }
+        if(arena_row_ != row_number_) {
+            arena_.reset();
+            arena_row_ = row_number_;
+        }
+        return arena_.decode(cell, escapechar_, quotechar_);
+    }
+
+    CsmSpannerType
+    spanner_type()
+    {
+        return spanner_type_;
+    }
+
+    /**
+     * Only store the given zero-based columns, in file order, so that
+     * row().cells[i] is the i'th wanted column present in the row. Cells of
+     * other columns are never stored, and the remainder of each row after the
+     * last wanted column is skipped. An empty vector disables projection.
+     */
+    void
+    set_projection(const std::vector<int> &columns)
+    {
+        projection_.clear();
+        projection_last_ = -1;
+        resume_.state = kCsmResumeNone;
+        for(int col : columns) {
+            if(col < 0) {
+                throw Error("set_projection", "negative column index");
+            }
+            if(col >= (int) projection_.size()) {
+                projection_.resize(col + 1);
+            }
+            projection_[col] = 1;
+            projection_last_ = std::max(projection_last_, col);
+        }
+        update_columns();
+    }
+
+    /**
+     * Only yield rows whose zero-based column equals value. Filters are
+     * checked as each filtered cell ends, and a row failing any of them is
+     * skipped at once without tracking its remaining cells. Rows lacking a
+     * filtered column are skipped, while an incomplete final row yielded by
+     * yield_incomplete_row is not filtered. Rows skipped by filters still
+     * count towards row_number() and any RowIndex.
+     */
+    void
+    add_filter_equals(int column, const std::string &value)
+    {
+        add_filter(column, kCsmFilterEquals, value, 0, 0);
+    }
+
+    /**
+     * Only yield rows whose column begins with prefix.
+     */
+    void
+    add_filter_prefix(int column, const std::string &prefix)
+    {
+        add_filter(column, kCsmFilterPrefix, prefix, 0, 0);
+    }
+
+    /**
+     * Only yield rows whose column parses as a number, like as_double(),
+     * within [min, max]. Empty cells never match.
+     */
+    void
+    add_filter_range(int column, double min, double max)
+    {
+        add_filter(column, kCsmFilterRange, std::string(), min, max);
+    }
+
+    /**
+     * Check rows as they are parsed: quotes must be balanced, and unless
+     * columns is 0, every row must have that many columns. In strict mode
+     * read_row() returns false at the first malformed row and failed()
+     * becomes true. In lenient mode the row is skipped and parsing continues
+     * from the next row boundary, without parsing again what came before.
+     * Either way rows found are counted by stats().invalid_rows, and the
+     * first max_errors kept by errors(). Rows skipped by filters are not
+     * checked, nor is the length of an incomplete final row.
+     */
+    void
+    set_validation(CsmValidateType type, int columns=0,
+                   size_t max_errors=1000)
+    {
+        if(columns < 0) {
+            throw Error("set_validation", "negative column count");
+        }
+        validate_ = type;
+        columns_ = type ? columns : 0;
+        max_errors_ = max_errors;
+        resume_.state = kCsmResumeNone;
+        update_columns();
+    }
+
+    /**
+     * Return true if strict validation stopped at a malformed row.
+     */
+    bool
+    failed()
+    {
+        return failed_;
+    }
+
+    const std::vector<CsvRowError> &
+    errors()
+    {
+        return errors_;
+    }
+
+    void
+    clear_filters()
+    {
+        filters_.clear();
+        filter_columns_.clear();
+        filter_last_ = -1;
+        resume_.state = kCsmResumeNone;
+    }
+
+    private:
+    void
+    add_filter(int column, CsmFilterType type, const std::string &value,
+               double min, double max)
+    {
+        if(column < 0) {
+            throw Error("add_filter", "negative column index");
+        }
+        filters_.push_back(Filter { column, type, value, min, max });
+        if(column >= (int) filter_columns_.size()) {
+            filter_columns_.resize(column + 1);
+        }
+        filter_columns_[column] = 1;
+        filter_last_ = std::max(filter_last_, column);
+        resume_.state = kCsmResumeNone;
+        update_columns();
+    }
+
+    /**
+     * With projection, cells are tracked up to the last projected or
+     * filtered column, or while validating the last expected column to count
+     * them, so extend the projection flags to cover all of these.
+     */
+    void
+    update_columns()
+    {
+        int last = std::max(filter_last_, columns_ - 1);
+        if(! projection_.empty() && (int) projection_.size() <= last) {
+            projection_.resize(last + 1);
+        }
+    }
+
+    public:
+    /**
+     * Switch to the two-stage structural index engine, which avoids the
+     * per-character branching of try_parse() on quote-heavy input. Parsing
+     * result is identical for RFC 4180 input, but quotes appearing within an
+     * unquoted cell are not supported. Return false if escapechar or a
+     * multi-byte delimiter is set.
+     */
+    bool
+    use_structural_index(bool enable=true)
+    {
+        if(enable && (escapechar_ || !delimiter_tail_.empty())) {
+            return false;
+        }
+        use_index_ = enable;
+        index_base_ = 0;
+        resume_.state = kCsmResumeNone;
+        return true;
+    }
+
+    /**
+     * Return the compile-time dialect matching a reader configuration, or
+     * kCsmDialectRuntime. Tab-separated input with a NUL quotechar matches
+     * the unquoted TSV dialect.
+     */
+    static CsmDialectType
+    match_dialect(char delimiter, char quotechar, char escapechar)
+    {
+        if(escapechar) {
+            return kCsmDialectRuntime;
+        } else if(delimiter == ',' && quotechar == '"') {
+            return kCsmDialectCsv;
+        } else if(delimiter == '\t' && !quotechar) {
+            return kCsmDialectTsvUnquoted;
+        }
+        return kCsmDialectRuntime;
+    }
+
+    /**
+     * Parse using the runtime-configured dialect even when a compile-time
+     * one matches, eg. to compare them.
+     */
+    void
+    use_runtime_dialect(bool enable=true)
+    {
+        force_runtime_ = enable;
+        if(! delimiter_tail_.empty()) {
+            dialect_type_ = kCsmDialectMultiByte;
+        } else {
+            dialect_type_ = enable
+                ? kCsmDialectRuntime
+                : match_dialect(delimiter_, quotechar_, escapechar_);
+        }
+    }
+
+    /**
+     * Replace the delimiter given to the constructor, which may be longer
+     * than one byte, such as "||" or the UTF-8 encoding of a character. A
+     * multi-byte delimiter is found by the same vectorized scan as others,
+     * for its first byte, and checked there for the rest. It is not supported
+     * by the structural index, and may not contain a line break, quotechar
+     * or escapechar.
+     */
+    void
+    set_delimiter(const std::string &delimiter)
+    {
+        if(delimiter.empty()) {
+            throw Error("set_delimiter", "delimiter is empty");
+        }
+        for(char c : delimiter) {
+            if(c == '\r' || c == '\n' || (c && (c == quotechar_
+                                                  || c == escapechar_))) {
+                throw Error("set_delimiter", "delimiter contains a line "
+                            "break, quotechar or escapechar");
+            }
+        }
+        if(delimiter.size() > 1 && use_index_) {
+            throw Error("set_delimiter", "the structural index does not "
+                        "support multi-byte delimiters");
+        }
+
+        delimiter_ = delimiter[0];
+        delimiter_tail_.assign(delimiter, 1, std::string::npos);
+        unquoted_cell_spanner_ = StringSpanner(delimiter_, '\r', '\n',
+                                               escapechar_);
+        resume_.state = kCsmResumeNone;
+        use_runtime_dialect(force_runtime_);
+    }
+
+    CsmDialectType
+    dialect_type()
+    {
+        return dialect_type_;
+    }
+
+    /**
+     * Override the spanner picked by best_spanner(). Return false if it is not
+     * supported by this build or CPU.
+     */
+    bool
+    use_spanner(CsmSpannerType type)
+    {
+        if(! spanner_supported(type)) {
+            return false;
+        }
+        spanner_type_ = type;
+        return true;
+    }
+
+    CsvReader(StreamCursor &stream,
+            char delimiter=',',
+            char quotechar='"',
+            char escapechar=0,
+            bool yield_incomplete_row=false)
+        : endp_(stream.buf() + stream.size())
+        , p_(stream.buf())
+        , delimiter_(delimiter)
+        , quotechar_(quotechar)
+        , escapechar_(escapechar)
+        , yield_incomplete_row_(yield_incomplete_row)
+        , stream_(stream)
+        , quoted_cell_spanner_(quotechar, escapechar)
+        , unquoted_cell_spanner_(delimiter, '\r', '\n', escapechar)
+        , skip_spanner_(quotechar, '\r', '\n', escapechar)
+        , spanner_type_(best_spanner())
+        , dialect_type_(match_dialect(delimiter, quotechar, escapechar))
+        , force_runtime_(false)
+        , projection_last_(-1)
+        , filter_last_(-1)
+        , use_index_(false)
+        , index_block_(262144)
+        , index_base_(0)
+        , index_len_(0)
+        , index_pos_(0)
+        , row_start_(0)
+        , row_end_(0)
+        , offset_(0)
+        , row_offset_(0)
+        , row_number_(0)
+        , row_index_(0)
+        , validate_(kCsmValidateNone)
+        , columns_(0)
+        , invalid_(kCsmRowErrorNone)
+        , invalid_columns_(0)
+        , failed_(false)
+        , max_errors_(0)
+        , stats_()
+        , arena_row_(0)
+    {
+        resume_.state = kCsmResumeNone;
+    }
+};
+
+
+class DatasetReader;
+
+
+/**
+ * Parse the remainder of a MappedFileCursor using several threads. The input
+ * is cut into one byte range per thread, each cut is moved forward to the next
+ * row boundary, and every range is then parsed by its own CsvReader.
+ *
+ * Whether a cut falls inside a quoted cell is not known until all preceding
+ * input has been seen, so boundary detection happens in two steps. Each cut
+ * is first moved past the next newline, where the parser is either at a row
+ * start or inside a quoted cell. Every thread then follows the parser's
+ * quoting rules across its slice for both cases, recording where the slice
+ * ends up and where its first row starts, and the correct case for each slice
+ * is picked in order from the one before it. A quote opens a cell only at the
+ * start of a cell, and a quoted cell ends only at a quote followed by a
+ * delimiter or newline, exactly as in CsvReader, so quotes appearing inside
+ * unquoted cells cannot misplace a cut. escapechar is not supported. A slice
+ * with no row start is simply merged into its predecessor.
+ */
+class ParallelReader
+{
+    friend class DatasetReader;
+
+    public:
+    struct Range
+    {
+        const char *p;
+        const char *endp;
+    };
+
+    // Below this many bytes per thread, splitting costs more than it saves.
+    static const size_t kMinRangeSize = 1 << 20;
+    // Rows per batch handed from workers to for_each_ordered().
+    static const size_t kBatchRows = 1024;
+    // Batches each worker may queue ahead of for_each_ordered().
+    static const size_t kMaxQueuedBatches = 8;
+
+    private:
+    struct Scan
+    {
+        // Slice of input, starting just past a newline unless it is first.
+        const char *p;
+        const char *endp;
+        // For a slice starting outside/inside a quoted cell, whether it ends
+        // inside one, and its first row start.
+        bool quoted[2];
+        const char *boundary[2];
+    };
+
+    struct Batch
+    {
+        std::vector<CsvCell> cells;
+        std::vector<int> counts;
+    };
+
+    struct Queue
+    {
+        std::deque<Batch> batches;
+        bool done;
+
+        Queue()
+            : done(false)
+        {
+        }
+    };
+
+    MappedFileCursor &stream_;
+    int threads_;
+    char delimiter_;
+    char quotechar_;
+    bool yield_incomplete_row_;
+    const RowIndex *row_index_;
+    std::vector<Range> ranges_;
+
+    template<typename Fn>
+    static void
+    run(size_t n, Fn fn)
+    {
+        std::vector<std::thread> threads;
+        std::vector<std::exception_ptr> errors(n);
+
+        for(size_t i = 0; i < n; i++) {
+            threads.emplace_back([&fn, &errors, i]() {
+                try {
+                    fn(i);
+                } catch(...) {
+                    errors[i] = std::current_exception();
+                }
+            });
+        }
+
+        for(auto &thread : threads) {
+            thread.join();
+        }
+        for(auto &error : errors) {
+            if(error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    static const char *
+    find_newline(const char *p, const char *endp)
+    {
+        auto lf = (const char *) memchr(p, '\n', endp - p);
+        auto cr = (const char *) memchr(p, '\r', (lf ? lf : endp) - p);
+        return cr ? cr : lf;
+    }
+
+    /**
+     * Follow CsvReader's quoting rules from p to endp, starting inside a
+     * quoted cell if quoted is set, otherwise at a row start, and return
+     * whether endp falls inside a quoted cell. If boundary is not null and
+     * still unset, it receives the first row start found.
+     */
+    static bool
+    advance(const char *p, const char *endp, char delimiter, char quotechar,
+            bool quoted, const char **boundary)
+    {
+        const char *startp = p;
+        while(p < endp) {
+            auto q = (const char *) memchr(p, quotechar, endp - p);
+            if(! quoted) {
+                if(boundary && !*boundary) {
+                    const char *newline = find_newline(p, q ? q : endp);
+                    if(newline) {
+                        *boundary = newline + 1;
+                    }
+                }
+                if(! q) {
+                    return false;
+                }
+                // Elsewhere than at the start of a cell, a quote is data.
+                quoted = q == startp || q[-1] == delimiter
+                    || q[-1] == '\r' || q[-1] == '\n';
+                p = q + 1;
+            } else {
+                if(! q) {
+                    return true;
+                } else if(q + 1 == endp) {
+                    return false;
+                }
+                // The quote and the character after it are consumed together;
+                // only a delimiter or newline ends the cell.
+                char c = q[1];
+                p = q + 2;
+                if(c == delimiter || c == '\r' || c == '\n') {
+                    quoted = false;
+                    if(c != delimiter && boundary && !*boundary) {
+                        *boundary = p;
+                    }
+                }
+            }
+        }
+        return quoted;
+    }
+
+    /**
+     * Fill in scan.quoted and scan.boundary for both starting states.
+     */
+    static void
+    scan(char delimiter, char quotechar, Scan &scan)
+    {
+        scan.boundary[0] = scan.p;
+        scan.boundary[1] = 0;
+        if(! quotechar) {
+            scan.boundary[1] = scan.p;
+            scan.quoted[0] = scan.quoted[1] = false;
+            return;
+        }
+
+        scan.quoted[1] = advance(scan.p, scan.endp, delimiter, quotechar,
+                                 true, &scan.boundary[1]);
+        const char *boundary = scan.boundary[1] ? scan.boundary[1] : scan.endp;
+        scan.quoted[0] = advance(scan.p, boundary, delimiter, quotechar,
+                                 false, 0);
+        if(boundary != scan.endp) {
+            // Once both cases reach the same row start, they agree.
+            scan.quoted[0] = scan.quoted[0]
+                ? advance(boundary, scan.endp, delimiter, quotechar, true, 0)
+                : scan.quoted[1];
+        }
+    }
+
+    /**
+     * Divide [p, endp) into n slices of roughly equal size, each after the
+     * first starting just past a newline.
+     */
+    static void
+    slice(const char *p, const char *endp, size_t n, std::vector<Scan> &scans)
+    {
+        size_t size = (endp - p) / n;
+        scans.resize(n);
+        scans[0].p = p;
+        for(size_t i = 1; i < n; i++) {
+            const char *split = std::max(scans[i - 1].p, p + (i * size));
+            const char *newline = find_newline(split, endp);
+            scans[i].p = newline ? newline + 1 : endp;
+            scans[i - 1].endp = scans[i].p;
+        }
+        scans[n - 1].endp = endp;
+    }
+
+    void
+    split()
+    {
+        const char *p = stream_.buf();
+        const char *endp = p + stream_.size();
+        size_t n = std::max(1, threads_);
+        n = std::max((size_t) 1, std::min(n, (endp - p) / kMinRangeSize));
+
+        size_t range_size = (endp - p) / n;
+        if(row_index_ && row_index_->covers(stream_.offset() + (endp - p))) {
+            split_indexed(p, endp, n, range_size);
+            return;
+        }
+
+        std::vector<Scan> scans;
+        slice(p, endp, n, scans);
+        run(n, [&](size_t i) {
+            scan(delimiter_, quotechar_, scans[i]);
+        });
+        cut(p, endp, scans, ranges_);
+    }
+
+    /**
+     * Cut [p, endp) into ranges at the first row start of each slice after
+     * the first, following each slice's quote state into the next, and
+     * skipping slices where no row starts.
+     */
+    static void
+    cut(const char *p, const char *endp, const std::vector<Scan> &scans,
+        std::vector<Range> &ranges)
+    {
+        ranges.clear();
+        ranges.push_back(Range { p, endp });
+        bool quoted = scans[0].quoted[0];
+        for(size_t i = 1; i < scans.size(); i++) {
+            const char *boundary = scans[i].boundary[quoted];
+            if(boundary && boundary > ranges.back().p && boundary < endp) {
+                ranges.back().endp = boundary;
+                ranges.push_back(Range { boundary, endp });
+            }
+            quoted = scans[i].quoted[quoted];
+        }
+    }
+
+    /**
+     * Cut at the first indexed row starting past each range_size split, with
+     * no need to scan for boundaries.
+     */
+    void
+    split_indexed(const char *p, const char *endp, size_t n, size_t range_size)
+    {
+        const char *base = p - stream_.offset();
+        ranges_.clear();
+        ranges_.push_back(Range { p, endp });
+        for(size_t i = 1; i < n; i++) {
+            uint64_t offset;
+            const char *target = p + (i * range_size);
+            if(row_index_->find_offset(target - base, offset) < 0) {
+                break;
+            }
+
+            const char *boundary = base + offset;
+            if(boundary > ranges_.back().p && boundary < endp) {
+                ranges_.back().endp = boundary;
+                ranges_.push_back(Range { boundary, endp });
+            }
+        }
+    }
+
+    template<typename Fn>
+    void
+    parse(size_t i, Fn fn)
+    {
+        MemoryCursor cursor(ranges_[i].p, ranges_[i].endp);
+        CsvReader reader(cursor, delimiter_, quotechar_, 0,
+            yield_incomplete_row_ && (i == ranges_.size() - 1));
+        while(reader.read_row()) {
+            fn(reader.row());
+        }
+    }
+
+    public:
+    ParallelReader(MappedFileCursor &stream,
+                   int threads=0,
+                   char delimiter=',',
+                   char quotechar='"',
+                   bool yield_incomplete_row=false)
+        : stream_(stream)
+        , threads_(threads ? threads : std::thread::hardware_concurrency())
+        , delimiter_(delimiter)
+        , quotechar_(quotechar)
+        , yield_incomplete_row_(yield_incomplete_row)
+        , row_index_(0)
+    {
+    }
+
+    /**
+     * Split at row starts found in index rather than scanning for them, when
+     * it was built over the whole of the stream's file. Coarse indexes give
+     * less even ranges. The index must outlive the reader.
+     */
+    void
+    use_row_index(const RowIndex *index)
+    {
+        row_index_ = index;
+    }
+
+    /**
+     * Upper bound on the number of ranges, and so on the range indices
+     * passed to for_each() callbacks.
+     */
+    int
+    max_ranges()
+    {
+        return std::max(1, threads_);
+    }
+
+    /**
+     * Byte ranges assigned to each thread by the most recent
+     * for_each()/for_each_ordered().
+     */
+    const std::vector<Range> &
+    ranges()
+    {
+        return ranges_;
+    }
+
+    /**
+     * Invoke fn(range_index, row) for every row, concurrently from one thread
+     * per range. Rows within a range arrive in file order. The stream is
+     * fully consumed on return, and any exception thrown by fn is rethrown.
+     */
+    template<typename Fn>
+    void
+    for_each(Fn fn)
+    {
+        split();
+        run(ranges_.size(), [&](size_t i) {
+            parse(i, [&](CsvCursor &row) {
+                fn((int) i, row);
+            });
+        });
+        stream_.consume(stream_.size());
+    }
+
+    /**
+     * Invoke fn(row) for every row, from the calling thread and in file
+     * order, while the remaining ranges are parsed ahead by worker threads.
+     * Cells still point into the mapping, only the CsvCell arrays are copied.
+     */
+    template<typename Fn>
+    void
+    for_each_ordered(Fn fn)
+    {
+        split();
+
+        std::vector<Queue> queues(ranges_.size());
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool abort = false;
+
+        auto push = [&](Queue &queue, Batch &batch) {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]() {
+                return abort || queue.batches.size() < kMaxQueuedBatches;
+            });
+            if(abort) {
+                throw Error("ParallelReader", "aborted");
+            }
+            queue.batches.emplace_back(std::move(batch));
+            batch = Batch();
+            cond.notify_all();
+        };
+
+        auto produce = [&](size_t i) {
+            Queue &queue = queues[i];
+            Batch batch;
+            try {
+                parse(i, [&](CsvCursor &row) {
+                    batch.cells.insert(batch.cells.end(),
+                        row.cells.begin(), row.cells.begin() + row.count);
+                    batch.counts.push_back(row.count);
+                    if(batch.counts.size() == kBatchRows) {
+                        push(queue, batch);
+                    }
+                });
+                if(batch.counts.size()) {
+                    push(queue, batch);
+                }
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.done = true;
+                cond.notify_all();
+                throw;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.done = true;
+            cond.notify_all();
+        };
+
+        std::exception_ptr error;
+        std::thread producer([&]() {
+            try {
+                run(ranges_.size(), produce);
+            } catch(...) {
+                error = std::current_exception();
+            }
+        });
+
+        CsvCursor row;
+        try {
+            for(auto &queue : queues) {
+                for(;;) {
+                    Batch batch;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cond.wait(lock, [&]() {
+                            return queue.done || queue.batches.size();
+                        });
+                        if(queue.batches.empty()) {
+                            break;
+                        }
+                        batch = std::move(queue.batches.front());
+                        queue.batches.pop_front();
+                        cond.notify_all();
+                    }
+
+                    const CsvCell *cell = batch.cells.data();
+                    for(int count : batch.counts) {
+                        if((size_t) count > row.cells.size()) {
+                            row.cells.resize(count);
+                        }
+                        std::copy(cell, cell + count, row.cells.begin());
+                        row.count = count;
+                        cell += count;
+                        fn(row);
+                    }
+                }
+            }
+        } catch(...) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                abort = true;
+                cond.notify_all();
+            }
+            producer.join();
+            throw;
+        }
+
+        producer.join();
+        if(error) {
+            std::rethrow_exception(error);
+        }
+        stream_.consume(stream_.size());
+    }
+};
+
+
+/**
+ * Parse a list of files sharing a header as one dataset, using several
+ * threads. Each file is a task on a queue shared by a pool of threads. When a
+ * thread opens a file of at least twice kChunkSize, it cuts it into chunks the
+ * same way ParallelReader splits its input, then queues the chunks ahead of
+ * every later file so idle threads pick them up first. Tasks are taken in
+ * (file, chunk) order, which is also the order rows are delivered in by
+ * for_each_ordered().
+ *
+ * With header set, the first row of the first non-empty file is the header,
+ * and the first row of every other non-empty file must match it, otherwise
+ * Error is thrown. Header rows are not passed to callbacks.
+ */
+class DatasetReader
+{
+    public:
+    // Smallest chunk a file is cut into.
+    static const size_t kChunkSize = 8 << 20;
+
+    private:
+    typedef ParallelReader::Range Range;
+    typedef ParallelReader::Batch Batch;
+    typedef ParallelReader::Queue Queue;
+
+    struct Task
+    {
+        int file;
+        int chunk;
+
+        // Reversed, so std::priority_queue pops the earliest task.
+        bool operator<(const Task &other) const
+        {
+            return file > other.file
+                || (file == other.file && chunk > other.chunk);
+        }
+    };
+
+    struct File
+    {
+        std::shared_ptr<MappedFileCursor> stream;
+        std::vector<Range> ranges;
+        // One per range, for for_each_ordered().
+        std::deque<Queue> queues;
+        size_t unfinished;
+        bool opened;
+
+        File()
+            : unfinished(0)
+            , opened(false)
+        {
+        }
+    };
+
+    std::vector<std::string> paths_;
+    int threads_;
+    char delimiter_;
+    char quotechar_;
+    bool yield_incomplete_row_;
+    bool header_;
+    bool header_read_;
+    int header_file_;
+    std::vector<std::string> header_row_;
+
+    std::vector<File> files_;
+    std::priority_queue<Task> tasks_;
+    // Tasks queued or running; more may be queued until this reaches zero.
+    size_t pending_;
+    // Tasks for files past this are not started yet.
+    int last_file_;
+    bool ordered_;
+    bool abort_;
+    std::exception_ptr error_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+
+    static size_t
+    file_size(const std::string &path)
+    {
+        struct stat st;
+        if(::stat(path.c_str(), &st) == -1) {
+            throw Error(path.c_str(), strerror(errno));
+        }
+        return st.st_size;
+    }
+
+    void
+    read_header()
+    {
+        header_read_ = true;
+        for(size_t i = 0; header_ && i < paths_.size(); i++) {
+            if(! file_size(paths_[i])) {
+                continue;
+            }
+
+            MappedFileCursor stream;
+            stream.open(paths_[i].c_str());
+            CsvReader reader(stream, delimiter_, quotechar_, 0, true);
+            if(reader.read_row()) {
+                CsvCursor &row = reader.row();
+                for(int col = 0; col < row.count; col++) {
+                    header_row_.push_back(row.cells[col].as_str(0, quotechar_));
+                }
+            }
+            header_file_ = (int) i;
+            return;
+        }
+    }
+
+    void
+    check_header(int index, CsvCursor &row)
+    {
+        bool match = row.count == (int) header_row_.size();
+        for(int col = 0; match && col < row.count; col++) {
+            match = row.cells[col].as_str(0, quotechar_) == header_row_[col];
+        }
+        if(! match) {
+            throw Error(paths_[index].c_str(),
+                "header does not match " + paths_[header_file_]);
+        }
+    }
+
+    /**
+     * Map a file and cut it into ranges, queueing a task for each range after
+     * the first, which the calling thread goes on to parse itself.
+     */
+    void
+    open(int index)
+    {
+        auto stream = std::make_shared<MappedFileCursor>();
+        std::vector<Range> ranges;
+        if(file_size(paths_[index])) {
+            stream->open(paths_[index].c_str());
+            const char *p = stream->buf();
+            const char *endp = p + stream->size();
+            size_t n = std::max((size_t) 1, stream->size() / kChunkSize);
+
+            std::vector<ParallelReader::Scan> scans;
+            ParallelReader::slice(p, endp, n, scans);
+            for(auto &scan : scans) {
+                ParallelReader::scan(delimiter_, quotechar_, scan);
+            }
+            ParallelReader::cut(p, endp, scans, ranges);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        File &file = files_[index];
+        file.stream = stream;
+        file.ranges = ranges;
+        file.queues.resize(std::max((size_t) 1, ranges.size()));
+        file.unfinished = file.queues.size();
+        file.opened = true;
+        for(size_t i = 1; i < ranges.size(); i++) {
+            tasks_.push(Task { index, (int) i });
+            pending_++;
+        }
+        cond_.notify_all();
+    }
+
+    template<typename Fn>
+    void
+    parse(int index, int chunk, Fn fn)
+    {
+        File &file = files_[index];
+        if(file.ranges.empty()) {
+            return;
+        }
+
+        MemoryCursor cursor(file.ranges[chunk].p, file.ranges[chunk].endp);
+        CsvReader reader(cursor, delimiter_, quotechar_, 0,
+            yield_incomplete_row_ && (chunk == (int) file.ranges.size() - 1));
+        if(header_ && chunk == 0 && reader.read_row()) {
+            check_header(index, reader.row());
+        }
+        while(reader.read_row()) {
+            fn(reader.row());
+        }
+    }
+
+    void
+    start(bool ordered)
+    {
+        if(! header_read_) {
+            read_header();
+        }
+
+        files_.clear();
+        files_.resize(paths_.size());
+        tasks_ = std::priority_queue<Task>();
+        for(size_t i = 0; i < paths_.size(); i++) {
+            tasks_.push(Task { (int) i, 0 });
+        }
+        pending_ = paths_.size();
+        ordered_ = ordered;
+        last_file_ = ordered
+            ? (kMaxFilesAhead * std::max(1, threads_)) - 1
+            : std::numeric_limits<int>::max();
+        abort_ = false;
+        error_ = std::exception_ptr();
+    }
+
+    void
+    fail()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(! abort_) {
+            error_ = std::current_exception();
+            abort_ = true;
+        }
+        cond_.notify_all();
+    }
+
+    /**
+     * Run fn(file_index, chunk) for every task from each pool thread, until
+     * none remain or one fails.
+     */
+    template<typename Fn>
+    void
+    run_tasks(Fn fn)
+    {
+        ParallelReader::run(std::max(1, threads_), [&](size_t) {
+            for(;;) {
+                Task task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cond_.wait(lock, [&]() {
+                        return abort_ || !pending_ || (tasks_.size()
+                            && tasks_.top().file <= last_file_);
+                    });
+                    if(abort_ || !pending_) {
+                        return;
+                    }
+                    task = tasks_.top();
+                    tasks_.pop();
+                }
+
+                try {
+                    if(! task.chunk) {
+                        open(task.file);
+                    }
+                    fn(task.file, task.chunk);
+                } catch(...) {
+                    fail();
+                    return;
+                }
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                File &file = files_[task.file];
+                if(! --file.unfinished && !ordered_) {
+                    file.stream.reset();
+                }
+                if(! --pending_) {
+                    cond_.notify_all();
+                }
+            }
+        });
+    }
+
+    public:
+    // Files for_each_ordered() may parse ahead of the one being delivered,
+    // per thread.
+    static const int kMaxFilesAhead = 2;
+
+    DatasetReader(const std::vector<std::string> &paths,
+                  int threads=0,
+                  char delimiter=',',
+                  char quotechar='"',
+                  bool yield_incomplete_row=false,
+                  bool header=true)
+        : paths_(paths)
+        , threads_(threads ? threads : std::thread::hardware_concurrency())
+        , delimiter_(delimiter)
+        , quotechar_(quotechar)
+        , yield_incomplete_row_(yield_incomplete_row)
+        , header_(header)
+        , header_read_(false)
+        , header_file_(0)
+        , pending_(0)
+        , last_file_(0)
+        , ordered_(false)
+        , abort_(false)
+    {
+    }
+
+    /**
+     * Paths matching a shell wildcard pattern, sorted. No match is not an
+     * error.
+     */
+    static std::vector<std::string>
+    glob(const std::string &pattern)
+    {
+        glob_t matches;
+        int ret = ::glob(pattern.c_str(), 0, 0, &matches);
+        if(ret && ret != GLOB_NOMATCH) {
+            globfree(&matches);
+            throw Error(pattern.c_str(), "glob failed");
+        }
+
+        std::vector<std::string> paths;
+        for(size_t i = 0; !ret && i < matches.gl_pathc; i++) {
+            paths.push_back(matches.gl_pathv[i]);
+        }
+        globfree(&matches);
+        return paths;
+    }
+
+    const std::vector<std::string> &
+    paths()
+    {
+        return paths_;
+    }
+
+    /**
+     * Unescaped header cells, empty if the dataset has no header or every
+     * file is empty. Only the first non-empty file is read.
+     */
+    const std::vector<std::string> &
+    header()
+    {
+        if(! header_read_) {
+            read_header();
+        }
+        return header_row_;
+    }
+
+    /**
+     * Invoke fn(file_index, row) for every row, concurrently from the pool
+     * threads. Rows within a chunk arrive in file order, but files and chunks
+     * are interleaved. Any exception thrown by fn is rethrown.
+     */
+    template<typename Fn>
+    void
+    for_each(Fn fn)
+    {
+        start(false);
+        run_tasks([&](int index, int chunk) {
+            parse(index, chunk, [&](CsvCursor &row) {
+                fn(index, row);
+            });
+        });
+        if(error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+    /**
+     * Invoke fn(file_index, row) for every row, from the calling thread, in
+     * order of paths() and then of file position, while later chunks and
+     * files are parsed ahead by the pool. A file stays mapped until its last
+     * row has been delivered.
+     */
+    template<typename Fn>
+    void
+    for_each_ordered(Fn fn)
+    {
+        start(true);
+
+        auto push = [&](Queue &queue, Batch &batch) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [&]() {
+                return abort_
+                    || queue.batches.size() < ParallelReader::kMaxQueuedBatches;
+            });
+            if(abort_) {
+                throw Error("DatasetReader", "aborted");
+            }
+            queue.batches.emplace_back(std::move(batch));
+            batch = Batch();
+            cond_.notify_all();
+        };
+
+        auto produce = [&](int index, int chunk) {
+            Queue &queue = files_[index].queues[chunk];
+            Batch batch;
+            try {
+                parse(index, chunk, [&](CsvCursor &row) {
+                    batch.cells.insert(batch.cells.end(),
+                        row.cells.begin(), row.cells.begin() + row.count);
+                    batch.counts.push_back(row.count);
+                    if(batch.counts.size() == ParallelReader::kBatchRows) {
+                        push(queue, batch);
+                    }
+                });
+                if(batch.counts.size()) {
+                    push(queue, batch);
+                }
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queue.done = true;
+                cond_.notify_all();
+                throw;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue.done = true;
+            cond_.notify_all();
+        };
+
+        std::thread producer([&]() {
+            run_tasks(produce);
+        });
+
+        CsvCursor row;
+        try {
+            for(size_t index = 0; index < files_.size(); index++) {
+                File &file = files_[index];
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cond_.wait(lock, [&]() {
+                        return abort_ || file.opened;
+                    });
+                    if(abort_) {
+                        break;
+                    }
+                }
+
+                for(auto &queue : file.queues) {
+                    for(;;) {
+                        Batch batch;
+                        {
+                            std::unique_lock<std::mutex> lock(mutex_);
+                            cond_.wait(lock, [&]() {
+                                return abort_ || queue.done
+                                    || queue.batches.size();
+                            });
+                            if(abort_ || queue.batches.empty()) {
+                                break;
+                            }
+                            batch = std::move(queue.batches.front());
+                            queue.batches.pop_front();
+                            cond_.notify_all();
+                        }
+
+                        const CsvCell *cell = batch.cells.data();
+                        for(int count : batch.counts) {
+                            if((size_t) count > row.cells.size()) {
+                                row.cells.resize(count);
+                            }
+                            std::copy(cell, cell + count, row.cells.begin());
+                            row.count = count;
+                            cell += count;
+                            fn((int) index, row);
+                        }
+                    }
+                }
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                file.stream.reset();
+                last_file_ = (int) index
+                    + (kMaxFilesAhead * std::max(1, threads_));
+                cond_.notify_all();
+            }
+        } catch(...) {
+            fail();
+            producer.join();
+            throw;
+        }
+
+        producer.join();
+        if(error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+};
+
+
+/**
+ * Aggregates computed per group by Aggregator. Count with column -1 counts
+ * rows, otherwise rows whose cell is not empty. Sum, min and max parse cells
+ * like as_double() and ignore empty ones; min and max are NaN for a group
+ * with no values.
+ */
+enum CsmAggregateType {
+    kCsmAggregateCount,
+    kCsmAggregateSum,
+    kCsmAggregateMin,
+    kCsmAggregateMax
+};
+
+
+/**
+ * Streaming group-by over rows from a CsvReader or ParallelReader. Groups are
+ * held in an open-addressing table keyed by a hash of the key cells' bytes.
+ * A key is only copied, into a single arena, when its group is first seen,
+ * as a sequence of length-prefixed cells. Results are doubles, one per
+ * aggregate for every group, in order of first appearance.
+ */
+class Aggregator
+{
+    struct Aggregate
+    {
+        CsmAggregateType type;
+        int column;
+    };
+
+    struct Slot
+    {
+        uint64_t hash;
+        size_t group;
+    };
+
+    struct Part
+    {
+        const char *ptr;
+        size_t size;
+    };
+
+    static const size_t kEmpty = ~(size_t) 0;
+
+    std::vector<int> keys_;
+    std::vector<Aggregate> aggregates_;
+    char escapechar_;
+    char quotechar_;
+
+    std::vector<Slot> slots_;
+    std::vector<char> arena_;
+    std::vector<size_t> key_offsets_;
+    std::vector<double> values_;
+
+    // Scratch for the current row's key cells, and unescaped copies of them.
+    std::vector<Part> parts_;
+    UnescapeArena unescaped_;
+
+    /**
+     * Return the key of group as stored in the arena, and its size.
+     */
+    const char *
+    encoded_key(size_t group, size_t &size) const
+    {
+        size_t offset = key_offsets_[group];
+        size = ((group + 1 < key_offsets_.size())
+            ? key_offsets_[group + 1]
+            : arena_.size()) - offset;
+        return arena_.data() + offset;
+    }
+
+    bool
+    key_matches(size_t group, const Part *parts, size_t count) const
+    {
+        size_t size;
+        const char *p = encoded_key(group, size);
+        const char *endp = p + size;
+        for(size_t i = 0; i < count; i++) {
+            uint32_t len;
+            memcpy(&len, p, sizeof len);
+            p += sizeof len;
+            if(len != parts[i].size || memcmp(p, parts[i].ptr, len)) {
+                return false;
+            }
+            p += len;
+        }
+        return p == endp;
+    }
+
+    void
+    grow()
+    {
+        std::vector<Slot> slots(std::max((size_t) 64, slots_.size() * 2),
+                                Slot { 0, kEmpty });
+        size_t mask = slots.size() - 1;
+        for(const Slot &slot : slots_) {
+            if(slot.group != kEmpty) {
+                size_t i = slot.hash & mask;
+                while(slots[i].group != kEmpty) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = slot;
+            }
+        }
+        slots_.swap(slots);
+    }
+
+    /**
+     * Return the group for the key made of parts, adding it if it is new.
+     */
+    size_t
+    find_group(const Part *parts, size_t count, uint64_t hash)
+    {
+        if(2 * (key_offsets_.size() + 1) > slots_.size()) {
+            grow();
+        }
+
+        size_t mask = slots_.size() - 1;
+        size_t i = hash & mask;
+        for(; slots_[i].group != kEmpty; i = (i + 1) & mask) {
+            if(slots_[i].hash == hash
+                    && key_matches(slots_[i].group, parts, count)) {
+                return slots_[i].group;
+            }
+        }
+
+        size_t group = key_offsets_.size();
+        slots_[i] = Slot { hash, group };
+        key_offsets_.push_back(arena_.size());
+        for(size_t k = 0; k < count; k++) {
+            uint32_t len = (uint32_t) parts[k].size;
+            const char *lenp = (const char *) &len;
+            arena_.insert(arena_.end(), lenp, lenp + sizeof len);
+            arena_.insert(arena_.end(), parts[k].ptr, parts[k].ptr + len);
+        }
+
+        for(const Aggregate &aggregate : aggregates_) {
+            bool extremum = aggregate.type == kCsmAggregateMin
+                         || aggregate.type == kCsmAggregateMax;
+            values_.push_back(extremum ? NAN : 0);
+        }
+        return group;
+    }
+
+    static void
+    combine(CsmAggregateType type, double &value, double v)
+    {
+        switch(type) {
+        case kCsmAggregateCount:
+        case kCsmAggregateSum:
+            value += v;
+            break;
+        case kCsmAggregateMin:
+            if(std::isnan(value) || v < value) {
+                value = v;
+            }
+            break;
+        case kCsmAggregateMax:
+            if(std::isnan(value) || v > value) {
+                value = v;
+            }
+            break;
+        }
+    }
+
+    public:
+    /**
+     * Group by the given zero-based columns of each row, unescaping escaped
+     * key and value cells using escapechar and quotechar.
+     */
+    Aggregator(const std::vector<int> &keys,
+               char escapechar=0,
+               char quotechar='"')
+        : keys_(keys)
+        , escapechar_(escapechar)
+        , quotechar_(quotechar)
+        , parts_(keys.size())
+    {
+        for(int col : keys) {
+            if(col < 0) {
+                throw Error("Aggregator", "negative column index");
+            }
+        }
+    }
+
+    /**
+     * Compute an aggregate of column for every group, returning its index
+     * within values(). Aggregates must be added before any row.
+     */
+    size_t
+    add_aggregate(CsmAggregateType type, int column=-1)
+    {
+        if(column < 0 && type != kCsmAggregateCount) {
+            throw Error("Aggregator", "aggregate requires a column");
+        } else if(! key_offsets_.empty()) {
+            throw Error("Aggregator", "aggregate added after rows");
+        }
+        aggregates_.push_back(Aggregate { type, column });
+        return aggregates_.size() - 1;
+    }
+
+    /**
+     * Return an empty Aggregator computing the same aggregates.
+     */
+    Aggregator
+    empty_copy() const
+    {
+        Aggregator copy(keys_, escapechar_, quotechar_);
+        copy.aggregates_ = aggregates_;
+        return copy;
+    }
+
+    void
+    add_row(CsvCursor &row)
+    {
+        uint64_t hash = 0;
+        unescaped_.reset();
+        for(size_t k = 0; k < keys_.size(); k++) {
+            Part &part = parts_[k];
+            part.ptr = "";
+            part.size = 0;
+            if(keys_[k] < row.count) {
+                CsvCell cell = unescaped_.decode(row.cells[keys_[k]],
+                                                 escapechar_, quotechar_);
+                if(cell.size) {
+                    part.ptr = cell.ptr;
+                    part.size = cell.size;
+                }
+            }
+            hash = hash_bytes(part.ptr, part.size, hash);
+        }
+
+        size_t group = find_group(parts_.data(), parts_.size(), hash);
+        double *values = &values_[group * aggregates_.size()];
+        for(size_t a = 0; a < aggregates_.size(); a++) {
+            const Aggregate &aggregate = aggregates_[a];
+            if(aggregate.column < 0) {
+                values[a] += 1;
+                continue;
+            } else if(aggregate.column >= row.count) {
+                continue;
+            }
+
+            CsvCell &cell = row.cells[aggregate.column];
+            if(! cell.size) {
+                continue;
+            } else if(aggregate.type == kCsmAggregateCount) {
+                values[a] += 1;
+            } else if(cell.escaped) {
+                CsvCell value = unescaped_.decode(cell, escapechar_,
+                                                  quotechar_);
+                combine(aggregate.type, values[a],
+                        parse_double(value.ptr, value.size));
+            } else {
+                combine(aggregate.type, values[a],
+                        parse_double(cell.ptr, cell.size));
+            }
+        }
+    }
+
+    /**
+     * Aggregate every remaining row of reader.
+     */
+    void
+    add_rows(CsvReader &reader)
+    {
+        while(reader.read_row()) {
+            add_row(reader.row());
+        }
+    }
+
+    /**
+     * Aggregate every row of reader, with one table per range that is
+     * merged into this one once all ranges are parsed.
+     */
+    void
+    add_rows(ParallelReader &reader)
+    {
+        std::vector<Aggregator> locals(reader.max_ranges(), empty_copy());
+        reader.for_each([&](int i, CsvCursor &row) {
+            locals[i].add_row(row);
+        });
+        for(const Aggregator &local : locals) {
+            merge(local);
+        }
+    }
+
+    /**
+     * Fold the groups of other, which must compute the same aggregates,
+     * into this one.
+     */
+    void
+    merge(const Aggregator &other)
+    {
+        std::vector<Part> parts(keys_.size());
+        for(size_t group = 0; group < other.size(); group++) {
+            size_t size;
+            const char *p = other.encoded_key(group, size);
+            uint64_t hash = 0;
+            for(Part &part : parts) {
+                uint32_t len;
+                memcpy(&len, p, sizeof len);
+                part.ptr = p + sizeof len;
+                part.size = len;
+                p = part.ptr + len;
+                hash = hash_bytes(part.ptr, part.size, hash);
+            }
+
+            size_t mine = find_group(parts.data(), parts.size(), hash);
+            const double *values = other.values(group);
+            for(size_t a = 0; a < aggregates_.size(); a++) {
+                if(! std::isnan(values[a])) {
+                    combine(aggregates_[a].type,
+                            values_[mine * aggregates_.size() + a],
+                            values[a]);
+                }
+            }
+        }
+    }
+
+    /**
+     * Number of groups.
+     */
+    size_t
+    size() const
+    {
+        return key_offsets_.size();
+    }
+
+    /**
+     * Number of aggregates, and their types in order.
+     */
+    size_t
+    aggregates() const
+    {
+        return aggregates_.size();
+    }
+
+    CsmAggregateType
+    type(size_t aggregate) const
+    {
+        return aggregates_[aggregate].type;
+    }
+
+    /**
+     * Return the key cells of group.
+     */
+    std::vector<std::string>
+    key(size_t group) const
+    {
+        std::vector<std::string> out;
+        size_t size;
+        const char *p = encoded_key(group, size);
+        const char *endp = p + size;
+        while(p < endp) {
+            uint32_t len;
+            memcpy(&len, p, sizeof len);
+            out.push_back(std::string(p + sizeof len, len));
+            p += sizeof len + len;
+        }
+        return out;
+    }
+
+    /**
+     * Return the aggregates of group, in the order they were added.
+     */
+    const double *
+    values(size_t group) const
+    {
+        return &values_[group * aggregates_.size()];
+    }
+};
+
+
+/**
+ * Write every byte of the iovcnt buffers to fd, or throw Error.
+ */
+static inline void
+writev_all(int fd, const struct iovec *iov, int iovcnt)
+{
+    std::vector<struct iovec> vec(iov, iov + iovcnt);
+    struct iovec *v = vec.data();
+    while(iovcnt) {
+        ssize_t rc = ::writev(fd, v, std::min(iovcnt, IOV_MAX));
+        if(rc == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            throw Error("writev", strerror(errno));
+        }
+        for(; iovcnt && (size_t) rc >= v->iov_len; v++, iovcnt--) {
+            rc -= v->iov_len;
+        }
+        if(iovcnt) {
+            v->iov_base = (char *) v->iov_base + rc;
+            v->iov_len -= rc;
+        }
+    }
+}
+
+
+/**
+ * Buffered CSV output, quoting like Python's csv.QUOTE_MINIMAL: fields
+ * containing the delimiter, quotechar, CR or LF are quoted with quotechars
+ * doubled, and the rest are copied verbatim. Subclasses implement writeout()
+ * to deliver buffered output to their sink.
+ */
+class CsvWriter
+{
+#ifdef CSM_USE_SSE42
+    typedef ClassifierSse2 Classifier;
+#else
+    typedef ClassifierFallback Classifier;
+#endif
+
+    std::vector<char> vec_;
+    size_t pos_;
+    char delimiter_;
+    char quotechar_;
+    std::string lineterminator_;
+    bool quote_all_;
+    Classifier classifier_;
+    // Fields written to the current row, and whether the last was empty.
+    int fields_;
+    bool last_empty_;
+
+    protected:
+    /**
+     * Write every byte of the iovcnt buffers, or throw Error.
+     */
+    virtual void writeout(const struct iovec *iov, int iovcnt) = 0;
+
+    private:
+    bool
+    needs_quoting(const char *p, size_t size)
+    {
+        uint64_t quote, delimiter, newline;
+        size_t i = 0;
+        for(; (i + 64) <= size; i += 64) {
+            classifier_(p + i, quote, delimiter, newline);
+            if(quote | delimiter | newline) {
+                return true;
+            }
+        }
+        if(i < size) {
+            char tail[64];
+            memset(tail, 0, sizeof tail);
+            memcpy(tail, p + i, size - i);
+            classifier_(tail, quote, delimiter, newline);
+            return (quote | delimiter | newline) != 0;
+        }
+        return false;
+    }
+
+    /**
+     * Append bytes to the buffer, writing them alongside the buffer contents
+     * when they do not fit.
+     */
+    void
+    append(const char *p, size_t size)
+    {
+        if(size > (vec_.size() - pos_)) {
+            struct iovec iov[2] = {
+                {&vec_[0], pos_},
+                {(void *) p, size}
+            };
+            writeout(iov, 2);
+            pos_ = 0;
+            return;
+        }
+        memcpy(&vec_[pos_], p, size);
+        pos_ += size;
+    }
+
+    void
+    put(char c)
+    {
+        if(pos_ == vec_.size()) {
+            flush();
+        }
+        vec_[pos_++] = c;
+    }
+
+    void
+    begin_field(size_t size)
+    {
+        if(fields_++) {
+            put(delimiter_);
+        }
+        last_empty_ = !size && !quote_all_;
+    }
+
+    public:
+    /**
+     * Fields are quoted like Python's csv.QUOTE_MINIMAL, or if quote_all is
+     * set, like csv.QUOTE_ALL.
+     */
+    CsvWriter(char delimiter=',',
+              char quotechar='"',
+              const std::string &lineterminator="\r\n",
+              bool quote_all=false,
+              size_t buffer_size=1048576)
+        : vec_(std::max(buffer_size, (size_t) 64))
+        , pos_(0)
+        , delimiter_(delimiter)
+        , quotechar_(quotechar)
+        , lineterminator_(lineterminator)
+        , quote_all_(quote_all)
+        , classifier_(delimiter, quotechar)
+        , fields_(0)
+        , last_empty_(false)
+    {
+    }
+
+    virtual ~CsvWriter()
+    {
+    }
+
+    void
+    write_cell(const char *p, size_t size)
+    {
+        begin_field(size);
+        if(! (quote_all_ || needs_quoting(p, size))) {
+            append(p, size);
+            return;
+        }
+
+        const char *endp = p + size;
+        put(quotechar_);
+        while(p < endp) {
+            auto q = (const char *) memchr(p, quotechar_, endp - p);
+            if(! q) {
+                append(p, endp - p);
+                break;
+            }
+            append(p, (q + 1) - p);
+            put(quotechar_);
+            p = q + 1;
+        }
+        put(quotechar_);
+    }
+
+    void
+    write_cell(const std::string &s)
+    {
+        write_cell(s.data(), s.size());
+    }
+
+    /**
+     * Write a cell produced by a reader using escapechar and quotechar, which
+     * defaults to the writer's. Escaped cells from a reader without an
+     * escapechar already have doubled quotes, so are copied without decoding.
+     */
+    void
+    write_cell(const CsvCell &cell, char escapechar=0, char quotechar=0)
+    {
+        if(! quotechar) {
+            quotechar = quotechar_;
+        }
+        if(! cell.escaped) {
+            write_cell(cell.ptr, cell.size);
+        } else if(escapechar || quotechar != quotechar_) {
+            write_cell(CsvCell(cell).as_str(escapechar, quotechar));
+        } else {
+            begin_field(cell.size);
+            put(quotechar_);
+            append(cell.ptr, cell.size);
+            put(quotechar_);
+        }
+    }
+
+    void
+    write_row(const CsvCursor &row, char escapechar=0, char quotechar=0)
+    {
+        for(int i = 0; i < row.count; i++) {
+            write_cell(row.cells[i], escapechar, quotechar);
+        }
+        end_row();
+    }
+
+    /**
+     * Append bytes verbatim, such as a whole row from CsvReader::row_data()
+     * to be followed by end_row().
+     */
+    void
+    write_raw(const char *p, size_t size)
+    {
+        append(p, size);
+        fields_ = 0;
+    }
+
+    void
+    end_row()
+    {
+        // As with Python, a lone empty field is quoted so the row is not
+        // read back as a blank line.
+        if(fields_ == 1 && last_empty_) {
+            put(quotechar_);
+            put(quotechar_);
+        }
+        append(lineterminator_.data(), lineterminator_.size());
+        fields_ = 0;
+    }
+
+    void
+    flush()
+    {
+        if(pos_) {
+            struct iovec iov = {&vec_[0], pos_};
+            pos_ = 0;
+            writeout(&iov, 1);
+        }
+    }
+};
+
+
+class FdCsvWriter
+    : public CsvWriter
+{
+    int fd_;
+
+    protected:
+    virtual void
+    writeout(const struct iovec *iov, int iovcnt)
+    {
+        writev_all(fd_, iov, iovcnt);
+    }
+
+    public:
+    FdCsvWriter(int fd,
+                char delimiter=',',
+                char quotechar='"',
+                const std::string &lineterminator="\r\n",
+                bool quote_all=false)
+        : CsvWriter(delimiter, quotechar, lineterminator, quote_all)
+        , fd_(fd)
+    {
+    }
+
+    ~FdCsvWriter()
+    {
+        try {
+            flush();
+        } catch(Error &e) {
+            CSM_DEBUG("flush failed: %s", e.what());
+        }
+    }
+};
+
+
+/**
+ * Days since 1970-01-01 of a proleptic Gregorian date.
+ */
+static inline int32_t
+days_from_civil(int year, int month, int day)
+{
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yoe = (unsigned) (year - (era * 400));
+    unsigned doy = ((153 * (month + (month > 2 ? -3 : 9))) + 2) / 5 + day - 1;
+    unsigned doe = (yoe * 365) + (yoe / 4) - (yoe / 100) + doy;
+    return (era * 146097) + (int) doe - 719468;
+}
+
+
+/**
+ * Minimal FlatBuffers encoder, enough for Arrow IPC metadata. Unlike the
+ * reference builder, objects are written front to back: a table or vector of
+ * offsets reserves its offset fields, which link() fills in once the object
+ * they refer to has been written after them, so that every offset points
+ * forward as the format requires. Scalars are stored little-endian.
+ */
+class FlatBuilder
+{
+    std::vector<char> buf_;
+
+    /**
+     * Pad until size() + skew is a multiple of n.
+     */
+    void
+    align(size_t n, size_t skew=0)
+    {
+        buf_.resize(buf_.size() + ((n - ((buf_.size() + skew) % n)) % n), 0);
+    }
+
+    public:
+    /**
+     * A table field: a scalar of size bytes, or if offset is set, a 4 byte
+     * offset to be filled in by link().
+     */
+    struct Field
+    {
+        int id;
+        int size;
+        uint64_t value;
+        bool offset;
+    };
+
+    FlatBuilder()
+        : buf_(4, 0)
+    {
+    }
+
+    template<typename T>
+    void
+    set(size_t pos, T value)
+    {
+        memcpy(&buf_[pos], &value, sizeof value);
+    }
+
+    /**
+     * Point the offset at pos, or the root offset if pos is 0, to target.
+     */
+    void
+    link(size_t pos, size_t target)
+    {
+        set<uint32_t>(pos, (uint32_t) (target - pos));
+    }
+
+    /**
+     * Write a table, returning its position. Fields must be in decreasing
+     * order of size, so that each is naturally aligned. The position of each
+     * offset field is stored to slots, in order.
+     */
+    size_t
+    table(std::initializer_list<Field> fields, size_t *slots=0)
+    {
+        int ids = 0;
+        size_t size = 4;
+        bool wide = false;
+        for(const Field &field : fields) {
+            ids = std::max(ids, field.id + 1);
+            size += field.size;
+            wide |= field.size == 8;
+        }
+
+        align(2);
+        size_t vtable = buf_.size();
+        buf_.resize(vtable + 4 + (2 * ids), 0);
+        // The vtable offset precedes the fields, so 8 byte fields need the
+        // table to start 4 bytes past an 8 byte boundary.
+        align(wide ? 8 : 4, wide ? 4 : 0);
+        size_t start = buf_.size();
+        buf_.resize(start + size, 0);
+        set<int32_t>(start, (int32_t) (start - vtable));
+        set<uint16_t>(vtable, (uint16_t) (4 + (2 * ids)));
+        set<uint16_t>(vtable + 2, (uint16_t) size);
+
+        size_t pos = start + 4;
+        for(const Field &field : fields) {
+            set<uint16_t>(vtable + 4 + (2 * field.id),
+                          (uint16_t) (pos - start));
+            if(field.offset) {
+                *slots++ = pos;
+            } else {
+                memcpy(&buf_[pos], &field.value, field.size);
+            }
+            pos += field.size;
+        }
+        return start;
+    }
+
+    /**
+     * Write a vector of count elements of size bytes, returning its position.
+     * Element i starts at the position plus 4 + (i * size).
+     */
+    size_t
+    vector(size_t count, size_t size)
+    {
+        align(std::max(size, (size_t) 4), 4);
+        size_t start = buf_.size();
+        buf_.resize(start + 4 + (count * size), 0);
+        set<uint32_t>(start, (uint32_t) count);
+        return start;
+    }
+
+    size_t
+    string(const std::string &s)
+    {
+        size_t start = vector(s.size() + 1, 1);
+        memcpy(&buf_[start + 4], s.data(), s.size());
+        set<uint32_t>(start, (uint32_t) s.size());
+        return start;
+    }
+
+    /**
+     * Pad the buffer to a multiple of 8 bytes and return it.
+     */
+    const std::vector<char> &
+    finish()
+    {
+        align(8);
+        return buf_;
+    }
+};
+
+
+/**
+ * Rows converted to the Arrow columnar format: for each column, a validity
+ * bitmap and values buffer, plus an offsets buffer for strings. String
+ * columns are utf8 of the unescaped cells. Int, float, bool and date columns
+ * are int64, float64, bool and date32, parsed like TypeInference; their empty
+ * cells are null, and a cell that does not parse throws Error naming its row
+ * and column. Missing trailing cells are null in every column, and cells
+ * beyond the last column are ignored. Rows are appended a CsvBatch at a time
+ * and converted column by column.
+ */
+class ArrowBatch
+{
+    public:
+    struct Column
+    {
+        CsmValueType type;
+        std::vector<uint8_t> validity;
+        // Fixed width values, a bitmap for bool, or utf8 bytes.
+        std::vector<char> values;
+        std::vector<int32_t> offsets;
+        size_t nulls;
+    };
+
+    private:
+    std::vector<Column> columns_;
+    size_t rows_;
+    size_t bytes_;
+    // Rows appended before the current append(), which may since have been
+    // cleared, for numbering rows in errors.
+    size_t appended_;
+    char escapechar_;
+    char quotechar_;
+
+    /**
+     * Throw Error for cell, at row of column col, not parsing as its type.
+     */
+    void
+    unparsed(size_t row, size_t col, const CsvCell &cell) const
+    {
+        static const char *const kTypeNames[] = {
+            "string", "int", "float", "bool", "date"
+        };
+        std::string value(cell.ptr, std::min(cell.size, (size_t) 40));
+        throw Error("ArrowBatch",
+            "row " + std::to_string(appended_ + (row - rows_))
+            + ", column " + std::to_string(col) + ": \"" + value
+            + "\" is not a valid " + kTypeNames[columns_[col].type]);
+    }
+
+    /**
+     * Append column col of batch to column. For every row, convert(row, cell,
+     * missing) stores the cell's value, or space for a null if missing is set
+     * or the cell is empty, and returns true if the value is valid.
+     */
+    template<typename Convert>
+    void
+    append_column(Column &column, const CsvBatch &batch, size_t col,
+                  Convert convert)
+    {
+        static const CsvCell kEmpty = { "", 0, false };
+        column.validity.resize((rows_ + batch.rows + 7) / 8, 0);
+        bool present = col < batch.columns.size();
+        for(size_t i = 0; i < batch.rows; i++) {
+            size_t row = rows_ + i;
+            bool missing = !(present && (int) col < batch.counts[i]);
+            bool valid = convert(row, missing ? kEmpty : batch.cell(i, col),
+                                 missing);
+            column.validity[row / 8] |= (uint8_t) (valid << (row % 8));
+            column.nulls += !valid;
+        }
+    }
+
+    template<typename T, typename Parse>
+    void
+    append_fixed(Column &column, const CsvBatch &batch, size_t col,
+                 Parse parse)
+    {
+        size_t pos = column.values.size();
+        column.values.resize(pos + (batch.rows * sizeof(T)));
+        T *out = (T *) &column.values[pos];
+        append_column(column, batch, col,
+            [&](size_t row, const CsvCell &cell, bool missing) {
+                T value = 0;
+                bool valid = !missing && cell.size;
+                if(valid && !parse(cell, value)) {
+                    unparsed(row, col, cell);
+                }
+                *out++ = value;
+                return valid;
+            });
+    }
+
+    void
+    append_strings(Column &column, const CsvBatch &batch, size_t col)
+    {
+        // Escaped cells only shrink, so the raw sizes bound the bytes needed.
+        size_t size = 0;
+        if(col < batch.columns.size()) {
+            const auto &sizes = batch.columns[col].sizes;
+            for(size_t i = 0; i < batch.rows; i++) {
+                size += sizes[i];
+            }
+        }
+        std::vector<char> &values = column.values;
+        size_t start = values.size();
+        // Offsets are 32 bit, and export_arrow() only checks the total
+        // between chunks.
+        if(start + size > (size_t) INT32_MAX) {
+            throw Error("ArrowBatch",
+                "column " + std::to_string(col)
+                + ": string data exceeds 2GiB in one batch");
+        }
+        values.resize(start + size);
+        char *out = &values[start];
+        column.offsets.resize(rows_ + batch.rows + 1);
+        int32_t *offsets = &column.offsets[rows_ + 1];
+
+        append_column(column, batch, col,
+            [&](size_t, const CsvCell &cell, bool missing) {
+                if(cell.escaped) {
+                    out += unescape(cell.ptr, cell.size, out, escapechar_,
+                                    quotechar_);
+                } else {
+                    memcpy(out, cell.ptr, cell.size);
+                    out += cell.size;
+                }
+                *offsets++ = (int32_t) (out - &values[0]);
+                return !missing;
+            });
+        values.resize(out - &values[0]);
+        bytes_ += values.size() - start;
+    }
+
+    void
+    append_bools(Column &column, const CsvBatch &batch, size_t col)
+    {
+        column.values.resize((rows_ + batch.rows + 7) / 8, 0);
+        append_column(column, batch, col,
+            [&](size_t row, const CsvCell &cell, bool missing) {
+                bool value = false;
+                bool valid = !missing && cell.size;
+                if(valid && !parse_bool(cell.ptr, cell.size, value)) {
+                    unparsed(row, col, cell);
+                }
+                column.values[row / 8] |= (char) (value << (row % 8));
+                return valid;
+            });
+    }
+
+    public:
+    explicit ArrowBatch(const std::vector<CsmValueType> &types,
+                        char escapechar=0, char quotechar='"')
+        : columns_(types.size())
+        , rows_(0)
+        , bytes_(0)
+        , appended_(0)
+        , escapechar_(escapechar)
+        , quotechar_(quotechar)
+    {
+        for(size_t i = 0; i < types.size(); i++) {
+            columns_[i].type = types[i];
+        }
+        clear();
+    }
+
+    const std::vector<Column> &
+    columns() const
+    {
+        return columns_;
+    }
+
+    size_t
+    rows() const
+    {
+        return rows_;
+    }
+
+    /**
+     * Return the bytes of string data, which must stay below 2GiB as Arrow's
+     * utf8 offsets are 32 bits.
+     */
+    size_t
+    string_bytes() const
+    {
+        return bytes_;
+    }
+
+    /**
+     * Empty the batch, keeping its storage.
+     */
+    void
+    clear()
+    {
+        for(auto &column : columns_) {
+            column.validity.clear();
+            column.values.clear();
+            column.offsets.assign(1, 0);
+            column.nulls = 0;
+        }
+        rows_ = 0;
+        bytes_ = 0;
+    }
+
+    /**
+     * Exchange rows and storage with other, which must have the same types.
+     */
+    void
+    swap(ArrowBatch &other)
+    {
+        columns_.swap(other.columns_);
+        std::swap(rows_, other.rows_);
+        std::swap(bytes_, other.bytes_);
+    }
+
+    void
+    append(const CsvBatch &batch)
+    {
+        for(size_t col = 0; col < columns_.size(); col++) {
+            Column &column = columns_[col];
+            switch(column.type) {
+            case kCsmValueInt:
+                append_fixed<int64_t>(column, batch, col,
+                    [](const CsvCell &cell, int64_t &out) {
+                        return parse_exact_int64(cell.ptr, cell.size, out);
+                    });
+                break;
+            case kCsmValueFloat:
+                append_fixed<double>(column, batch, col,
+                    [](const CsvCell &cell, double &out) {
+                        return parse_exact_double(cell.ptr, cell.size, out);
+                    });
+                break;
+            case kCsmValueDate:
+                append_fixed<int32_t>(column, batch, col,
+                    [](const CsvCell &cell, int32_t &out) {
+                        int year, month, day;
+                        if(! parse_date(cell.ptr, cell.size, year, month,
+                                        day)) {
+                            return false;
+                        }
+                        out = days_from_civil(year, month, day);
+                        return true;
+                    });
+                break;
+            case kCsmValueBool:
+                append_bools(column, batch, col);
+                break;
+            default:
+                append_strings(column, batch, col);
+                break;
+            }
+        }
+        rows_ += batch.rows;
+        appended_ += batch.rows;
+    }
+};
+
+
+/**
+ * Write ArrowBatches to fd as an Arrow IPC stream, which pyarrow and other
+ * Arrow implementations read with their stream readers, and can convert to
+ * Parquet. Batches are encoded and written by a background thread while the
+ * caller parses the next one, so a single batch is buffered at a time.
+ * Columns are named by names and typed by types, which batches must share.
+ * Errors from the background thread are thrown by the following write() or
+ * close().
+ */
+class ArrowStreamWriter
+{
+    enum {
+        kTypeInt = 2,
+        kTypeFloatingPoint = 3,
+        kTypeUtf8 = 5,
+        kTypeBool = 6,
+        kTypeDate = 8
+    };
+    enum { kHeaderSchema = 1, kHeaderRecordBatch = 3 };
+    enum { kMetadataV5 = 4 };
+
+    int fd_;
+    std::vector<std::string> names_;
+    std::vector<CsmValueType> types_;
+    // Batch being written by the background thread while busy_ is set.
+    ArrowBatch pending_;
+    bool busy_;
+    bool stop_;
+    std::string error_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+
+    /**
+     * Write one encapsulated message: the continuation marker, the metadata
+     * length and metadata padded to 8 bytes, then the body buffers.
+     */
+    void
+    write_message(const std::vector<char> &metadata,
+                  std::vector<struct iovec> &body)
+    {
+        int32_t header[2] = { -1, (int32_t) metadata.size() };
+        body.insert(body.begin(), {
+            { header, sizeof header },
+            { (void *) metadata.data(), metadata.size() }
+        });
+        writev_all(fd_, body.data(), (int) body.size());
+    }
+
+    void
+    write_schema()
+    {
+        FlatBuilder fb;
+        size_t slot;
+        size_t message = fb.table({
+            {3, 8, 0, false},
+            {2, 4, 0, true},
+            {0, 2, kMetadataV5, false},
+            {1, 1, kHeaderSchema, false}
+        }, &slot);
+        fb.link(0, message);
+
+        size_t fields_slot;
+        size_t schema = fb.table({{1, 4, 0, true}, {0, 2, 0, false}},
+                                 &fields_slot);
+        fb.link(slot, schema);
+        size_t fields = fb.vector(names_.size(), 4);
+        fb.link(fields_slot, fields);
+
+        for(size_t i = 0; i < names_.size(); i++) {
+            static const uint64_t kTypeIds[] = {
+                kTypeUtf8, kTypeInt, kTypeFloatingPoint, kTypeBool, kTypeDate
+            };
+            size_t slots[3];
+            size_t field = fb.table({
+                {0, 4, 0, true},
+                {3, 4, 0, true},
+                {5, 4, 0, true},
+                {1, 1, 1, false},
+                {2, 1, kTypeIds[types_[i]], false}
+            }, slots);
+            fb.link(fields + 4 + (4 * i), field);
+            fb.link(slots[0], fb.string(names_[i]));
+
+            size_t type;
+            switch(types_[i]) {
+            case kCsmValueInt:
+                type = fb.table({{0, 4, 64, false}, {1, 1, 1, false}});
+                break;
+            case kCsmValueFloat:
+                // Precision DOUBLE.
+                type = fb.table({{0, 2, 2, false}});
+                break;
+            case kCsmValueDate:
+                // DateUnit DAY, which is not the default.
+                type = fb.table({{0, 2, 0, false}});
+                break;
+            default:
+                type = fb.table({});
+                break;
+            }
+            fb.link(slots[1], type);
+            // Readers require the children vector even when it is empty.
+            fb.link(slots[2], fb.vector(0, 4));
+        }
+
+        std::vector<struct iovec> body;
+        write_message(fb.finish(), body);
+    }
+
+    void
+    write_batch(const ArrowBatch &batch)
+    {
+        static const char kZeros[8] = { 0 };
+        std::vector<struct iovec> body;
+        std::vector<std::pair<uint64_t, uint64_t>> buffers;
+        uint64_t length = 0;
+        auto add = [&](const void *p, size_t size) {
+            buffers.push_back(std::make_pair(length, (uint64_t) size));
+            if(size) {
+                body.push_back({ (void *) p, size });
+            }
+            if(size % 8) {
+                body.push_back({ (void *) kZeros, 8 - (size % 8) });
+            }
+            length += (size + 7) & ~(size_t) 7;
+        };
+
+        for(const auto &column : batch.columns()) {
+            add(column.validity.data(),
+                column.nulls ? column.validity.size() : 0);
+            if(column.type == kCsmValueString) {
+                add(column.offsets.data(), column.offsets.size() * 4);
+            }
+            add(column.values.data(), column.values.size());
+        }
+
+        FlatBuilder fb;
+        size_t slot;
+        size_t message = fb.table({
+            {3, 8, length, false},
+            {2, 4, 0, true},
+            {0, 2, kMetadataV5, false},
+            {1, 1, kHeaderRecordBatch, false}
+        }, &slot);
+        fb.link(0, message);
+
+        size_t slots[2];
+        size_t record_batch = fb.table({
+            {0, 8, batch.rows(), false},
+            {1, 4, 0, true},
+            {2, 4, 0, true}
+        }, slots);
+        fb.link(slot, record_batch);
+
+        const auto &columns = batch.columns();
+        size_t nodes = fb.vector(columns.size(), 16);
+        fb.link(slots[0], nodes);
+        for(size_t i = 0; i < columns.size(); i++) {
+            fb.set<int64_t>(nodes + 4 + (16 * i), batch.rows());
+            fb.set<int64_t>(nodes + 12 + (16 * i), columns[i].nulls);
+        }
+        size_t vec = fb.vector(buffers.size(), 16);
+        fb.link(slots[1], vec);
+        for(size_t i = 0; i < buffers.size(); i++) {
+            fb.set<int64_t>(vec + 4 + (16 * i), buffers[i].first);
+            fb.set<int64_t>(vec + 12 + (16 * i), buffers[i].second);
+        }
+
+        write_message(fb.finish(), body);
+    }
+
+    void
+    run()
+    {
+        for(;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [this] { return stop_ || busy_; });
+                if(! busy_) {
+                    return;
+                }
+            }
+
+            std::string error;
+            try {
+                write_batch(pending_);
+            } catch(Error &e) {
+                error = e.what();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(error_.empty()) {
+                error_ = error;
+            }
+            busy_ = false;
+            cond_.notify_all();
+        }
+    }
+
+    /**
+     * Wait for the background thread to finish the pending batch, and throw
+     * any error it saw.
+     */
+    void
+    wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return !busy_; });
+        if(! error_.empty()) {
+            throw Error("ArrowStreamWriter", error_);
+        }
+    }
+
+    public:
+    /**
+     * Write the schema of names and types to fd, which is not closed.
+     */
+    ArrowStreamWriter(int fd, const std::vector<std::string> &names,
+                      const std::vector<CsmValueType> &types)
+        : fd_(fd)
+        , names_(names)
+        , types_(types)
+        , pending_(types)
+        , busy_(false)
+        , stop_(false)
+    {
+        if(names.size() != types.size()) {
+            throw Error("ArrowStreamWriter", "names and types differ in size");
+        }
+        write_schema();
+    }
+
+    ~ArrowStreamWriter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+            cond_.notify_all();
+        }
+        if(thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    const std::vector<CsmValueType> &
+    types() const
+    {
+        return types_;
+    }
+
+    /**
+     * Queue batch to be written, taking its contents and leaving it empty,
+     * with buffers recycled from an earlier batch.
+     */
+    void
+    write(ArrowBatch &batch)
+    {
+        wait();
+        pending_.swap(batch);
+        batch.clear();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(! thread_.joinable()) {
+            thread_ = std::thread(&ArrowStreamWriter::run, this);
+        }
+        busy_ = true;
+        cond_.notify_all();
+    }
+
+    /**
+     * Wait for queued batches, then write the end-of-stream marker.
+     */
+    void
+    close()
+    {
+        wait();
+        static const int32_t kEndOfStream[2] = { -1, 0 };
+        struct iovec iov = { (void *) kEndOfStream, sizeof kEndOfStream };
+        writev_all(fd_, &iov, 1);
+    }
+};
+
+
+/**
+ * Convert the remaining rows of reader into batches of up to batch_rows rows,
+ * starting with any rows already in batch, and write them to writer, then
+ * close it. Returns the number of rows written.
+ */
+static inline size_t
+export_arrow(CsvReader &reader, ArrowStreamWriter &writer, ArrowBatch &batch,
+             size_t batch_rows=16384)
+{
+    // Rows parsed at a time, and headroom below the 2GiB limit of 32 bit
+    // string offsets.
+    static const size_t kChunkRows = 4096;
+    static const size_t kMaxStringBytes = 1UL << 30;
+
+    CsvBatch chunk;
+    size_t rows = 0;
+    batch_rows = std::max(batch_rows, (size_t) 1);
+    for(;;) {
+        if(batch.rows() >= batch_rows
+                || batch.string_bytes() >= kMaxStringBytes) {
+            rows += batch.rows();
+            writer.write(batch);
+        }
+        size_t want = std::min(kChunkRows, batch_rows - batch.rows());
+        if(! reader.read_batch(chunk, want)) {
+            break;
+        }
+        batch.append(chunk);
+    }
+    if(batch.rows()) {
+        rows += batch.rows();
+        writer.write(batch);
+    }
+    writer.close();
+    return rows;
+}
+
+
+static inline size_t
+export_arrow(CsvReader &reader, ArrowStreamWriter &writer,
+             size_t batch_rows=16384)
+{
+    ArrowBatch batch(writer.types(), reader.escapechar(), reader.quotechar());
+    return export_arrow(reader, writer, batch, batch_rows);
+}
+
 } // namespace csvmonkey
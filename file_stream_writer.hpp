@@ -0,0 +1,46 @@
+
+class FileStreamWriter
+    : public csvmonkey::CsvWriter
+{
+    PyObject *write_;
+
+    protected:
+    virtual void writeout(const struct iovec *iov, int iovcnt)
+    {
+        Py_ssize_t size = 0;
+        for(int i = 0; i < iovcnt; i++) {
+            size += iov[i].iov_len;
+        }
+
+        PyObject *s = PyString_FromStringAndSize(NULL, size);
+        if(! s) {
+            throw csvmonkey::Error("write", "out of memory");
+        }
+
+        char *p = PyString_AS_STRING(s);
+        for(int i = 0; i < iovcnt; i++) {
+            memcpy(p, iov[i].iov_base, iov[i].iov_len);
+            p += iov[i].iov_len;
+        }
+
+        PyObject *result = PyObject_CallFunctionObjArgs(write_, s, NULL);
+        Py_DECREF(s);
+        if(! result) {
+            throw csvmonkey::Error("write", "write() raised an exception");
+        }
+        Py_DECREF(result);
+    }
+
+    public:
+    FileStreamWriter(PyObject *write, char delimiter, char quotechar,
+                     const std::string &lineterminator, bool quote_all)
+        : CsvWriter(delimiter, quotechar, lineterminator, quote_all)
+        , write_(write)
+    {
+    }
+
+    ~FileStreamWriter()
+    {
+        Py_DECREF(write_);
+    }
+};
@@ -18,10 +18,12 @@ extra_compile_args = []
 extra_compile_args += ['-std=c++11']
 extra_compile_args += ['-O3']
 extra_compile_args += ['-w']
+extra_compile_args += ['-DCSM_USE_ZLIB']
 #extra_compile_args += ['-DUSE_SPIRIT']
 #extra_compile_args += ['-I/home/dmw/src/boost_1_64_0']
 #extra_compile_args += ['-fprofile-generate', '-lgcov']
 #extra_compile_args += ['-DCSVMONKEY_DEBUG']
+#extra_compile_args += ['-DCSM_STATS']
 
 
 if has_sse42():
@@ -42,6 +44,7 @@ setup(
             name='csvmonkey',
             sources=['csvmonkey.cpp'],
             extra_compile_args=extra_compile_args,
+            libraries=['z'],
         )
     ],
     zip_safe = False,
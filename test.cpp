@@ -8,9 +8,7 @@ using namespace csvmonkey;
 
 int main(int argc, char **argv)
 {
-    chdir("/Users/dmw/py-csvmonkey");
-
-    const char *filename = "ram.csv";
+    const char *filename = "profiledata.csv";
     if(argc > 1) {
         filename = argv[1];
     }
@@ -49,33 +47,17 @@ int main(int argc, char **argv)
 
     double total_cost = 0;
     auto start = std::chrono::high_resolution_clock::now();
-    int i = 0;
 
     while(reader.read_row()) {
-        //printf("%d\n", i++);
-        if(0 && rows++ >= 160075) {
-            for(int i = 0; i < row.count; i++) {
-                CsvCell &cell = row.cells[i];
-                printf("%d: %i: %.*s\n", rows, i, (int)cell.size, cell.ptr);
-            }
-        }
-        if(0 && (++i == 4)) {
-            break;
-        }
-
-        if(0) {
-            if(record_type_cell->equals("LineItem")) {
-                total_cost += cost_cell->as_double();
-            } else if(record_type_cell->equals("Rounding")) {
-                total_cost += cost_cell->as_double();
-            }
-        } else {
-            total_cost += 0.0;
+        rows++;
+        if(record_type_cell->equals("LineItem")
+                || record_type_cell->equals("Rounding")) {
+            total_cost += cost_cell->as_double();
         }
     }
     auto finish = std::chrono::high_resolution_clock::now();
 
-    printf("%lf\n", total_cost);
+    printf("%d rows, %lf\n", rows, total_cost);
     std::cout << (std::chrono::duration_cast<std::chrono::microseconds>(finish-start).count()) << " us\n";
     return 0;
 }
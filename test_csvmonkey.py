@@ -1,4 +1,5 @@
 
+import datetime
 import unittest
 
 import csvmonkey
@@ -21,6 +22,43 @@ class ParseTest(unittest.TestCase):
         reader = make_reader(s, delimiter=' ', header=False)
         self.assertEquals(next(reader).astuple(), tuple(s.split()))
 
+    def test_wide_rows(self):
+        rows = [tuple(str(i * j) for j in range(n)) for i, n in
+                enumerate([3, 1000, 40, 5000])]
+        s = "".join(",".join(row) + "\n" for row in rows)
+        reader = make_reader(s, header=False, yields="tuple")
+        self.assertEquals(rows, list(reader))
+
+    def test_stats(self):
+        data = 'a,b\n"x,""y",1\nz,2\n'
+        reader = make_reader(data, where={"b": "2"})
+        self.assertEquals(["z"], [row["a"] for row in reader])
+        stats = reader.stats()
+        self.assertEquals(len(data), stats["bytes"])
+        self.assertEquals(3, stats["rows"])
+        if "cells" in stats:
+            self.assertEquals(1, stats["rejected_rows"])
+            self.assertEquals(1, stats["escaped_cells"])
+
+    def test_tsv_unquoted(self):
+        reader = make_reader('a\tb\n"x\ty"\n', delimiter='\t',
+                             quotechar='\0', yields="tuple")
+        self.assertEquals([('"x', 'y"')], list(reader))
+
+    def test_unescape(self):
+        data = '"k""1",b\n"x,""y""",' + '"%s"' % ('q""' * 20) + '\n'
+        values = ('x,"y"', 'q"' * 20)
+        self.assertEquals([values], list(make_reader(data, yields="tuple")))
+        row = next(make_reader(data))
+        self.assertEquals(values, (row['k"1'], row[1]))
+        self.assertEquals({'k"1': values[0], "b": values[1]},
+                          next(make_reader(data, yields="dict")))
+        self.assertEquals([values[0]],
+                          make_reader(data).read_columns({'k"1': "S"})['k"1'])
+        reader = make_reader('a\n"x\\"y\\\\"\n', escapechar="\\",
+                             yields="tuple")
+        self.assertEquals([('x"y\\',)], list(reader))
+
 
 
 class RowTest(unittest.TestCase):
@@ -45,7 +83,908 @@ class RowTest(unittest.TestCase):
         self.assertEquals("0", row["c0"])
         self.assertRaises(KeyError, lambda: row["missing"])
 
+    def test_getitem_key_objects(self):
+        reader = self.reader()
+        row = next(reader)
+        for _ in range(3):
+            self.assertEquals(["0", "1", "2", "3"],
+                              [row["c%d" % i] for i in range(4)])
+        self.assertRaises(KeyError, lambda: row["c%d" % 4])
+
+
+class YieldsTest(unittest.TestCase):
+    DATA = "c0,c1,2x\n0,1,2\na,b,c\nshort\n"
+
+    def test_namedtuple(self):
+        rows = list(make_reader(self.DATA, yields="namedtuple"))
+        self.assertEquals([("0", "1", "2"), ("a", "b", "c"),
+                           ("short", "", "")], rows)
+        self.assertEquals(("c0", "c1", "_2"), rows[0]._fields)
+        self.assertEquals("b", rows[1].c1)
+
+    def test_namedtuple_projection(self):
+        reader = make_reader(self.DATA, yields="namedtuple",
+                             columns=["c1"])
+        self.assertEquals(["1", "b", ""], [row.c1 for row in reader])
+        self.assertRaises(ValueError,
+            lambda: make_reader(self.DATA, yields="namedtuple", header=False))
+
+    def test_reuse(self):
+        for yields in "tuple", "dict", "namedtuple":
+            reader = make_reader(self.DATA, yields=yields)
+            row = next(reader)
+            first = id(row)
+            del row
+            row = next(reader)
+            self.assertEquals(first, id(row))
+            self.assertEquals("a", row[0] if yields != "dict" else row["c0"])
+
+    def test_reuse_mutated_dict(self):
+        reader = make_reader(self.DATA, yields="dict")
+        first = next(reader)
+        del first["c0"]
+        first["other"] = 1
+        del first
+        self.assertEquals({"c0": "a", "c1": "b", "2x": "c"}, next(reader))
+        self.assertEquals({"c0": "short"}, next(reader))
+
+
+class ProjectionTest(unittest.TestCase):
+    def test_names(self):
+        reader = make_reader(EXAMPLE_FILE, columns=["c2", "c0"], yields="tuple")
+        self.assertEquals(("0", "2"), next(reader))
+        self.assertEquals(("a", "c"), next(reader))
+
+    def test_dict(self):
+        reader = make_reader(EXAMPLE_FILE, columns=["c1", "c3"], yields="dict")
+        self.assertEquals({"c1": "1", "c3": "3"}, next(reader))
+
+    def test_row_key(self):
+        reader = make_reader(EXAMPLE_FILE, columns=["c3"])
+        row = next(reader)
+        self.assertEquals("3", row["c3"])
+        self.assertRaises(KeyError, lambda: row["c0"])
+
+    def test_header(self):
+        reader = make_reader(EXAMPLE_FILE, columns=["c3", "c1"])
+        self.assertEquals(["c1", "c3"], reader.get_header())
+
+    def test_indices_no_header(self):
+        reader = make_reader('a,"b,\nb",c,d\ne,f,g,h\n', columns=[0, 2],
+                             header=False, yields="tuple")
+        self.assertEquals([("a", "c"), ("e", "g")], list(reader))
+
+    def test_skip_quoted_tail(self):
+        reader = make_reader('a,b,"c\n,d"\ne,f,g\n', columns=[0],
+                             header=False, yields="tuple")
+        self.assertEquals([("a",), ("e",)], list(reader))
+
+    def test_missing(self):
+        self.assertRaises(KeyError,
+            lambda: make_reader(EXAMPLE_FILE, columns=["nope"]))
+
+
+NUMERIC_FILE = """name,cost,qty
+a,1.5,-2
+b,0.25,3
+c,,4
+"""
+
+
+class WhereTest(unittest.TestCase):
+    def names(self, **kwargs):
+        reader = make_reader(NUMERIC_FILE, yields="tuple", **kwargs)
+        return [row[0] for row in reader]
+
+    def test_equals(self):
+        self.assertEquals(["b"], self.names(where={"name": "b"}))
+
+    def test_prefix(self):
+        self.assertEquals(["a"], self.names(where={"cost": {"prefix": "1."}}))
+
+    def test_range(self):
+        self.assertEquals(["a", "b"], self.names(where={"cost": (0, None)}))
+        self.assertEquals(["b"], self.names(where={"qty": {"min": 0,
+                                                            "max": 3}}))
+
+    def test_conjunction(self):
+        self.assertEquals(["b"], self.names(where={"cost": (0, 1),
+                                                   2: (3, 3)}))
+
+    def test_projection(self):
+        reader = make_reader(NUMERIC_FILE, columns=["name"], yields="tuple",
+                             where={"qty": (3, None)})
+        self.assertEquals([("b",), ("c",)], list(reader))
+
+    def test_quoted(self):
+        # Conditions compare unescaped values.
+        reader = make_reader('a,b\n"x,""y",1\nz,2\n', yields="tuple",
+                             where={"a": 'x,"y'})
+        self.assertEquals(["1"], [row[1] for row in reader])
+
+    def test_errors(self):
+        self.assertRaises(KeyError, lambda: self.names(where={"nope": "x"}))
+        self.assertRaises(TypeError, lambda: self.names(where={"name": 1}))
+        self.assertRaises(ValueError,
+            lambda: self.names(where={"name": {"eq": "a"}}))
+
+
+class ReadColumnsTest(unittest.TestCase):
+    def test_types(self):
+        reader = make_reader(NUMERIC_FILE)
+        cols = reader.read_columns({"cost": "f8", "qty": "i8", "name": "S"})
+        self.assertEquals([1.5, 0.25, 0.0], list(cols["cost"]))
+        self.assertEquals([-2, 3, 4], list(cols["qty"]))
+        self.assertEquals(["a", "b", "c"], cols["name"])
+
+    def test_buffer(self):
+        import struct
+        reader = make_reader(NUMERIC_FILE)
+        view = memoryview(reader.read_columns({"cost": "f8"})["cost"])
+        self.assertEquals("d", view.format)
+        self.assertEquals(8, view.itemsize)
+        self.assertEquals((3,), view.shape)
+        self.assertEquals((1.5, 0.25, 0.0),
+                          struct.unpack("=3d", view.tobytes()))
+
+    def test_max_rows(self):
+        reader = make_reader(NUMERIC_FILE)
+        self.assertEquals([-2, 3],
+                          list(reader.read_columns({"qty": "i8"}, 2)["qty"]))
+        self.assertEquals([4], list(reader.read_columns({"qty": "i8"})["qty"]))
+        self.assertEquals([], list(reader.read_columns({"qty": "i8"})["qty"]))
+
+    def test_index_no_header(self):
+        reader = make_reader("1,2\n3\n", header=False)
+        self.assertEquals([2, 0], list(reader.read_columns({1: "u8"})[1]))
+
+    def test_bad_value(self):
+        reader = make_reader(NUMERIC_FILE)
+        self.assertRaises(ValueError,
+            lambda: reader.read_columns({"qty": "u8"}))
+
+    def test_bad_type(self):
+        reader = make_reader(NUMERIC_FILE)
+        self.assertRaises(ValueError,
+            lambda: reader.read_columns({"qty": "f4"}))
+
+    def test_missing(self):
+        reader = make_reader(NUMERIC_FILE)
+        self.assertRaises(KeyError,
+            lambda: reader.read_columns({"nope": "f8"}))
+
+
+class AggregateTest(unittest.TestCase):
+    DATA = 'kind,region,cost\na,x,1.5\nb,x,2\na,y,\n"a",x,0.5\nb\n'
+
+    def test_single_key(self):
+        reader = make_reader(self.DATA)
+        result = reader.aggregate("kind", [("count", None), ("sum", "cost"),
+                                           ("min", "cost"), ("max", 2),
+                                           ("count", "cost")])
+        self.assertEquals({"a": (3, 2.0, 0.5, 1.5, 2),
+                           "b": (2, 2.0, 2.0, 2.0, 1)}, result)
+
+    def test_tuple_key(self):
+        reader = make_reader(self.DATA)
+        result = reader.aggregate(["kind", "region"], [("sum", "cost")])
+        self.assertEquals({("a", "x"): (2.0,), ("b", "x"): (2.0,),
+                           ("a", "y"): (0.0,), ("b", ""): (0.0,)}, result)
+
+    def test_no_values(self):
+        reader = make_reader(self.DATA)
+        result = reader.aggregate("region", [("min", "cost")])
+        self.assertEquals(None, result[""][0])
+
+    def test_remaining_rows(self):
+        reader = make_reader(self.DATA, yields="tuple")
+        next(reader)
+        self.assertEquals({"b": (2,), "a": (2,)},
+                          reader.aggregate("kind", [("count", None)]))
+
+    def test_where(self):
+        reader = make_reader(self.DATA, where={"region": "x"})
+        self.assertEquals({"a": (2,), "b": (1,)},
+                          reader.aggregate("kind", [("count", None)]))
+
+    def test_errors(self):
+        reader = make_reader(self.DATA)
+        self.assertRaises(KeyError,
+            lambda: reader.aggregate("nope", [("count", None)]))
+        self.assertRaises(ValueError,
+            lambda: reader.aggregate("kind", [("avg", "cost")]))
+        self.assertRaises(ValueError,
+            lambda: reader.aggregate("kind", [("sum", None)]))
+
+
+class InternTest(unittest.TestCase):
+    DATA = 'kind,id\nspot,i-1\nspot,i-2\n"sp""ot",i-3\n"sp""ot",i-1\n'
+
+    def test_rows(self):
+        for yields in "tuple", "dict":
+            rows = list(make_reader(self.DATA, yields=yields,
+                                    intern=["kind"]))
+            self.assertIs(rows[0]["kind" if yields == "dict" else 0],
+                          rows[1]["kind" if yields == "dict" else 0])
+            self.assertEquals(["spot", "spot", 'sp"ot', 'sp"ot'],
+                              [row["kind" if yields == "dict" else 0]
+                               for row in rows])
+        kinds = [row["kind"] for row in make_reader(self.DATA, intern=[0])]
+        self.assertIs(kinds[2], kinds[3])
+
+    def test_all_columns(self):
+        rows = list(make_reader(self.DATA, yields="tuple", intern=True))
+        self.assertIs(rows[0][1], rows[3][1])
+        rows = list(make_reader(self.DATA, yields="tuple"))
+        self.assertIsNot(rows[0][1], rows[3][1])
+
+    def test_projection(self):
+        rows = list(make_reader(self.DATA, yields="tuple", columns=["id"],
+                                intern=["id"]))
+        self.assertIs(rows[0][0], rows[3][0])
+
+    def test_read_columns(self):
+        reader = make_reader(self.DATA, intern=["kind"])
+        cols = reader.read_columns({"kind": "C", "id": "C", 5: "C"})
+        codes, values = cols["kind"]
+        self.assertEquals([0, 0, 1, 1], list(codes))
+        self.assertEquals(["spot", 'sp"ot'], values)
+        self.assertEquals(([0, 1, 2, 0], ["i-1", "i-2", "i-3"]),
+                          (list(cols["id"][0]), cols["id"][1]))
+        self.assertEquals([0] * 4, list(cols[5][0]))
+        self.assertEquals([""], cols[5][1])
+
+    def test_errors(self):
+        self.assertRaises(KeyError,
+            lambda: make_reader(self.DATA, intern=["nope"]))
+        self.assertRaises(TypeError, lambda: make_reader(self.DATA, intern=1))
+
+
+class InferTypesTest(unittest.TestCase):
+    DATA = ("id,price,ok,day,name,code\n"
+            "1,1.5,true,2024-01-01,a,007\n"
+            "2,3,False,2024-02-29,b,010\n"
+            ",,,,,\n")
+
+    def test_types(self):
+        reader = make_reader(self.DATA, infer_types=True)
+        self.assertEquals([int, float, bool, datetime.date, str, str],
+                          reader.types())
+        self.assertRaises(ValueError, lambda: make_reader(self.DATA).types())
+
+    def test_rows(self):
+        rows = list(make_reader(self.DATA, infer_types=True, yields="tuple"))
+        self.assertEquals([
+            (1, 1.5, True, datetime.date(2024, 1, 1), "a", "007"),
+            (2, 3.0, False, datetime.date(2024, 2, 29), "b", "010"),
+            (None, None, None, None, "", ""),
+        ], rows)
+        row = next(make_reader(self.DATA, infer_types=True, yields="dict"))
+        self.assertEquals(1.5, row["price"])
+        values = [(row["id"], row[2])
+                  for row in make_reader(self.DATA, infer_types=True)]
+        self.assertEquals([(1, True), (2, False), (None, None)], values)
+
+    def test_after_sample(self):
+        data = "a,b\n" + "".join("%d,x\n" % i for i in range(100))
+        data += "1.5,x\nfoo,x\n"
+        rows = list(make_reader(data, infer_types=10, yields="tuple",
+                                columns=["a"]))
+        self.assertEquals([(i,) for i in range(100)] + [(1.5,), ("foo",)],
+                          rows)
+        rows = list(make_reader(data, infer_types=10, chunk_rows=7,
+                                yields="tuple"))
+        self.assertEquals(102, len(rows))
+        self.assertEquals((99, "x"), rows[99])
+
+    def test_chunked_input(self):
+        # The sample spans many stream buffers.
+        reader = csvmonkey.from_iter(iter(["a\n", "1\n", "foo\n"]),
+                                     infer_types=True, yields="tuple")
+        self.assertEquals([str], reader.types())
+        self.assertEquals([("1",), ("foo",)], list(reader))
+
+        lines = ["a,b\n"] + ['%d,"x ""%d"""\n' % (i, i) for i in range(50)]
+        for chunk_rows in 0, 7:
+            reader = csvmonkey.from_iter(iter(lines + ["1.5,y\n"]),
+                                         infer_types=20, yields="tuple",
+                                         chunk_rows=chunk_rows)
+            self.assertEquals([int, str], reader.types())
+            self.assertEquals([(i, 'x "%d"' % i) for i in range(50)]
+                              + [(1.5, "y")], list(reader))
+
+        reader = csvmonkey.from_iter(iter(lines), infer_types=30)
+        for _ in range(4):
+            row = next(reader)
+        self.assertEquals('3,"x ""3"""', str(row.raw()))
+        cols = reader.read_columns({"a": "i8"})
+        self.assertEquals(range(4, 50), list(cols["a"]))
+
+    def test_read_columns(self):
+        reader = make_reader(self.DATA, infer_types=True)
+        next(reader)
+        cols = reader.read_columns({"id": None, "price": None, "day": None})
+        self.assertEquals([2, 0], list(cols["id"]))
+        self.assertEquals([3.0, 0.0], list(cols["price"]))
+        self.assertEquals(["2024-02-29", ""], cols["day"])
+        self.assertRaises(ValueError,
+            lambda: make_reader(self.DATA).read_columns({"id": None}))
+
+    def test_aggregate(self):
+        reader = make_reader(self.DATA, infer_types=True)
+        self.assertEquals({"a": (1,), "b": (1,), "": (1,)},
+                          reader.aggregate("name", [("count", None)]))
+
+
+def read_arrow(path):
+    """
+    Decode the Arrow IPC stream at path, of the column types write_arrow()
+    produces, into its field names, type ids and rows.
+    """
+    import struct
+    data = open(path, "rb").read()
+
+    def get(fmt, buf, pos):
+        return struct.unpack_from("<" + fmt, buf, pos)[0]
+
+    def field(buf, table, i, fmt="I"):
+        # Scalar field i, or the position offset field i refers to.
+        vtable = table - get("i", buf, table)
+        if 4 + (2 * i) >= get("H", buf, vtable):
+            return None
+        off = get("H", buf, vtable + 4 + (2 * i))
+        if not off:
+            return None
+        value = get(fmt, buf, table + off)
+        return (table + off + value) if fmt == "I" else value
+
+    names, types, rows = [], [], []
+    pos = 0
+    while True:
+        marker, size = struct.unpack_from("<iI", data, pos)
+        pos += 8
+        if not size:
+            break
+        meta = data[pos:pos + size]
+        root = get("I", meta, 0)
+        header = field(meta, root, 2)
+        body = pos + size
+        pos = body + field(meta, root, 3, "q")
+        if field(meta, root, 1, "B") == 1:
+            vec = field(meta, header, 1)
+            for k in range(get("I", meta, vec)):
+                f = vec + 4 + (4 * k) + get("I", meta, vec + 4 + (4 * k))
+                name = field(meta, f, 0)
+                names.append(meta[name + 4:name + 4 + get("I", meta, name)])
+                types.append(field(meta, f, 2, "B"))
+            continue
+
+        n = field(meta, header, 0, "q")
+        buffers = field(meta, header, 2)
+
+        def buf(k):
+            off, length = struct.unpack_from("<qq", meta,
+                                             buffers + 4 + (16 * k))
+            return data[body + off:body + off + length]
+
+        def bit(bits, i):
+            return bool((ord(bits[i // 8]) >> (i % 8)) & 1)
+
+        cols, k = [], 0
+        for t in types:
+            validity = buf(k)
+            values = buf(k + 1)
+            if t == 5:
+                offsets = struct.unpack("<%di" % (n + 1), values)
+                values = buf(k + 2)
+                col = [values[offsets[i]:offsets[i + 1]] for i in range(n)]
+                k += 1
+            elif t == 6:
+                col = [bit(values, i) for i in range(n)]
+            elif t == 8:
+                col = [datetime.date.fromordinal(719163 + v)
+                       for v in struct.unpack("<%di" % n, values)]
+            else:
+                col = struct.unpack("<%d%s" % (n, "q" if t == 2 else "d"),
+                                    values)
+            k += 2
+            cols.append([v if (not validity or bit(validity, i)) else None
+                         for i, v in enumerate(col)])
+        rows.extend(zip(*cols))
+    return names, types, rows
+
+
+class ArrowTest(unittest.TestCase):
+    DATA = ("id,price,ok,day,name\n"
+            "1,1.5,true,2024-01-01,a\n"
+            '2,x,False,1969-12-31,"b""q"\n'
+            ",,,,\n"
+            "3,4,TRUE,2000-02-29\n")
+
+    def write(self, reader, **kwargs):
+        import os
+        import tempfile
+        fd, path = tempfile.mkstemp(suffix=".arrow")
+        os.close(fd)
+        try:
+            count = reader.write_arrow(path, **kwargs)
+            return count, read_arrow(path)
+        finally:
+            os.unlink(path)
+
+    def test_typed(self):
+        reader = make_reader(self.DATA, infer_types=True)
+        next(reader)
+        count, (names, types, rows) = self.write(reader, batch_rows=2)
+        self.assertEquals(3, count)
+        self.assertEquals(["id", "price", "ok", "day", "name"], names)
+        self.assertEquals([2, 5, 6, 8, 5], types)
+        self.assertEquals([
+            (2, "x", False, datetime.date(1969, 12, 31), 'b"q'),
+            (None, "", None, None, ""),
+            (3, "4", True, datetime.date(2000, 2, 29), None),
+        ], rows)
+
+    def test_strings(self):
+        reader = make_reader(self.DATA, columns=["name", "id"])
+        count, (names, types, rows) = self.write(reader)
+        self.assertEquals((["id", "name"], [5, 5]), (names, types))
+        self.assertEquals([("1", "a"), ("2", 'b"q'), ("", ""), ("3", None)],
+                          rows)
+
+    def test_unparseable(self):
+        def error(data):
+            try:
+                self.write(make_reader(data, infer_types=2))
+            except IOError as e:
+                return str(e).split(": ", 2)[2]
+            self.fail("write_arrow() did not raise")
+
+        data = "a,b\n1,true\n2,false\n3,yes\n4.5,true\n"
+        self.assertEquals('row 3, column 0: "4.5" is not a valid int',
+                          error(data))
+        self.assertEquals('row 2, column 1: "yes" is not a valid bool',
+                          error(data.replace("4.5", "4")))
+        # The whole file as the sample widens the column to float instead.
+        reader = make_reader(data.replace("yes", "true"), infer_types=True)
+        count, (names, types, rows) = self.write(reader)
+        self.assertEquals([3, 6], types)
+        self.assertEquals([1.0, 2.0, 3.0, 4.5], [row[0] for row in rows])
+
+    def test_errors(self):
+        reader = make_reader("1,2\n", header=False)
+        self.assertRaises(ValueError, lambda: self.write(reader))
+        reader = make_reader(self.DATA)
+        self.assertRaises(ValueError,
+                          lambda: self.write(reader, batch_rows=0))
+
+
+class ValidateTest(unittest.TestCase):
+    DATA = ('a,b,c\n1,2,3\n4,5\n6,7,8,9\n"x"y,2,3\n10,11,12\n'
+            '1,"open,3\n13,14,15\n')
+    ERRORS = [
+        (2, 12, "row 2 at offset 12: 2 columns, expected 3"),
+        (3, 16, "row 3 at offset 16: 4 columns, expected 3"),
+        (4, 24, "row 4 at offset 24: unbalanced quote"),
+        (6, 42, "row 6 at offset 42: unbalanced quote"),
+    ]
+
+    def test_lenient(self):
+        reader = make_reader(self.DATA, yields="tuple", validate="lenient")
+        self.assertEquals([("1", "2", "3"), ("10", "11", "12"),
+                           ("13", "14", "15")], list(reader))
+        self.assertEquals(self.ERRORS, reader.errors())
+        self.assertEquals(4, reader.stats()["invalid_rows"])
+
+    def test_lenient_chunked(self):
+        reader = make_reader(self.DATA, yields="tuple", validate="lenient",
+                             chunk_rows=2, columns=["a"])
+        self.assertEquals([("1",), ("10",), ("13",)], list(reader))
+        self.assertEquals("row 3 at offset 16: more than 3 columns",
+                          reader.errors()[1][2])
+
+    def test_strict(self):
+        reader = make_reader(self.DATA, yields="tuple", validate="strict")
+        self.assertEquals(("1", "2", "3"), next(reader))
+        self.assertRaises(ValueError, lambda: next(reader))
+        self.assertEquals(self.ERRORS[:1], reader.errors())
+
+    def test_unterminated(self):
+        reader = make_reader('a,b\n1,2\n3,"4\n', validate="strict")
+        next(reader)
+        self.assertRaises(ValueError, lambda: next(reader))
+        self.assertEquals("row 2 at offset 8: unbalanced quote",
+                          reader.errors()[0][2])
+
+    def test_errors(self):
+        self.assertRaises(ValueError,
+                          lambda: make_reader(self.DATA, validate="x"))
+        # Without validate=, short and long rows are yielded as they are.
+        reader = make_reader("a,b\n1\n2,3,4\n", yields="tuple")
+        self.assertEquals([("1",), ("2", "3", "4")], list(reader))
+        self.assertEquals([], reader.errors())
+
+
+class DelimiterTest(unittest.TestCase):
+    def test_multibyte(self):
+        reader = make_reader('a||b||c\n1||"x||y"||3\n4||||"6"\n',
+                             delimiter="||", yields="tuple")
+        self.assertEquals([("1", "x||y", "3"), ("4", "", "6")], list(reader))
+
+    def test_utf8(self):
+        # U+00A6 BROKEN BAR, as exported by some mainframe tools.
+        reader = make_reader("a\xc2\xa6b\n1\xc2\xa6\xc2\xa22\n",
+                             delimiter="\xc2\xa6", yields="tuple")
+        self.assertEquals([("1", "\xc2\xa22")], list(reader))
+
+    def test_partial(self):
+        # A lone first byte of the delimiter is part of the cell.
+        reader = make_reader("a::b\nx:y::z:\n", delimiter="::",
+                             yields="tuple", chunk_rows=1)
+        self.assertEquals([("x:y", "z:")], list(reader))
+
+    def test_errors(self):
+        for delimiter in "", ";\n", '"|':
+            self.assertRaises(ValueError,
+                lambda: make_reader("a\n", delimiter=delimiter))
+
+
+class ChunkedTest(unittest.TestCase):
+    def test_iter(self):
+        reader = make_reader(EXAMPLE_FILE, chunk_rows=1, yields="tuple")
+        self.assertEquals([("0", "1", "2", "3"), ("a", "b", "c", "d")],
+                          list(reader))
+
+    def test_path(self):
+        import os
+        import tempfile
+        fd, path = tempfile.mkstemp()
+        try:
+            os.write(fd, "h1,h2\n" + "".join("%d,x%d\n" % (i, i)
+                                            for i in range(5000)))
+            os.close(fd)
+            reader = csvmonkey.from_path(path, chunk_rows=64)
+            rows = [(row["h1"], row[1]) for row in reader]
+            self.assertEquals([(str(i), "x%d" % i) for i in range(5000)],
+                              rows)
+        finally:
+            os.unlink(path)
+
+    def test_read_columns_pending(self):
+        reader = make_reader(NUMERIC_FILE, chunk_rows=2)
+        next(reader)
+        self.assertRaises(ValueError,
+            lambda: reader.read_columns({"qty": "i8"}))
+        next(reader)
+        self.assertEquals([4], list(reader.read_columns({"qty": "i8"})["qty"]))
+
+    def test_reentrant(self):
+        errors = []
+
+        def chunks():
+            yield "a\n1\n"
+            try:
+                next(reader)
+            except RuntimeError as e:
+                errors.append(e)
+            yield "2\n"
+
+        reader = csvmonkey.from_iter(chunks(), yields="tuple", chunk_rows=4)
+        self.assertEquals([("1",), ("2",)], list(reader))
+        self.assertEquals(1, len(errors))
+
+    def test_threads(self):
+        import os
+        import tempfile
+        import threading
+        fd, path = tempfile.mkstemp()
+        try:
+            os.write(fd, "h\n" + "".join("%d\n" % i for i in range(200000)))
+            os.close(fd)
+            reader = csvmonkey.from_path(path, yields="tuple", chunk_rows=64)
+            rows = []
+
+            def drain():
+                while True:
+                    try:
+                        rows.append(int(next(reader)[0]))
+                    except RuntimeError:
+                        continue
+                    except StopIteration:
+                        break
+
+            threads = [threading.Thread(target=drain) for _ in range(4)]
+            for thread in threads:
+                thread.start()
+            for thread in threads:
+                thread.join()
+            self.assertEquals(range(200000), sorted(rows))
+        finally:
+            os.unlink(path)
+
+
+class SpanTest(unittest.TestCase):
+    def test_view(self):
+        reader = make_reader(EXAMPLE_FILE)
+        row = next(reader)
+        view = memoryview(row.view("c1"))
+        self.assertTrue(view.readonly)
+        self.assertEquals("1", view.tobytes())
+        self.assertEquals("3", str(row.view(-1)))
+
+    def test_past_short_row(self):
+        reader = csvmonkey.from_iter(
+            iter(["a,b,c,d,e\n", "1,2,3,4,5\n", "p,q\n"]))
+        next(reader)
+        row = next(reader)
+        self.assertEquals("q", row[1])
+        self.assertRaises(IndexError, lambda: row[2])
+        self.assertRaises(IndexError, lambda: row.view(2))
+        self.assertRaises(IndexError, lambda: row.view("c"))
+
+    def test_raw(self):
+        reader = make_reader('a,"b\n",c\r\n\nd,e,f\n', header=False)
+        self.assertEquals('a,"b\n",c', str(next(reader).raw()))
+        self.assertEquals("d,e,f", str(next(reader).raw()))
+
+    def test_raw_chunked(self):
+        reader = make_reader(EXAMPLE_FILE, chunk_rows=8)
+        self.assertEquals(["0,1,2,3", "a,b,c,d"],
+                          [str(row.raw()) for row in reader])
+
+    def test_stale(self):
+        reader = make_reader(EXAMPLE_FILE)
+        span = next(reader).raw()
+        next(reader)
+        self.assertRaises(BufferError, lambda: str(span))
+        self.assertRaises(BufferError, lambda: memoryview(span))
+
+    def test_pinned(self):
+        reader = make_reader(EXAMPLE_FILE)
+        view = memoryview(next(reader).raw())
+        self.assertRaises(BufferError, lambda: next(reader))
+        del view
+        self.assertEquals("a", next(reader)[0])
+
+
+class WriterTest(unittest.TestCase):
+    def write(self, fn, **kwargs):
+        import StringIO
+        fp = StringIO.StringIO()
+        writer = csvmonkey.writer(fp, **kwargs)
+        fn(writer)
+        writer.flush()
+        return fp.getvalue()
+
+    def test_quoting(self):
+        out = self.write(lambda w: w.writerow(["a", "b,c", 'd"e', "f\ng", 1,
+                                               None]))
+        self.assertEquals('a,"b,c","d""e","f\ng",1,\r\n', out)
+
+    def test_matches_csv(self):
+        import csv
+        import StringIO
+        rows = [["x" * 100 + ",", ""], [""], ['"' * 70, "\r"]]
+        fp = StringIO.StringIO()
+        csv.writer(fp).writerows(rows)
+        self.assertEquals(fp.getvalue(),
+                          self.write(lambda w: w.writerows(rows)))
+
+    def test_quote_all(self):
+        import csv
+        import StringIO
+        rows = [["a", "b,c", 'd"e', 1, None], [""], ["x" * 100]]
+        fp = StringIO.StringIO()
+        csv.writer(fp, quoting=csv.QUOTE_ALL).writerows(rows)
+        self.assertEquals(fp.getvalue(),
+                          self.write(lambda w: w.writerows(rows),
+                                     quoting=csv.QUOTE_ALL))
+        reader = make_reader('a,"b ""q"" c"\n', header=False)
+        self.assertEquals('"a","b ""q"" c"\r\n',
+                          self.write(lambda w: w.writerows(reader),
+                                     quoting=csv.QUOTE_ALL))
+        self.assertRaises(ValueError, csvmonkey.writer, StringIO.StringIO(),
+                          quoting=csv.QUOTE_NONE)
+
+    def test_options(self):
+        out = self.write(lambda w: w.writerow(["a|b", "c"]), delimiter="|",
+                         quotechar="'", lineterminator="\n")
+        self.assertEquals("'a|b'|c\n", out)
+
+    def test_reader_rows(self):
+        src = 'a,"b ""q"" c",d\r\ne,f,g\n'
+        reader = make_reader(src, header=False)
+        self.assertEquals('a,"b ""q"" c",d\r\ne,f,g\r\n',
+                          self.write(lambda w: w.writerows(reader)))
+
+    def test_spans(self):
+        reader = make_reader(EXAMPLE_FILE)
+        def fn(w):
+            row = next(reader)
+            w.writeraw(row.raw())
+            w.writerow([row.view("c3"), row.view("c0")])
+        self.assertEquals("0,1,2,3\r\n3,0\r\n", self.write(fn))
+
+
+class GzipTest(unittest.TestCase):
+    DATA = "h1,h2\n" + "".join('%d,"x\n%d"\n' % (i, i) for i in range(20000))
+
+    def with_path(self, data, fn):
+        import os
+        import tempfile
+        fd, path = tempfile.mkstemp(suffix=".csv.gz")
+        try:
+            os.write(fd, data)
+            os.close(fd)
+            return fn(path)
+        finally:
+            os.unlink(path)
+
+    def compress(self, s):
+        import gzip
+        import StringIO
+        io = StringIO.StringIO()
+        fp = gzip.GzipFile(fileobj=io, mode="wb")
+        fp.write(s)
+        fp.close()
+        return io.getvalue()
+
+    def rows(self, path):
+        return [(row["h1"], row[1]) for row in csvmonkey.from_path(path)]
+
+    def expected(self, n):
+        return [(str(i), "x\n%d" % i) for i in range(n)]
+
+    def test_gzip(self):
+        rows = self.with_path(self.compress(self.DATA), self.rows)
+        self.assertEquals(self.expected(20000), rows)
+
+    def test_members(self):
+        # Each member ends inside a row, as rows may span BGZF blocks.
+        split = len(self.DATA) // 3
+        data = (self.compress(self.DATA[:split]) +
+                self.compress(self.DATA[split:]))
+        self.assertEquals(self.expected(20000),
+                          self.with_path(data, self.rows))
+
+    def test_missing(self):
+        import tempfile
+        path = tempfile.mktemp(suffix=".csv.gz")
+        self.assertRaises(IOError, lambda: csvmonkey.from_path(path))
+
+    def test_truncated(self):
+        data = self.compress(self.DATA)
+        self.assertRaises(IOError,
+            lambda: self.with_path(data[:len(data) // 2], self.rows))
+
+
+class EncodingTest(unittest.TestCase):
+    TEXT = u"h1,h2\n" + u"".join(u'%d,"\xe9\n\u4e2d%d"\n' % (i, i)
+                                 for i in range(5000))
+
+    def with_path(self, data, fn):
+        import os
+        import tempfile
+        fd, path = tempfile.mkstemp()
+        try:
+            os.write(fd, data)
+            os.close(fd)
+            return fn(path)
+        finally:
+            os.unlink(path)
+
+    def rows(self, encoding):
+        def fn(path):
+            reader = csvmonkey.from_path(path, encoding=encoding)
+            return [(row["h1"], row[1].decode("utf-8")) for row in reader]
+        return fn
+
+    def expected(self):
+        return [(str(i), u"\xe9\n\u4e2d%d" % i) for i in range(5000)]
+
+    def test_bom(self):
+        for bom, encoding in (("\xff\xfe", "utf-16-le"),
+                              ("\xfe\xff", "utf-16-be")):
+            data = bom + self.TEXT.encode(encoding)
+            self.assertEquals(self.expected(),
+                              self.with_path(data, self.rows("utf-16")))
+
+    def test_explicit(self):
+        for encoding in "utf-16-le", "utf-16-be":
+            self.assertEquals(self.expected(), self.with_path(
+                self.TEXT.encode(encoding), self.rows(encoding)))
+
+    def test_surrogates(self):
+        # Unpaired surrogates decode to U+FFFD, as with errors="replace".
+        data = u"h1,h2\n\U0001f600,\ud800x\n".encode("utf-16-le")
+        self.assertEquals([("\xf0\x9f\x98\x80", u"\ufffdx")],
+                          self.with_path(data, self.rows("utf-16-le")))
+
+    def test_errors(self):
+        self.assertRaises(ValueError, lambda: self.with_path("a\n",
+            lambda path: csvmonkey.from_path(path, encoding="latin-1")))
+        self.assertRaises(ValueError, lambda: self.with_path("\x1f\x8b\x08",
+            lambda path: csvmonkey.from_path(path, encoding="utf-16")))
+
+
+
+class DatasetTest(unittest.TestCase):
+    HEADER = "id,text\n"
+
+    def setUp(self):
+        import shutil
+        import tempfile
+        self.dir = tempfile.mkdtemp()
+        self.addCleanup(shutil.rmtree, self.dir)
+        self.write((100, 0, 3000, None, 3))
+
+    def write(self, sizes):
+        """Write files of sizes rows each, or with no header if None."""
+        self.paths = []
+        self.expected = []
+        for i, rows in enumerate(sizes):
+            path = "%s/part%d.csv" % (self.dir, i)
+            with open(path, "wb") as fp:
+                if rows is not None:
+                    fp.write(self.HEADER)
+                for j in range(rows or 0):
+                    if j % 7:
+                        text = "row %d of file %d" % (j, i)
+                        fp.write("%d,%s\n" % (j, text))
+                    else:
+                        text = 'a "%d",\nb' % i
+                        fp.write('%d,"a ""%d"",\nb"\n' % (j, i))
+                    self.expected.append((i, (str(j), text)))
+            self.paths.append(path)
+
+    def collect(self, dataset):
+        rows = []
+        dataset.for_each(lambda index, row: rows.append((index, row)))
+        return rows
+
+    def test_ordered(self):
+        # The 17MB file is cut into chunks.
+        self.write((100, 0, 700000, None, 3))
+        for threads in 1, 4:
+            dataset = csvmonkey.from_paths(self.paths, threads=threads)
+            self.assertEquals(("id", "text"), dataset.header())
+            self.assertEquals(self.expected, self.collect(dataset))
+        # Datasets may be iterated again.
+        self.assertEquals(len(self.expected), len(self.collect(dataset)))
+
+    def test_glob(self):
+        dataset = csvmonkey.from_paths(self.dir + "/part*.csv")
+        self.assertEquals(tuple(self.paths), dataset.paths())
+        self.assertEquals(self.expected, self.collect(dataset))
+        self.assertEquals((), csvmonkey.from_paths(self.dir + "/x*").paths())
+
+    def test_no_header(self):
+        dataset = csvmonkey.from_paths(self.paths[:1], header=False)
+        self.assertEquals((), dataset.header())
+        rows = self.collect(dataset)
+        self.assertEquals((0, ("id", "text")), rows[0])
+        self.assertEquals(101, len(rows))
+
+    def test_header_mismatch(self):
+        with open(self.paths[4], "wb") as fp:
+            fp.write("id,other\n1,2\n")
+        dataset = csvmonkey.from_paths(self.paths)
+        self.assertRaises(IOError, self.collect, dataset)
+        self.assertRaises(IOError, csvmonkey.from_paths(
+            [self.dir + "/missing.csv"]).header)
+
+    def test_callback_errors(self):
+        dataset = csvmonkey.from_paths(self.paths)
+
+        def fn(index, row):
+            if index == 2:
+                raise ZeroDivisionError()
+        self.assertRaises(ZeroDivisionError, dataset.for_each, fn)
 
+        def reenter(index, row):
+            dataset.for_each(reenter)
+        self.assertRaises(RuntimeError, dataset.for_each, reenter)
+        self.assertEquals(self.expected, self.collect(dataset))
 
 
 if __name__ == '__main__':
@@ -0,0 +1,1129 @@
+/*
+ * Tests for the C++ interfaces not reachable from the Python binding, which is
+ * covered by test_csvmonkey.py instead.
+ *
+ *   make check
+ */
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Checked by tests of how much the cursors copy.
+#define CSM_STATS
+#include "csvmonkey.hpp"
+
+using namespace csvmonkey;
+
+
+static int failures;
+
+
+#define CHECK(cond) \
+    if(! (cond)) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", \
+                __FILE__, __LINE__, __func__, #cond); \
+        failures++; \
+    }
+
+
+typedef std::vector<std::string> Row;
+typedef std::vector<Row> Rows;
+
+
+/**
+ * Cursor over a copy of a string, padded as StreamCursor requires.
+ */
+class StringCursor
+    : public StreamCursor
+{
+    std::string data_;
+    size_t size_;
+    size_t pos_;
+
+    public:
+    explicit StringCursor(const std::string &data)
+        : data_(data + std::string(kPadding, '\0'))
+        , size_(data.size())
+        , pos_(0)
+    {
+    }
+
+    virtual const char *buf()
+    {
+        return data_.data() + pos_;
+    }
+
+    virtual size_t size()
+    {
+        return size_ - pos_;
+    }
+
+    virtual void consume(size_t n)
+    {
+        pos_ += std::min(n, size_ - pos_);
+    }
+
+    virtual bool fill()
+    {
+        return false;
+    }
+};
+
+
+/**
+ * Cursor reading a string at most chunk bytes per fill(), so that rows span
+ * fills at every offset.
+ */
+class ChunkCursor
+    : public BufferedStreamCursor
+{
+    std::string data_;
+    size_t chunk_;
+    size_t pos_;
+
+    public:
+    ChunkCursor(const std::string &data, size_t chunk)
+        : data_(data)
+        , chunk_(chunk)
+        , pos_(0)
+    {
+    }
+
+    virtual ssize_t readmore()
+    {
+        size_t n = std::min(chunk_, data_.size() - pos_);
+        ensure(n);
+        memcpy(&vec_[write_pos_], data_.data() + pos_, n);
+        pos_ += n;
+        return n;
+    }
+};
+
+
+/**
+ * File holding data for the life of the object.
+ */
+class TempFile
+{
+    std::string path_;
+
+    public:
+    explicit TempFile(const std::string &data)
+    {
+        const char *tmpdir = getenv("TMPDIR");
+        path_ = std::string(tmpdir ? tmpdir : "/tmp") + "/csvmonkey-XXXXXX";
+        int fd = mkstemp(&path_[0]);
+        if(fd == -1) {
+            throw Error("mkstemp", strerror(errno));
+        }
+        size_t done = 0;
+        while(done < data.size()) {
+            ssize_t rc = write(fd, data.data() + done, data.size() - done);
+            if(rc <= 0) {
+                close(fd);
+                throw Error(path_.c_str(), strerror(errno));
+            }
+            done += rc;
+        }
+        close(fd);
+    }
+
+    ~TempFile()
+    {
+        unlink(path_.c_str());
+    }
+
+    const char *
+    path() const
+    {
+        return path_.c_str();
+    }
+};
+
+
+static Row
+to_row(CsvCursor &row)
+{
+    Row out;
+    for(int i = 0; i < row.count; i++) {
+        out.push_back(row.cells[i].as_str());
+    }
+    return out;
+}
+
+
+static Rows
+read_all(CsvReader &reader)
+{
+    Rows rows;
+    while(reader.read_row()) {
+        rows.push_back(to_row(reader.row()));
+    }
+    return rows;
+}
+
+
+template<typename Fn>
+static bool
+throws(Fn fn)
+{
+    try {
+        fn();
+    } catch(csvmonkey::Error &) {
+        return true;
+    }
+    return false;
+}
+
+
+static Rows
+read_path(const char *path)
+{
+    MappedFileCursor stream;
+    stream.open(path);
+    CsvReader reader(stream);
+    return read_all(reader);
+}
+
+
+/**
+ * Fixed-seed text of random cells of 0 to 80 bytes, quoted at the given
+ * percentage and then often containing delimiters, newlines and escaped
+ * quotes, so cells start and end at every offset within a vector block.
+ */
+static std::string
+random_csv(size_t size, int columns, int quoted, uint64_t seed=1)
+{
+    static const char kAlphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789 .-";
+    static const char *const kSpecial[] = {",", "\n", "\"\"", "\r\n"};
+
+    std::string out;
+    uint64_t state = seed;
+    auto next = [&](uint64_t n) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (state >> 33) % n;
+    };
+    while(out.size() < size) {
+        for(int col = 0; col < columns; col++) {
+            if(col) {
+                out += ',';
+            }
+            bool quote = (int) next(100) < quoted;
+            out += quote ? "\"" : "";
+            for(size_t n = next(81); n; n--) {
+                if(quote && !next(8)) {
+                    out += kSpecial[next(4)];
+                } else {
+                    out += kAlphabet[next(sizeof kAlphabet - 1)];
+                }
+            }
+            out += quote ? "\"" : "";
+        }
+        out += next(4) ? "\n" : "\r\n";
+    }
+    return out;
+}
+
+
+/**
+ * Rows of data parsed by a reader that configure() has set up, read whole
+ * or else chunk bytes at a time.
+ */
+template<typename Fn>
+static Rows
+read_string(const std::string &data, Fn configure, size_t chunk=0)
+{
+    StringCursor string_stream(data);
+    ChunkCursor chunk_stream(data, chunk);
+    StreamCursor &stream = chunk
+        ? (StreamCursor &) chunk_stream
+        : (StreamCursor &) string_stream;
+    CsvReader reader(stream);
+    configure(reader);
+    return read_all(reader);
+}
+
+
+/*
+ * ParallelReader.
+ */
+
+/**
+ * Rows mixing quoted newlines, escaped quotes, CRLF and quotes that appear
+ * inside unquoted cells, which CsvReader treats as data.
+ */
+static std::string
+mixed_rows(size_t size)
+{
+    static const char *const kRows[] = {
+        "%zu,plain,text\n",
+        "%zu,\"quoted\nnewline\",x\n",
+        "%zu,ab\"cd,x\n",
+        "%zu,\"esc\"\"aped\",y\r\n",
+        "%zu,5\" disk,\"a,b\"\n",
+        "%zu,\"\n\n\",\"\n\"\n",
+    };
+
+    std::string out;
+    uint64_t state = 1;
+    char buf[64];
+    for(size_t i = 0; out.size() < size; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        snprintf(buf, sizeof buf, kRows[(state >> 33) % 6], i);
+        out += buf;
+    }
+    return out;
+}
+
+
+/**
+ * Rows from a ParallelReader in file order, with the number of ranges used,
+ * checking each range starts a row.
+ */
+static Rows
+parallel_rows(const char *path, int threads, bool ordered, size_t &nranges)
+{
+    MappedFileCursor stream;
+    stream.open(path);
+    ParallelReader reader(stream, threads);
+
+    Rows rows;
+    if(ordered) {
+        reader.for_each_ordered([&](CsvCursor &row) {
+            rows.push_back(to_row(row));
+        });
+    } else {
+        std::vector<Rows> per_range(reader.max_ranges());
+        reader.for_each([&](int i, CsvCursor &row) {
+            per_range[i].push_back(to_row(row));
+        });
+        for(auto &range_rows : per_range) {
+            rows.insert(rows.end(), range_rows.begin(), range_rows.end());
+        }
+    }
+    const std::vector<ParallelReader::Range> &ranges = reader.ranges();
+    for(size_t i = 1; i < ranges.size(); i++) {
+        CHECK(ranges[i].p == ranges[i - 1].endp);
+        CHECK(ranges[i].p[-1] == '\n' || ranges[i].p[-1] == '\r');
+    }
+    nranges = ranges.size();
+    return rows;
+}
+
+
+static void
+test_parallel_reader()
+{
+    TempFile file(mixed_rows(6 << 20));
+    Rows expected = read_path(file.path());
+
+    for(int ordered = 0; ordered < 2; ordered++) {
+        for(int threads : {1, 3, 4, 6}) {
+            size_t nranges;
+            Rows rows = parallel_rows(file.path(), threads, ordered, nranges);
+            CHECK(rows == expected);
+            CHECK(nranges == (size_t) threads);
+        }
+    }
+}
+
+
+static void
+test_parallel_reader_quoted_split()
+{
+    // Every nominal split lands inside one long quoted cell whose lines each
+    // look like a row, so the only cut is at the row following it.
+    std::string data = "a,b\n1,\"";
+    while(data.size() < (4 << 20)) {
+        data += "x,\"\"y\"\"\nz,";
+    }
+    data += "\"\n2,end\n";
+    TempFile file(data);
+    Rows expected = read_path(file.path());
+    CHECK(expected.size() == 3);
+
+    size_t nranges;
+    CHECK(parallel_rows(file.path(), 4, false, nranges) == expected);
+    CHECK(nranges == 2);
+    CHECK(parallel_rows(file.path(), 4, true, nranges) == expected);
+}
+
+
+/*
+ * Spanners.
+ */
+
+/**
+ * Check spanner returns the distance to the next of "," "\"" or "\n" from
+ * every position of a buffer, or its width if none is that close.
+ */
+template<typename Spanner>
+static void
+check_spanner()
+{
+    std::string data(300 + StreamCursor::kPadding, 'x');
+    for(size_t i = 7; i < 300; i += 1 + (i % 23)) {
+        data[i] = ",\"\n"[i % 3];
+    }
+    data[299] = ',';
+
+    Spanner spanner(',', '"', '\n');
+    for(size_t i = 0; i < 300; i++) {
+        size_t next = data.find_first_of(",\"\n", i) - i;
+        CHECK(spanner(&data[i]) == std::min(next, (size_t) Spanner::kWidth));
+    }
+}
+
+
+static void
+test_spanners()
+{
+    check_spanner<StringSpannerFallback>();
+#ifdef CSM_USE_SSE42
+    check_spanner<StringSpannerSse42>();
+#endif
+#ifdef CSM_USE_AVX2
+    if(spanner_supported(kCsmSpannerAvx2)) {
+        check_spanner<StringSpannerAvx2>();
+    }
+#endif
+#ifdef CSM_USE_AVX512
+    if(spanner_supported(kCsmSpannerAvx512)) {
+        check_spanner<StringSpannerAvx512>();
+    }
+#endif
+}
+
+
+static void
+test_spanner_dispatch()
+{
+    CHECK(spanner_supported(best_spanner()));
+
+    std::string data = random_csv(1 << 20, 7, 30);
+    std::vector<int> projection = {1, 4};
+    for(int project = 0; project < 2; project++) {
+        Rows expected;
+        for(int type = kCsmSpannerFallback; type <= kCsmSpannerAvx512; type++) {
+            Rows rows = read_string(data, [&](CsvReader &reader) {
+                CHECK(reader.use_spanner((CsmSpannerType) type)
+                      == spanner_supported((CsmSpannerType) type));
+                if(project) {
+                    reader.set_projection(projection);
+                }
+            });
+            if(type == kCsmSpannerFallback) {
+                expected = rows;
+                CHECK(rows.size() > 1000);
+            }
+            CHECK(rows == expected);
+        }
+    }
+}
+
+
+/*
+ * Structural index.
+ */
+
+static void
+test_structural_index_build()
+{
+    std::string data = random_csv(5000, 5, 60);
+    data.append(StreamCursor::kPadding, '\0');
+    size_t len = data.size() - StreamCursor::kPadding;
+
+    std::vector<uint32_t> expected;
+    bool inside = false;
+    for(size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if(c == '"') {
+            inside = !inside;
+        } else if(!inside && (c == ',' || c == '\r' || c == '\n')) {
+            expected.push_back((uint32_t) i | (c == ',' ? 0
+                               : StructuralIndex::kNewline));
+        }
+    }
+
+    for(int type = kCsmSpannerFallback; type <= kCsmSpannerAvx512; type++) {
+        if(! spanner_supported((CsmSpannerType) type)) {
+            continue;
+        }
+        StructuralIndex index;
+        index.build(data.data(), len, ',', '"', (CsmSpannerType) type);
+        CHECK(std::vector<uint32_t>(index.offsets.begin(),
+                                    index.offsets.begin() + index.count)
+              == expected);
+    }
+}
+
+
+static void
+test_structural_index()
+{
+    std::string data = random_csv(1 << 20, 6, 80);
+    Rows expected = read_string(data, [](CsvReader &) {});
+    CHECK(expected.size() > 1000);
+
+    for(size_t chunk : {0, 1000, 65536}) {
+        CHECK(read_string(data, [](CsvReader &reader) {
+            CHECK(reader.use_structural_index());
+        }, chunk) == expected);
+    }
+
+    std::vector<int> projection = {0, 3};
+    CHECK(read_string(data, [&](CsvReader &reader) {
+        reader.use_structural_index();
+        reader.set_projection(projection);
+    }) == read_string(data, [&](CsvReader &reader) {
+        reader.set_projection(projection);
+    }));
+
+    StringCursor stream(data);
+    CsvReader reader(stream, ',', '"', '\\');
+    CHECK(! reader.use_structural_index());
+}
+
+
+/*
+ * Batches.
+ */
+
+static void
+test_read_batch()
+{
+    StringCursor stream("a,b,c\n1,\"x\"\"y\",3.5\n4,5\n6,,8\n9,10,11\n");
+    CsvReader reader(stream);
+    CsvBatch batch;
+
+    CHECK(reader.read_batch(batch, 4) == 4);
+    CHECK(batch.rows == 4);
+    CHECK(batch.counts[0] == 3 && batch.counts[2] == 2);
+    CHECK(batch.cell(1, 1).as_str() == "x\"y");
+    CHECK(batch.cell(1, 1).escaped && !batch.cell(1, 0).escaped);
+    CHECK(batch.cell(3, 1).size == 0);
+    CHECK(batch.cell(2, 2).size == 0);
+    CHECK(batch.columns[0].offsets[1] == 6);
+
+    size_t size;
+    const char *data = batch.row_data(2, size);
+    CHECK(std::string(data, size) == "4,5");
+
+    CsvCursor row;
+    batch.row(3, row);
+    CHECK(to_row(row) == Row({"6", "", "8"}));
+
+    double values[4];
+    batch.as_double(2, values);
+    CHECK(values[1] == 3.5 && values[3] == 8);
+
+    CHECK(reader.read_batch(batch, 4) == 1);
+    CHECK(batch.cell(0, 2).as_str() == "11");
+    CHECK(reader.read_batch(batch, 4) == 0);
+}
+
+
+static void
+test_read_batch_chunked()
+{
+    std::string data = random_csv(1 << 20, 5, 20);
+    Rows expected = read_string(data, [](CsvReader &) {});
+
+    ChunkCursor stream(data, 4000);
+    CsvReader reader(stream);
+    CsvBatch batch;
+    CsvCursor row;
+    Rows rows;
+    while(size_t n = reader.read_batch(batch, 100)) {
+        CHECK(n <= 100);
+        for(size_t i = 0; i < n; i++) {
+            batch.row(i, row);
+            rows.push_back(to_row(row));
+        }
+    }
+    CHECK(rows == expected);
+}
+
+
+/*
+ * Underrun.
+ */
+
+static void
+test_resume()
+{
+    // Byte at a time, each state of the parser underruns and resumes.
+    std::string data = random_csv(20000, 6, 50) + "\n\r\n1,\"\",,\"a\"\"\"\n";
+    std::vector<int> projection = {1, 2};
+    for(int runtime = 0; runtime < 2; runtime++) {
+        for(int project = 0; project < 2; project++) {
+            auto configure = [&](CsvReader &reader) {
+                reader.use_runtime_dialect(runtime);
+                if(project) {
+                    reader.set_projection(projection);
+                }
+            };
+            CHECK(read_string(data, configure, 1)
+                  == read_string(data, configure));
+        }
+    }
+}
+
+
+static void
+test_dialect_after_set_delimiter()
+{
+    StringCursor stream("a;b\n");
+    CsvReader reader(stream, ';');
+    reader.set_delimiter(",");
+    CHECK(reader.dialect_type() == kCsmDialectCsv);
+    reader.use_runtime_dialect();
+    reader.set_delimiter(";");
+    CHECK(reader.dialect_type() == kCsmDialectRuntime);
+    reader.set_delimiter("||");
+    CHECK(reader.dialect_type() == kCsmDialectMultiByte);
+    reader.set_delimiter(",");
+    CHECK(reader.dialect_type() == kCsmDialectRuntime);
+    reader.use_runtime_dialect(false);
+    CHECK(reader.dialect_type() == kCsmDialectCsv);
+    reader.set_delimiter(";");
+    CHECK(read_all(reader) == Rows({{"a", "b"}}));
+}
+
+
+static void
+test_utf16_odd_byte()
+{
+    // A trailing odd byte decodes to U+FFFD wherever the output buffer ends.
+    for(size_t n = 0; n < 600; n++) {
+        std::string data;
+        for(size_t i = 0; i < n; i++) {
+            data += "a";
+            data += '\0';
+        }
+        StringCursor source(data + "x");
+        StreamCursor *stream = new Utf16StreamCursor(source, kCsmUtf16Le);
+        while(stream->fill()) {
+        }
+        CHECK(std::string(stream->buf(), stream->size())
+              == std::string(n, 'a') + "\xef\xbf\xbd");
+        // Through the base class, as the Python binding does.
+        delete stream;
+    }
+}
+
+
+/**
+ * ChunkCursor counting how often its buffer is reallocated.
+ */
+class GrowthCursor
+    : public ChunkCursor
+{
+    public:
+    size_t resizes;
+
+    GrowthCursor(const std::string &data, size_t chunk)
+        : ChunkCursor(data, chunk)
+        , resizes(0)
+    {
+    }
+
+    virtual ssize_t readmore()
+    {
+        size_t size = vec_.size();
+        ssize_t rc = ChunkCursor::readmore();
+        resizes += vec_.size() != size;
+        return rc;
+    }
+};
+
+
+static void
+test_long_cell()
+{
+    std::string cell(8 << 20, 'x');
+    for(size_t i = 0; i < cell.size(); i += 1000) {
+        cell[i] = '\n';
+    }
+    GrowthCursor stream("a,b\n1,\"" + cell + "\"\n2,3\n", 1024);
+    CsvReader reader(stream);
+    Rows rows = read_all(reader);
+    CHECK(rows.size() == 3 && rows[1][1] == cell && rows[2][1] == "3");
+    // Doubling from 128KiB reaches 8MiB in about 6 steps.
+    CHECK(stream.resizes <= 8);
+}
+
+
+static void
+test_async_long_cell()
+{
+    std::string cell(4 << 20, 'x');
+    std::string data = "a,b\n1,\"" + cell + "\"\n2,3\n";
+    TempFile file(data);
+    int fd = open(file.path(), O_RDONLY);
+    CHECK(fd != -1);
+    Rows rows;
+    uint64_t moved;
+    {
+        AsyncFdStreamCursor stream(fd, 4096);
+        CsvReader reader(stream);
+        rows = read_all(reader);
+        moved = stream.stats().bytes_moved;
+    }
+    close(fd);
+    CHECK(rows.size() == 3 && rows[1][1] == cell && rows[2][1] == "3");
+    // Rejoining the whole tail on each 4KiB block would copy ~2GiB.
+    CHECK(moved < 4 * data.size());
+}
+
+
+static void
+test_row_index()
+{
+    TempFile file(mixed_rows(2 << 20));
+    Rows expected = read_path(file.path());
+    const size_t stride = 1000;
+
+    RowIndex built(stride);
+    {
+        MappedFileCursor stream;
+        stream.open(file.path());
+        CsvReader reader(stream);
+        reader.set_row_index(&built);
+        read_all(reader);
+    }
+    CHECK(built.rows() == expected.size());
+    CHECK(built.offsets().size() == (expected.size() + stride - 1) / stride);
+
+    TempFile saved("");
+    built.save(saved.path());
+    RowIndex index;
+    index.load(saved.path());
+    CHECK(index.stride() == stride && index.rows() == built.rows());
+    CHECK(index.end() == built.end() && index.offsets() == built.offsets());
+    CHECK(throws([&] { index.load(file.path()); }));
+
+    MappedFileCursor stream;
+    stream.open(file.path());
+    CHECK(index.covers(stream.size()));
+    CsvReader reader(stream);
+    for(size_t row : {(size_t) 0, stride - 1, stride, stride + 1,
+                      5 * stride, expected.size() - 1}) {
+        CHECK(reader.seek_row(index, row) && reader.read_row());
+        CHECK(to_row(reader.row()) == expected[row]);
+    }
+    CHECK(! reader.seek_row(index, expected.size()));
+
+    const std::vector<uint64_t> &offsets = index.offsets();
+    for(size_t i : {(size_t) 0, (size_t) 1, offsets.size() - 1}) {
+        CHECK(reader.seek_offset(index, offsets[i]) == (ssize_t) (i * stride));
+        CHECK(reader.read_row());
+        CHECK(to_row(reader.row()) == expected[i * stride]);
+        if(i + 1 < offsets.size()) {
+            ssize_t next = reader.seek_offset(index, offsets[i] + 1);
+            CHECK(next == (ssize_t) ((i + 1) * stride));
+        }
+    }
+    CHECK(reader.seek_offset(index, offsets.back() + 1) == -1);
+
+    for(int threads : {1, 3, 4}) {
+        MappedFileCursor mapped;
+        mapped.open(file.path());
+        ParallelReader parallel(mapped, threads);
+        parallel.use_row_index(&index);
+        Rows rows;
+        parallel.for_each_ordered([&](CsvCursor &row) {
+            rows.push_back(to_row(row));
+        });
+        CHECK(rows == expected);
+        const std::vector<ParallelReader::Range> &ranges = parallel.ranges();
+        for(size_t i = 1; i < ranges.size(); i++) {
+            uint64_t offset = ranges[i].p - ranges[0].p;
+            CHECK(std::binary_search(offsets.begin(), offsets.end(), offset));
+        }
+    }
+}
+
+
+static void
+test_direct_file()
+{
+    std::string data = mixed_rows(1 << 20);
+    data += "0,\"" + std::string(20000, 'x') + "\",z\n1,2,3";
+    TempFile file(data);
+    Rows expected = read_path(file.path());
+
+    for(size_t block_size : {(size_t) 1, (size_t) 4096, (size_t) 65536}) {
+        DirectFileCursor stream(block_size);
+        stream.open(file.path());
+        CsvReader reader(stream);
+        CHECK(read_all(reader) == expected);
+        CHECK(stream.error().empty());
+    }
+    DirectFileCursor stream;
+    CHECK(throws([&] { stream.open("/nonexistent/csvmonkey"); }));
+}
+
+
+static void
+test_map_flags()
+{
+    TempFile file(mixed_rows(4 << 20));
+    Rows expected = read_path(file.path());
+
+    for(int flags = 0; flags < 16; flags++) {
+        MappedFileCursor stream;
+        stream.open(file.path(), flags, 65536);
+        CsvReader reader(stream);
+        CHECK(read_all(reader) == expected);
+        // Dropped pages fault back in.
+        CHECK(stream.seek(0));
+        CsvReader again(stream);
+        CHECK(again.read_row() && to_row(again.row()) == expected[0]);
+    }
+}
+
+
+static void
+test_dataset_reader()
+{
+    // The third file is large enough to be cut into chunks.
+    const std::string header = "n,a,b\n";
+    std::vector<std::string> data = {
+        header + mixed_rows(1000), "", header + mixed_rows(17 << 20),
+        header, header + "1,2,3\n4,5,6\n"
+    };
+    std::vector<std::unique_ptr<TempFile>> files;
+    std::vector<std::string> paths;
+    std::vector<std::pair<int, Row>> expected;
+    for(size_t i = 0; i < data.size(); i++) {
+        files.emplace_back(new TempFile(data[i]));
+        paths.push_back(files.back()->path());
+        // MappedFileCursor cannot map empty files.
+        Rows rows = data[i].empty() ? Rows() : read_path(paths.back().c_str());
+        for(size_t j = 1; j < rows.size(); j++) {
+            expected.push_back(std::make_pair((int) i, rows[j]));
+        }
+    }
+
+    for(int threads : {1, 4}) {
+        DatasetReader ordered(paths, threads);
+        CHECK(ordered.header() == Row({"n", "a", "b"}));
+        std::vector<std::pair<int, Row>> rows;
+        ordered.for_each_ordered([&](int index, CsvCursor &row) {
+            rows.push_back(std::make_pair(index, to_row(row)));
+        });
+        CHECK(rows == expected);
+
+        DatasetReader unordered(paths, threads);
+        std::mutex mutex;
+        rows.clear();
+        unordered.for_each([&](int index, CsvCursor &row) {
+            std::lock_guard<std::mutex> lock(mutex);
+            rows.push_back(std::make_pair(index, to_row(row)));
+        });
+        CHECK(rows.size() == expected.size());
+        std::sort(rows.begin(), rows.end());
+        std::vector<std::pair<int, Row>> sorted = expected;
+        std::sort(sorted.begin(), sorted.end());
+        CHECK(rows == sorted);
+    }
+
+    TempFile other("n,x,b\n1,2,3\n");
+    paths.push_back(other.path());
+    DatasetReader mismatched(paths, 2);
+    CHECK(throws([&] {
+        mismatched.for_each_ordered([](int, CsvCursor &) {});
+    }));
+}
+
+
+/**
+ * One 8-byte round of hash_bytes().
+ */
+static uint64_t
+hash_round(uint64_t h, const char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    h = (h ^ v) * 0xff51afd7ed558ccdULL;
+    return h ^ (h >> 32);
+}
+
+
+static void
+test_header_index()
+{
+    StringCursor stream("id,\"na\"\"me\",value,id,,x\n");
+    CsvReader reader(stream);
+    CHECK(reader.read_row());
+    HeaderIndex header(reader.row(), 0, '"');
+    CHECK(header.find("id") == 0 && header.find("na\"me") == 1);
+    CHECK(header.find("value") == 2 && header.find("") == 4);
+    CHECK(header.find("x") == 5 && header.find("missing") == -1);
+    CHECK(header.find("i") == -1 && header.find("valu") == -1);
+    CHECK(header.resolve({"x", "id"}) == std::vector<int>({5, 0}));
+    CHECK(throws([&] { header.resolve({"id", "missing"}); }));
+    CHECK(HeaderIndex().find("id") == -1);
+
+    std::vector<std::string> names;
+    for(int i = 0; i < 5000; i++) {
+        names.push_back("column" + std::to_string(i % 4000));
+    }
+    HeaderIndex wide(names);
+    for(int i = 0; i < 5000; i++) {
+        CHECK(wide.find(names[i]) == i % 4000);
+    }
+    CHECK(wide.find("column4000") == -1);
+
+    // Distinct 16-byte names with equal hashes: the second half of b cancels
+    // the difference the first halves make to the state.
+    std::string a = "aaaaaaaabbbbbbbb";
+    std::string b = "cccccccc--------";
+    uint64_t h = 16 * 0x9e3779b97f4a7c15ULL;
+    uint64_t v;
+    memcpy(&v, &a[8], 8);
+    v ^= hash_round(h, &a[0]) ^ hash_round(h, &b[0]);
+    memcpy(&b[8], &v, 8);
+    CHECK(a != b && hash_bytes(a.data(), 16, 0) == hash_bytes(b.data(), 16, 0));
+    HeaderIndex colliding(std::vector<std::string> {"x", a, b, a, "y"});
+    CHECK(colliding.find(a) == 1 && colliding.find(b) == 2);
+    CHECK(colliding.find("x") == 0 && colliding.find("y") == 4);
+    CHECK(colliding.find("aaaaaaaabbbbbbbc") == -1);
+}
+
+
+/**
+ * Return each group's key and values, in order of appearance.
+ */
+static std::vector<std::pair<Row, std::vector<double>>>
+groups(const Aggregator &agg)
+{
+    std::vector<std::pair<Row, std::vector<double>>> out;
+    for(size_t g = 0; g < agg.size(); g++) {
+        const double *values = agg.values(g);
+        out.push_back(std::make_pair(agg.key(g),
+            std::vector<double>(values, values + agg.aggregates())));
+    }
+    return out;
+}
+
+
+static void
+test_parallel_aggregate()
+{
+    // Integer values keep sums exact whatever order they are added in.
+    std::string data;
+    uint64_t state = 1;
+    char buf[64];
+    while(data.size() < (4 << 20)) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned r = state >> 33;
+        const char *fmt = (r & 8) ? "\"k,%u\",%d,%d\n" : "k%u,%d,%d\n";
+        snprintf(buf, sizeof buf, fmt, r % 97, (int) (r % 1000) - 500,
+                 (int) (r >> 10) % 100);
+        if(! (r & 48)) {
+            // Leave the last value empty.
+            strcpy(strrchr(buf, ',') + 1, "\n");
+        }
+        data += buf;
+    }
+    TempFile file(data);
+
+    Aggregator serial(std::vector<int> {0});
+    serial.add_aggregate(kCsmAggregateCount);
+    serial.add_aggregate(kCsmAggregateSum, 1);
+    serial.add_aggregate(kCsmAggregateMin, 1);
+    serial.add_aggregate(kCsmAggregateMax, 2);
+    serial.add_aggregate(kCsmAggregateCount, 2);
+    {
+        MappedFileCursor stream;
+        stream.open(file.path());
+        CsvReader reader(stream);
+        serial.add_rows(reader);
+    }
+    CHECK(serial.size() == 2 * 97);
+
+    for(int threads : {1, 2, 4, 7}) {
+        Aggregator parallel = serial.empty_copy();
+        MappedFileCursor stream;
+        stream.open(file.path());
+        ParallelReader reader(stream, threads);
+        parallel.add_rows(reader);
+        // Ranges are at least 1MiB, so 7 threads get only 4.
+        CHECK(reader.ranges().size() == (size_t) std::min(threads, 4));
+        CHECK(groups(parallel) == groups(serial));
+    }
+}
+
+
+/*
+ * Numeric conversions.
+ */
+
+static double
+as_double(const char *s)
+{
+    return parse_double(s, strlen(s));
+}
+
+
+static void
+test_parse_double()
+{
+    // Correct rounding, on and off the fast path.
+    CHECK(as_double("0.1") == 0.1);
+    CHECK(as_double("9007199254740993") == 9007199254740992.0);
+    CHECK(as_double("1.7976931348623157e308") == 1.7976931348623157e308);
+    CHECK(as_double("2.2250738585072011e-308") == 2.2250738585072011e-308);
+    CHECK(as_double("4.9e-324") == 4.9e-324);
+    CHECK(as_double("0.3000000000000000000000000001") == 0.3);
+    CHECK(as_double("123456789012345678901234567890") == 1.2345678901234568e29);
+    CHECK(as_double("1e309") == HUGE_VAL);
+    CHECK(as_double("-1e309") == -HUGE_VAL);
+    CHECK(as_double("1e-400") == 0);
+
+    // Signs, blanks and special values.
+    CHECK(as_double("-2.5") == -2.5 && as_double("+2.5") == 2.5);
+    CHECK(std::signbit(as_double("-0")));
+    CHECK(as_double(" \t7.25") == 7.25);
+    CHECK(as_double("-inf") == -HUGE_VAL && as_double("Infinity") == HUGE_VAL);
+    CHECK(std::isnan(as_double("nan")));
+    CHECK(as_double(".5") == 0.5 && as_double("5.") == 5);
+
+    // Parsing stops at the first byte that cannot continue the number, and
+    // never reads beyond size.
+    CHECK(as_double("12abc") == 12);
+    CHECK(as_double("1.5e") == 1.5 && as_double("1e+") == 1);
+    CHECK(as_double("2.5 ") == 2.5);
+    CHECK(parse_double("1.25e3", 4) == 1.25);
+    CHECK(parse_double("123456789012345678901", 3) == 123);
+    CHECK(as_double("") == 0 && as_double("abc") == 0 && as_double("-") == 0);
+
+    // Agreement with strtod() across magnitudes and digit counts.
+    uint64_t state = 1;
+    char buf[64];
+    for(int i = 0; i < 100000; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        int digits = 1 + (int) ((state >> 20) % 25);
+        int exponent = (int) ((state >> 8) % 700) - 350;
+        snprintf(buf, sizeof buf, "%.*ge%d", digits,
+                 (double) (state >> 11) / (1ULL << 53), exponent);
+        if(as_double(buf) != strtod(buf, 0)) {
+            fprintf(stderr, "parse_double(\"%s\")\n", buf);
+            CHECK(as_double(buf) == strtod(buf, 0));
+            break;
+        }
+    }
+}
+
+
+static void
+test_parse_integers()
+{
+    CHECK(parse_int64("-9223372036854775808", 20) == INT64_MIN);
+    CHECK(parse_int64("9223372036854775807", 19) == INT64_MAX);
+    CHECK(throws([]() { parse_int64("9223372036854775808", 19); }));
+    CHECK(throws([]() { parse_int64("-9223372036854775809", 20); }));
+    CHECK(parse_int64(" +42x", 5) == 42);
+    CHECK(parse_int64("-17.9", 5) == -17);
+    CHECK(parse_int64("1234", 2) == 12);
+    CHECK(parse_int64("", 0) == 0 && parse_int64("x", 1) == 0);
+
+    CHECK(parse_uint64("18446744073709551615", 20) == UINT64_MAX);
+    CHECK(throws([]() { parse_uint64("18446744073709551616", 20); }));
+    CHECK(throws([]() { parse_uint64("-1", 2); }));
+    CHECK(parse_uint64("-0", 2) == 0);
+    CHECK(parse_uint64("\t7", 2) == 7);
+}
+
+
+static void
+test_parse_decimal()
+{
+    // Rounding is half away from zero.
+    CHECK(parse_decimal("12.345", 6, 2) == 1235);
+    CHECK(parse_decimal("-12.345", 7, 2) == -1235);
+    CHECK(parse_decimal("12.344", 6, 2) == 1234);
+    CHECK(parse_decimal("0.005", 5, 2) == 1);
+    CHECK(parse_decimal("0.0049", 6, 2) == 0);
+    CHECK(parse_decimal("12", 2, 3) == 12000);
+    CHECK(parse_decimal("1.5e2", 5, 0) == 150);
+    CHECK(parse_decimal("-0.00", 5, 2) == 0);
+    CHECK(parse_decimal(" 3.10 ", 6, 2) == 310);
+    CHECK(parse_decimal("1e-30", 5, 2) == 0);
+    CHECK(parse_decimal("", 0, 2) == 0 && parse_decimal("n/a", 3, 2) == 0);
+    CHECK(parse_decimal("92233720368547758.07", 20, 2) == INT64_MAX);
+    CHECK(throws([]() { parse_decimal("92233720368547758.08", 20, 2); }));
+    CHECK(throws([]() { parse_decimal("1e30", 4, 0); }));
+
+    // Batch conversions match the per-cell ones.
+    StringCursor stream("1.005,7,-3\n2.5,-8,4\n");
+    CsvReader reader(stream);
+    CsvBatch batch;
+    CHECK(reader.read_batch(batch, 10) == 2);
+    int64_t decimals[2] = {0, 0};
+    batch.as_decimal(0, 2, decimals);
+    CHECK(decimals[0] == 101 && decimals[1] == 250);
+    int64_t ints[2] = {0, 0};
+    batch.as_int64(1, ints);
+    CHECK(ints[0] == 7 && ints[1] == -8);
+    uint64_t uints[2];
+    CHECK(throws([&]() { batch.as_uint64(2, uints); }));
+}
+
+
+static const struct {
+    const char *name;
+    void (*fn)();
+} kTests[] = {
+    {"parallel_reader", test_parallel_reader},
+    {"parallel_reader_quoted_split", test_parallel_reader_quoted_split},
+    {"spanners", test_spanners},
+    {"spanner_dispatch", test_spanner_dispatch},
+    {"structural_index_build", test_structural_index_build},
+    {"structural_index", test_structural_index},
+    {"read_batch", test_read_batch},
+    {"read_batch_chunked", test_read_batch_chunked},
+    {"resume", test_resume},
+    {"dialect_after_set_delimiter", test_dialect_after_set_delimiter},
+    {"utf16_odd_byte", test_utf16_odd_byte},
+    {"long_cell", test_long_cell},
+    {"async_long_cell", test_async_long_cell},
+    {"row_index", test_row_index},
+    {"parallel_aggregate", test_parallel_aggregate},
+    {"dataset_reader", test_dataset_reader},
+    {"header_index", test_header_index},
+    {"direct_file", test_direct_file},
+    {"map_flags", test_map_flags},
+    {"parse_double", test_parse_double},
+    {"parse_integers", test_parse_integers},
+    {"parse_decimal", test_parse_decimal},
+};
+
+
+int main(int argc, char **argv)
+{
+    int failed = 0;
+    for(auto &test : kTests) {
+        if(argc > 1 && strcmp(argv[1], test.name)) {
+            continue;
+        }
+        int before = failures;
+        try {
+            test.fn();
+        } catch(csvmonkey::Error &e) {
+            fprintf(stderr, "%s: %s\n", test.name, e.what());
+            failures++;
+        } catch(std::exception &e) {
+            fprintf(stderr, "%s: %s\n", test.name, e.what());
+            failures++;
+        }
+        bool ok = failures == before;
+        failed += !ok;
+        printf("%s: %s\n", test.name, ok ? "ok" : "FAILED");
+    }
+    return failed ? 1 : 0;
+}